@@ -0,0 +1,154 @@
+/**
+ *  @file          AnalysisCache.h
+ *
+ *  @version       1.0
+ *  @created       05/10/2013 10:03:17 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *
+ *  Per function analysis results, keyed by the structural hash of the
+ *  function and persisted across runs. An unchanged function costs one
+ *  hash computation and a lookup instead of LoopInfo, ScalarEvolution
+ *  and the cost model.
+ *
+ *  Layout of the cache file, all integers in host byte order:
+ *
+ *    magic, version, nsummaries, nhotness
+ *    nsummaries x {hash, cost, nloops, nblocks,
+ *                  nloops x {parent, trip count}, nblocks x innermost loop}
+ *    nhotness x {key, hotness}
+ *
+ */
+
+#ifndef __ANALYSIS_CACHE_H_
+#define __ANALYSIS_CACHE_H_
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "llvm/Pass.h"
+#include "llvm/PassManager.h"
+#include "llvm/Function.h"
+#include "llvm/Module.h"
+#include "llvm/ADT/DenseMap.h"
+
+#include "analyzer/CostModel.h"
+
+namespace llvm {
+
+#define ANALYSISCACHE_MAGIC "PSANCACH"
+#define ANALYSISCACHE_MAGIC_LEN 8
+#define ANALYSISCACHE_VERSION 1
+
+#define NOCOST ((unsigned) -1)
+
+struct LoopSummary {
+  int32_t parent;      // -1 for a top level loop
+  uint32_t trip_count; // 0 if unknown
+};
+
+/// What the risk model needs to know about a function
+struct FunctionSummary {
+  std::vector<LoopSummary> loops;
+  std::vector<int32_t> block_loop; // innermost loop of each basic block, -1 if none
+  unsigned cost; // CostModel::getFunctionCost, NOCOST until computed
+  FunctionSummary() : cost(NOCOST) {}
+
+  int loopOf(unsigned block) const
+  {
+    return block < block_loop.size() ? block_loop[block] : -1;
+  }
+  bool inLoop(unsigned block) const { return loopOf(block) >= 0; }
+};
+
+/// Computes the loop part of a FunctionSummary from LoopInfo and
+/// ScalarEvolution
+struct FunctionSummarizer : public FunctionPass {
+  static char ID;
+  static const char * PassName;
+
+  FunctionSummary * summary; // where the next run goes
+  DenseMap<const BasicBlock *, unsigned> * block_ids;
+
+  FunctionSummarizer() : FunctionPass(ID), summary(NULL), block_ids(NULL) {}
+
+  virtual bool runOnFunction(Function &F);
+  virtual const char * getPassName() const { return PassName; }
+  virtual void getAnalysisUsage(AnalysisUsage &AU) const;
+};
+
+/// Not thread safe: every thread needs its own cache, which can be
+/// merged before saving.
+class AnalysisCache {
+  private:
+    struct ModuleSummarizer {
+      FunctionPassManager * manager;
+      FunctionSummarizer * summarizer;
+    };
+
+    std::map<uint64_t, FunctionSummary> summaries;
+    std::map<uint64_t, unsigned> hotness; // see hotnessKey in Evaluator.cpp
+
+    // Only valid as long as the modules are loaded, see forget
+    DenseMap<const Function *, uint64_t> hashes;
+    DenseMap<const BasicBlock *, unsigned> block_ids;
+    std::map<Module *, ModuleSummarizer> summarizers;
+
+  public:
+    unsigned hits;
+    unsigned misses;
+
+  public:
+    AnalysisCache() : hits(0), misses(0) {}
+    ~AnalysisCache() { forget(); }
+
+    /// Add the entries of the cache file fname. A missing file is an
+    /// empty cache.
+    bool load(const char * fname);
+    bool save(const char * fname) const;
+
+    /// Add the entries of other
+    void merge(const AnalysisCache & other);
+
+    /// Drop everything that refers to loaded functions. Must be called
+    /// before a module is freed.
+    void forget();
+
+    uint64_t hash(const Function * F);
+
+    /// Position of BB in its function
+    unsigned blockId(const BasicBlock * BB);
+
+    /// Summary of F, computed on a miss
+    const FunctionSummary & summarize(Function * F);
+
+    /// CostModel::getFunctionCost of F, computed on a miss
+    unsigned functionCost(Function * F, CostModel * model);
+
+    bool lookupHotness(uint64_t key, unsigned & hot) const;
+    void insertHotness(uint64_t key, unsigned hot) { hotness[key] = hot; }
+
+    size_t size() const { return summaries.size(); }
+};
+
+} // End of llvm namespace
+
+#endif /* __ANALYSIS_CACHE_H_ */
@@ -47,17 +47,21 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/InstIterator.h"
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
 
+#include "analyzer/AnalysisCache.h"
 #include "analyzer/CostModel.h"
 #include "commons/LLVMHelper.h"
 #include "commons/CallSiteFinder.h"
+#include "commons/Profile.h"
 #include "dependence/DepGraphBuilder.h"
 #include "slicer/Slicer.h"
 #include "llvmslicer/StaticSlicer.h"
 
 #include <map>
+#include <stdio.h>
 
 namespace llvm {
 
@@ -94,42 +98,64 @@ const char * toExpStr(Expensiveness exp);
 
 #define CALLERHOT 10 // threshold of how many callers is a function defined hot
 
-// Nasty class to retain the LoopInfo that would otherwise be
-// destroyed after runOnFunction.
-//
-// It only retain certain information of the loop. Currently
-// the User of it is to query whether a Basic Block is in a Given 
-// Function's loop.
-struct DummyLoopInfo : public FunctionPass {
+#define EXPPERCENTILE 90 // percentile of call cost above which a function is expensive
+
+#define HOTPERCENTILE 90 // percentile of call frequency above which a function is hot
+
+/// Tunable thresholds of the risk model. The percentiles only matter
+/// for profiles that carry weights, see CompiledProfile::setCutoffs.
+struct RiskThresholds {
+  unsigned tight_loop;   // trip count above which a loop is tight
+  unsigned inst_exp;     // cost above which an instruction is expensive
+  unsigned caller_hot;   // number of callers above which a function is hot
+  double exp_percentile; 
+  double hot_percentile;
+
+  RiskThresholds() : tight_loop(LOOPCOUNTTIGHT), inst_exp(INSTEXP), 
+    caller_hot(CALLERHOT), exp_percentile(EXPPERCENTILE), 
+    hot_percentile(HOTPERCENTILE) {}
+
+  /// Set a threshold from a KEY=VALUE string, where KEY is one of
+  /// loop, inst, callers, exppct and hotpct
+  bool parse(const char * arg);
+};
+
+// Caller side facts of a module that don't change from one evaluation
+// to the next: the reverse call graph and the caller hotness computed
+// so far. Whether a call site sits in a loop comes from the function
+// summaries of the AnalysisCache. Keep one per module and hand it to
+// every RiskEvaluator on that module.
+class CallerHotnessCache {
   private:
-    typedef SmallPtrSet<const BasicBlock *, 4> LoopBBTy;
-    typedef std::map<const Function *, LoopBBTy> LoopMapTy;
-    typedef LoopMapTy::iterator iterator;
-    typedef LoopMapTy::const_iterator const_iterator;
-    LoopMapTy LoopMap;
+    typedef std::pair<const Function *, int> HotKeyTy;
+    CallerGraph graph;
+    AnalysisCache * analysis;
+    bool own_analysis;
+    std::map<HotKeyTy, Hotness> hotness;
 
   public:
+    unsigned hits;
+    unsigned misses;
 
-  static char ID;
-  static const char * PassName; 
-  
-  DummyLoopInfo() : FunctionPass(ID) {
-  }
-
-  bool inLoop(const Function * F, const BasicBlock * BB)
-  {
-    iterator I = LoopMap.find(F);
-    if (I == LoopMap.end())
-      return false;
-    return I->second.count(BB); 
-  }
-
-  virtual bool runOnFunction(Function &F);
-  virtual const char * getPassName() const { return PassName; }
-  virtual void getAnalysisUsage(AnalysisUsage &AU) const {
-    AU.setPreservesAll();
-    AU.addRequired<LoopInfo>();
-  }
+  public:
+    /// Without an analysis cache, a private one is used that only
+    /// lives as long as this. A lazily loaded module needs the call
+    /// index of the whole module, see CallerGraph.
+    CallerHotnessCache(Module * module, AnalysisCache * analysis = NULL, 
+        const CallIndex * calls = NULL);
+    ~CallerHotnessCache();
+
+    const CallerGraph & getCallerGraph() const { return graph; }
+    AnalysisCache * getAnalysisCache() const { return analysis; }
+
+    /// Whether callsite is inside a loop of its function
+    bool inLoop(const Instruction * callsite);
+
+    bool lookup(const Function * func, int level, Hotness & hot);
+    void insert(const Function * func, int level, Hotness hot)
+    {
+      hotness[std::make_pair(func, level)] = hot;
+    }
 };
 
 class RiskEvaluator: public FunctionPass {
@@ -142,36 +168,34 @@ class RiskEvaluator: public FunctionPass {
     InstMapTy m_inst_map;
     slicing::StaticSlicer *slicer;
     CostModel * cost_model;
-    Profile * profile;
-    FunctionPassManager * func_manager;
+    CompiledProfile * profile;
     Module * module;
-    SmallPtrSet<const Function *, 4> loop_analyzed;
-    LoopInfo * LocalLI;
-    //LoopInfo * GlobalLI;
-    DummyLoopInfo * GlobalLI;
-    ScalarEvolution *SE;
+    const FunctionSummary * summary; // of the function being evaluated
+    CallerHotnessCache * callers;
+    bool own_callers;
     unsigned AllRiskStat[RISKLEVELS];
     unsigned FuncRiskStat[RISKLEVELS];
     unsigned level; // denote the level of the analysis
     unsigned depth; // denote the depth of tracing up
+    FILE * out; // where the risk summaries go
+    RiskThresholds thresholds;
 
   public:
     static char ID;
     static const char * PassName; 
 
     RiskEvaluator(InstMapTy & inst_map, slicing::StaticSlicer * slicer = NULL, CostModel * model = NULL, 
-        Profile * profile = NULL, Module * module = NULL, unsigned level = 1, 
-        unsigned depth = 2) : FunctionPass(ID), m_inst_map(inst_map), slicer(slicer),
-        cost_model(model), profile(profile), func_manager(NULL), 
-        module(module), LocalLI(NULL), SE(NULL), level(level), depth(depth)
+        CompiledProfile * profile = NULL, Module * module = NULL, unsigned level = 1, 
+        unsigned depth = 2, FILE * out = stdout, CallerHotnessCache * callers = NULL) : 
+        FunctionPass(ID), m_inst_map(inst_map), slicer(slicer), cost_model(model), 
+        profile(profile), module(module), summary(NULL), callers(callers), 
+        own_callers(false), level(level), depth(depth), out(out)
     {
       memset(AllRiskStat, 0, sizeof(AllRiskStat));
       memset(FuncRiskStat, 0, sizeof(FuncRiskStat));
-      if (module) {
-        func_manager = new FunctionPassManager(module);
-        GlobalLI = new DummyLoopInfo();
-        func_manager->add(GlobalLI);
-        func_manager->doInitialization();
+      if (callers == NULL && module) {
+        this->callers = new CallerHotnessCache(module);
+        own_callers = true;
       }
     }
 
@@ -179,28 +203,30 @@ class RiskEvaluator: public FunctionPass {
     {
       //TODO don't put it here
       statAllRisk();
-      if (func_manager) {
-        func_manager->doFinalization();
-        delete func_manager;
-      }
+      if (own_callers)
+        delete callers;
     }
 
     virtual const char *getPassName() const { return PassName;}
 
-    virtual bool runOnFunction(Function &F); 
+    void setThresholds(const RiskThresholds & t) { thresholds = t; }
 
-    RiskLevel assess(const Instruction *I, std::map<Loop *, unsigned> & LoopDepthMap, Hotness FuncHotness);
+    virtual bool runOnFunction(Function &F); 
 
-    unsigned getLoopDepth(Loop *L, std::map<Loop *, unsigned> & LoopDepthMap);
+    RiskLevel assess(const Instruction *I, Hotness FuncHotness);
 
-    Hotness calcInstHotness(const Instruction *I, std::map<Loop *, unsigned> & LoopDepthMap);
+    Hotness calcInstHotness(const Instruction *I);
     Hotness calcFuncHotness(const Function * func);
     Hotness calcFuncHotness(const char * funcName);
+    Hotness calcFuncHotness(const ProfileEntry & entry);
     Hotness calcCallerHotness(const Function * func, int level = 3);
+    Hotness traceCallerHotness(const Function * func, int level);
+    uint64_t callerHotnessKey(const Function * func, int level);
 
     Expensiveness calcInstExp(const Instruction *I);
     Expensiveness calcFuncExp(const Function * func);
     Expensiveness calcFuncExp(const char * funcName);
+    Expensiveness calcFuncExp(const ProfileEntry & entry);
 
     bool isPerfSensitive(const BranchInst *I);
 
@@ -209,14 +235,15 @@ class RiskEvaluator: public FunctionPass {
     void statAllRisk();
 
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+      // Loops and trip counts come from the AnalysisCache, which
+      // only runs LoopInfo and ScalarEvolution on a miss
       AU.setPreservesAll();
-      AU.addRequired<LoopInfo>();
-      AU.addRequired<ScalarEvolution>(); 
       //AU.addRequired<DepGraphBuilder>();
     }
   
   private:
     inline void statPrint(unsigned stat[RISKLEVELS]);
+    const FunctionSummary & summaryOf(const Instruction *I);
 
 };
 
@@ -31,9 +31,14 @@
 #define __CALL_SITE_FINDER__H_
 
 #include "llvm/Function.h"
+#include "llvm/Module.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 
+#include <map>
+#include <string>
 #include <utility>
+#include <vector>
 
 namespace llvm {
 
@@ -60,6 +65,49 @@ class CallSiteFinder {
         inline size_t size() { return callsites.size(); }
 };
 
+// Names of the direct callers of every function of a module. It tells
+// which bodies to read for the callers of a function when the module
+// is loaded lazily.
+typedef StringMap<std::vector<std::string> > CallIndex;
+
+void buildCallIndex(const Module * module, CallIndex & index);
+
+// Reverse call graph of a whole module: the direct call sites of every
+// function, collected in one pass over the module instead of walking
+// the uses of each function on every query. With a call index, the
+// call sites of a function are only collected on its first query, from
+// its callers materialized at that point.
+class CallerGraph {
+    public:
+        typedef CallSiteFinder::CallInfo CallInfo;
+        typedef SmallVector<CallInfo, 4> CallerVecTy;
+        typedef CallerVecTy::const_iterator const_cs_iterator;
+
+    protected:
+        // node based, the lazy queries must not move earlier results
+        mutable std::map<const Function *, CallerVecTy> callers;
+        CallerVecTy none;
+        Module * module;
+        const CallIndex * index;
+
+    public:
+        CallerGraph(Module * module, const CallIndex * index = NULL);
+
+        inline const_cs_iterator begin(const Function * func) const { return get(func).begin(); }
+        inline const_cs_iterator end(const Function * func) const { return get(func).end(); }
+
+    protected:
+        const CallerVecTy & get(const Function * func) const
+        {
+          std::map<const Function *, CallerVecTy>::const_iterator I = callers.find(func);
+          if (I != callers.end())
+            return I->second;
+          return index ? collect(func) : none;
+        }
+
+        const CallerVecTy & collect(const Function * func) const;
+};
+
 } // End of llvm namespace
 
 #endif
@@ -0,0 +1,67 @@
+/**
+ *  @file          FunctionHash.h
+ *
+ *  @version       1.0
+ *  @created       05/10/2013 09:12:40 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *
+ *  Structural hash of a function, stable across runs and contexts
+ *
+ */
+
+#ifndef __FUNCTION_HASH_H_
+#define __FUNCTION_HASH_H_
+
+#include <stdint.h>
+
+#include "llvm/Function.h"
+#include "llvm/BasicBlock.h"
+#include "llvm/Module.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace llvm {
+
+/// Hash the body of F: its signature, and the opcode, type and operands
+/// of every instruction. Locals are hashed by their position, globals by
+/// their name, and debug info is left out, so moving a function around
+/// in its file keeps its hash. If block_ids is given, it receives the
+/// position of every basic block of F.
+uint64_t hashFunction(const Function * F,
+    DenseMap<const BasicBlock *, unsigned> * block_ids = NULL);
+
+/// Hash the globals, aliases and functions of M, in order, with the
+/// initializers of the globals in full. Two modules with the same hash
+/// have their values at the same positions.
+uint64_t hashModule(const Module * M);
+
+/// Fold v into the hash h
+inline uint64_t hashCombine(uint64_t h, uint64_t v)
+{
+  h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  return h;
+}
+
+uint64_t hashString(uint64_t h, StringRef s);
+
+} // End of llvm namespace
+
+#endif /* __FUNCTION_HASH_H_ */
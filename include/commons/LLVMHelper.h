@@ -31,9 +31,11 @@
 #define __LLVMHELPER_H_
 
 #include <iostream>
+#include <stdint.h>
 #include <string>
 #include <vector>
 #include <map>
+#include <algorithm>
 
 #include "llvm/Module.h"
 #include "llvm/PassRegistry.h"
@@ -47,12 +49,17 @@ struct ModuleArg {
   std::string name;
   Module *module;
   int strips;
-  ModuleArg(std::string n, Module *m = NULL, int s = 0) : name(n), module(m), strips(s) {}
+  bool lazy; // function bodies are read on demand, see materialize
+  ModuleArg(std::string n, Module *m = NULL, int s = 0) : name(n), module(m), strips(s), 
+    lazy(false) {}
 };
 
-#define HOTTYPES 5
+#define HOTTYPES 6
 
-enum SpeFuncType {INVALIDTYPE, SYSCALL, LOCKCALL, EXPCALL, FREQCALL};
+// SAMPLED lists functions that only carry weights, see FuncWeight
+enum SpeFuncType {INVALIDTYPE, SYSCALL, LOCKCALL, EXPCALL, FREQCALL, SAMPLED};
+
+#define SPEMASK(type) (1U << (type))
 
 SpeFuncType fromSpeTypeName(const char * name);
 
@@ -61,6 +68,25 @@ const char * toSpeFuncName(const SpeFuncType type);
 
 typedef std::map<SpeFuncType, std::vector<std::string> > Profile;
 
+/// Measured weights of a function, e.g., sample counts from perf.
+/// Zero means unknown.
+struct FuncWeight {
+  uint64_t self;      // samples in the function itself
+  uint64_t inclusive; // samples in the function and its callees
+  uint64_t calls;     // number of calls
+  FuncWeight() : self(0), inclusive(0), calls(0) {}
+  FuncWeight(uint64_t s, uint64_t i, uint64_t c) : self(s), inclusive(i), calls(c) {}
+  bool empty() const { return self == 0 && inclusive == 0 && calls == 0; }
+  void merge(const FuncWeight & w)
+  {
+    self = std::max(self, w.self);
+    inclusive = std::max(inclusive, w.inclusive);
+    calls = std::max(calls, w.calls);
+  }
+};
+
+typedef std::map<std::string, FuncWeight> ProfileWeights;
+
 /// Infer the level of strips in the module.
 /// The algorithm is to use the length of longest 
 /// common prefix in the CUs inside the module
@@ -71,7 +97,15 @@ size_t count_strips(Module * M);
 ///
 /// On error, messages are written to stderr
 /// and null is returned.
-Module *ReadModule(LLVMContext &Context, StringRef Name);
+///
+/// A lazy module only has its globals and metadata
+/// read, function bodies are left in the bitcode
+/// until they are materialized.
+Module *ReadModule(LLVMContext &Context, StringRef Name, bool lazy = false);
+
+/// Read the body of F if it was left in the bitcode.
+/// Returns false on error.
+bool materialize(Function *F);
 
 /// Get the TargetMachine representing the executing
 /// machine's architecture
@@ -90,7 +124,11 @@ void indent(raw_ostream & OS, int space);
 #define PROFILE_SEGMENT_TYPE(type) #type
 #define PROFILE_SEGMENT_END "===="
 
-bool parseProfile(const char *fname, Profile &profile);
+/// Function lines may carry weights as tab separated fields:
+///   NAME[\tSELF[\tINCLUSIVE[\tCALLS]]]
+#define PROFILE_WEIGHT_SEP '\t'
+
+bool parseProfile(const char *fname, Profile &profile, ProfileWeights *weights = NULL);
 
 } // End of llvm namespace
 
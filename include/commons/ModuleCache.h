@@ -0,0 +1,122 @@
+/**
+ *  @file          ModuleCache.h
+ *
+ *  @version       1.0
+ *  @created       05/18/2013 02:26:51 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *  
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *     
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *  
+ *  Modules loaded on demand under a memory budget
+ *
+ */
+
+#ifndef __MODULE_CACHE_H_
+#define __MODULE_CACHE_H_
+
+#include <stddef.h>
+#include <list>
+#include <vector>
+
+#include "llvm/LLVMContext.h"
+#include "llvm/Module.h"
+
+#include "commons/LLVMHelper.h"
+
+namespace llvm {
+
+/// Whatever is derived from a module and must go with it, e.g., its
+/// matcher or its slicer. Owned by the cache entry of the module.
+class ModuleState {
+  public:
+    virtual ~ModuleState() {}
+
+    /// Rough bytes taken, counted against the budget of the cache
+    virtual size_t footprint() const { return 0; }
+};
+
+/// Rough bytes taken by the materialized part of M and by its context,
+/// which is assumed to be private to M. Debug metadata is not counted.
+size_t moduleFootprint(const Module * M);
+
+/// The modules of a ModuleArg vector, loaded on first use and evicted
+/// in least recently used order when their estimated footprint goes
+/// over a budget. Every module is loaded in a context of its own, so
+/// that evicting it also frees the types and constants it created.
+/// Subclasses tell how to load a module and what else to drop when one
+/// is evicted; they must call clear in their destructor. Not thread safe.
+class ModuleCache {
+  private:
+    struct Entry {
+      ModuleState * state;
+      LLVMContext * context; // owned, private to the module
+      size_t footprint;
+      bool cached;
+      std::list<unsigned>::iterator pos; // in lru
+      Entry() : state(NULL), context(NULL), footprint(0), cached(false) {}
+    };
+
+    std::vector<ModuleArg> & mods;
+    std::vector<Entry> entries;
+    std::list<unsigned> lru; // most recently used first
+    size_t budget; // 0 means no limit
+    size_t used;
+
+  public:
+    unsigned hits;
+    unsigned misses;
+    unsigned evictions;
+
+  public:
+    /// Modules of mods that are already loaded are adopted, along with
+    /// their context, which must not be shared with any other module
+    ModuleCache(std::vector<ModuleArg> & mods, size_t budget = 0);
+    virtual ~ModuleCache() {}
+
+    /// Module #id, loaded on a miss, NULL if it can't be. It becomes
+    /// the most recently used one.
+    Module * get(unsigned id);
+
+    ModuleState * getState(unsigned id) const { return entries[id].state; }
+    void setState(unsigned id, ModuleState * state);
+
+    /// Estimate the footprint of #id again, it grows as functions are
+    /// materialized, and evict other modules until under budget
+    void update(unsigned id);
+
+    /// Drop every module and its state
+    void clear();
+
+    size_t footprint() const { return used; }
+
+  protected:
+    /// Load mod.module in context, a fresh one owned by the cache
+    virtual bool load(unsigned id, ModuleArg & mod, LLVMContext & context) = 0;
+
+    /// Drop whatever else refers to mod.module, right before it's deleted
+    /// along with its context
+    virtual void release(unsigned id, ModuleArg & mod) {}
+
+  private:
+    void drop(unsigned id);
+};
+
+} // End of llvm namespace
+
+#endif /* __MODULE_CACHE_H_ */
@@ -0,0 +1,51 @@
+/**
+ *  @file          Parallel.h
+ *
+ *  @version       1.0
+ *  @created       05/02/2013 10:12:37 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *
+ *  A minimal worker pool on top of pthreads
+ *
+ */
+
+#ifndef __PARALLEL_H_
+#define __PARALLEL_H_
+
+/// A batch of independent jobs numbered [0, n).
+class ParallelTask {
+  public:
+    virtual ~ParallelTask() {}
+
+    /// Process job #index. worker is the id in [0, threads) of the
+    /// thread running it, so that per-worker state can be indexed by it.
+    virtual void run(unsigned index, unsigned worker) = 0;
+};
+
+/// Number of online processors, at least 1.
+unsigned hardware_threads();
+
+/// Run the n jobs of task on at most threads workers and wait for all
+/// of them to finish. Jobs are handed out in increasing index order;
+/// with threads <= 1 they are run inline on the calling thread.
+void parallel_for(ParallelTask & task, unsigned n, unsigned threads);
+
+#endif /* __PARALLEL_H_ */
@@ -0,0 +1,122 @@
+/**
+ *  @file          Profile.h
+ *
+ *  @version       1.0
+ *  @created       05/04/2013 03:16:52 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *  
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *     
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *  
+ *  Profile compiled for constant time lookup by function name
+ *
+ */
+
+#ifndef __PROFILE_H_
+#define __PROFILE_H_
+
+#include "llvm/Function.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include "commons/LLVMHelper.h"
+#include "commons/ProfileDB.h"
+
+namespace llvm {
+
+/// What a profile knows about a function
+struct ProfileEntry {
+  unsigned mask;     // SPEMASK of the segments it is in
+  FuncWeight weight;
+  ProfileEntry() : mask(0) {}
+  void merge(const ProfileEntry & e)
+  {
+    mask |= e.mask;
+    weight.merge(e.weight);
+  }
+};
+
+/// Maps every name of a Profile to what the profile says about it.
+/// Symbol names from the IR are demangled once and memoized, so
+/// lookups don't demangle on the hot path. Names may also come from
+/// a ProfileDB, which is shared read-only. Not thread safe: give every
+/// thread its own CompiledProfile.
+///
+/// Weighted functions are classified by percentile cutoffs over all
+/// the weights in the profile, see setCutoffs.
+class CompiledProfile {
+  private:
+    StringMap<ProfileEntry> names;   // name as in the profile
+    StringMap<ProfileEntry> symbols; // symbol name in the IR
+    const ProfileDB * db;
+    uint64_t cost_cutoff; // 0 means no cutoff
+    uint64_t freq_cutoff;
+
+  public:
+    CompiledProfile() : db(NULL), cost_cutoff(0), freq_cutoff(0) {}
+    CompiledProfile(const Profile & profile, const ProfileWeights * weights = NULL,
+        const ProfileDB * db = NULL) : db(db), cost_cutoff(0), freq_cutoff(0)
+    { 
+      add(profile); 
+      if (weights)
+        add(*weights);
+    }
+
+    void add(const Profile & profile);
+    void add(const ProfileWeights & weights);
+    void add(StringRef name, SpeFuncType type);
+
+    bool empty() const { return names.empty() && (db == NULL || db->size() == 0); }
+
+    /// Entry of a name spelled as in the profile
+    ProfileEntry lookupName(StringRef name) const;
+
+    /// Entry of a (possibly mangled) symbol name
+    const ProfileEntry & lookup(StringRef symbol);
+
+    const ProfileEntry & lookup(const Function * func)
+    {
+      static const ProfileEntry none;
+      return func ? lookup(func->getName()) : none;
+    }
+
+    /// Cost of one call: inclusive samples (self if unknown) per call
+    static uint64_t callCost(const FuncWeight & w);
+    /// How often a function runs: its calls, self samples if unknown
+    static uint64_t callFreq(const FuncWeight & w);
+
+    /// Set the cutoffs to the given percentiles, in [0, 100], of the
+    /// weighted functions. A percentile <= 0 disables its cutoff.
+    void setCutoffs(double cost_percentile, double freq_percentile);
+
+    bool isCostly(const ProfileEntry & e) const
+    {
+      return cost_cutoff && callCost(e.weight) >= cost_cutoff;
+    }
+    bool isFrequent(const ProfileEntry & e) const
+    {
+      return freq_cutoff && callFreq(e.weight) >= freq_cutoff;
+    }
+
+    /// The first segment type in mask, INVALIDTYPE if none
+    static SpeFuncType firstType(unsigned mask);
+};
+
+} // End of llvm namespace
+
+#endif /* __PROFILE_H_ */
@@ -0,0 +1,129 @@
+/**
+ *  @file          ProfileDB.h
+ *
+ *  @version       1.0
+ *  @created       05/06/2013 09:42:15 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *  
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *     
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *  
+ *  Binary profile database. The names of a profile are stored in a
+ *  minimal perfect hash table (hash and displace) that is mapped into
+ *  memory as is, so opening a database costs no parsing at all.
+ *
+ *  Layout, all integers in host byte order:
+ *
+ *    ProfileDBHeader
+ *    int32_t  displacements[nbuckets]
+ *    ProfileDBEntry slots[nslots]
+ *    char     strings[strsize]
+ *
+ */
+
+#ifndef __PROFILEDB_H_
+#define __PROFILEDB_H_
+
+#include <stdint.h>
+
+#include "llvm/ADT/StringRef.h"
+
+#include "commons/LLVMHelper.h"
+
+namespace llvm {
+
+#define PROFILEDB_MAGIC "PSPROFDB"
+#define PROFILEDB_MAGIC_LEN 8
+#define PROFILEDB_VERSION 2
+
+struct ProfileDBHeader {
+  char magic[PROFILEDB_MAGIC_LEN];
+  uint32_t version;
+  uint32_t nentries;
+  uint32_t nbuckets;
+  uint32_t nslots;
+  uint32_t disp_off;
+  uint32_t slot_off;
+  uint32_t str_off;
+  uint32_t str_size;
+};
+
+struct ProfileDBEntry {
+  uint32_t name_off; // into the string pool
+  uint32_t name_len; // 0 for an empty slot
+  uint32_t mask;     // SPEMASK of the segments the name is in
+  uint32_t reserved;
+  uint64_t self;     // FuncWeight of the name
+  uint64_t inclusive;
+  uint64_t calls;
+};
+
+class ProfileDB {
+  private:
+    void * base;
+    size_t length;
+    const ProfileDBHeader * header;
+    const int32_t * disps;
+    const ProfileDBEntry * slots;
+    const char * strings;
+
+  public:
+    ProfileDB() : base(NULL), length(0), header(NULL), disps(NULL), slots(NULL), 
+      strings(NULL) {}
+    ~ProfileDB() { close(); }
+
+    /// Map the database in fname. On error, messages are written 
+    /// to stderr and false is returned.
+    bool open(const char * fname);
+    void close();
+
+    /// Mask of the segments name is in, 0 if it isn't in the profile
+    unsigned lookup(StringRef name) const
+    {
+      const ProfileDBEntry * E = find(name);
+      return E ? E->mask : 0;
+    }
+
+    /// The entry of name, NULL if it isn't in the profile
+    const ProfileDBEntry * find(StringRef name) const;
+
+    unsigned size() const { return header ? header->nentries : 0; }
+
+    // Raw slots, for dumping. Empty slots have an empty name.
+    unsigned slot_size() const { return header ? header->nslots : 0; }
+    StringRef slot_name(unsigned i) const 
+    { 
+      return StringRef(strings + slots[i].name_off, slots[i].name_len); 
+    }
+    unsigned slot_mask(unsigned i) const { return slots[i].mask; }
+    FuncWeight slot_weight(unsigned i) const 
+    { 
+      return FuncWeight(slots[i].self, slots[i].inclusive, slots[i].calls); 
+    }
+};
+
+/// Whether fname starts with the magic of a profile database
+bool isProfileDB(const char * fname);
+
+/// Compile profile, and the weights if given, into a database file
+bool writeProfileDB(const char * fname, const Profile & profile, 
+    const ProfileWeights * weights = NULL);
+
+} // End of llvm namespace
+
+#endif /* __PROFILEDB_H_ */
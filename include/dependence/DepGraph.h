@@ -40,6 +40,7 @@
 
 #include "graph/Graph.h"
 #include "graph/Container.h"
+#include "graph/CSRGraph.h"
 #include "graph/DFSIter.h"
 #include "dependence/Dependence.h"
 
@@ -50,9 +51,9 @@ typedef GraphNode<Instruction *, MemDepType> DepNode;
 typedef Graph<Instruction *, MemDepType> DependenceGraph;
 typedef DFSIterator<Instruction *, MemDepType> DepDFSIter;
 
-typedef Node<Instruction *> InstNode;
-
-typedef MapGraphBase<Instruction *> MemDepGraph;
+/// Memory dependences are only added while the graph is built, then frozen
+typedef CSRGraph<Instruction *> MemDepGraph;
+typedef MemDepGraph::NodeType InstNode;
 
 
 template<>
@@ -83,19 +84,19 @@ struct GraphConcept<MemDepGraph>
   }
   static in_iterator in_begin(MemDepGraph *graph, NodeType *node) 
   {
-    return node->in_begin();
+    return graph->in_begin(node);
   }
   static in_iterator in_end(MemDepGraph *graph, NodeType *node)
   {
-    return node->in_end();
+    return graph->in_end(node);
   }
   static out_iterator out_begin(MemDepGraph *graph, NodeType *node)
   {
-    return node->out_begin();
+    return graph->out_begin(node);
   }
-  static out_iterator out_end(MemDepGraph *grap, NodeType *node)
+  static out_iterator out_end(MemDepGraph *graph, NodeType *node)
   {
-    return node->out_end();
+    return graph->out_end(node);
   }
 };
 
@@ -20,8 +20,10 @@
 #include <set>
 
 #include "llvm/ADT/EquivalenceClasses.h"
+#include "llvm/ADT/ilist.h"
 #include "llvm/Function.h"
 
+#include "dsa/DSNodePool.h"
 #include "dsa/DSNode.h"
 #include "dsa/DSCallGraph.h"
 
@@ -29,6 +31,15 @@ namespace llvm {
 
 class TargetData;
 class GlobalValue;
+class DSNode;
+
+/// ilist_traits<DSNode> - Nodes come from the pool of their graph, so that
+/// is where a node erased from the Nodes list goes back to.
+template<> struct ilist_traits<DSNode> : public ilist_default_traits<DSNode> {
+  static DSNode *createSentinel();
+  static void destroySentinel(DSNode *N);
+  static void deleteNode(DSNode *N);
+};
 
 //===----------------------------------------------------------------------===//
 /// DSScalarMap - An instance of this class is used to keep track of all of
@@ -42,15 +53,20 @@ class GlobalValue;
 /// globals or unique node handles active in the function.
 ///
 class DSScalarMap {
-  typedef std::map<const Value*, DSNodeHandle> ValueMapTy;
+  typedef std::map<const Value*, DSNodeHandle, std::less<const Value*>,
+    DSPoolAllocator<std::pair<const Value* const, DSNodeHandle> > > ValueMapTy;
   ValueMapTy ValueMap;
 
-  typedef std::set<const GlobalValue*> GlobalSetTy;
+  typedef std::set<const GlobalValue*, std::less<const GlobalValue*>,
+    DSPoolAllocator<const GlobalValue*> > GlobalSetTy;
   GlobalSetTy GlobalSet;
 
   EquivalenceClasses<const GlobalValue*> &GlobalECs;
 public:
-  DSScalarMap(EquivalenceClasses<const GlobalValue*> &ECs) : GlobalECs(ECs) {}
+  DSScalarMap(EquivalenceClasses<const GlobalValue*> &ECs, DSNodePool *Pool)
+    : ValueMap(ValueMapTy::key_compare(), ValueMapTy::allocator_type(Pool)),
+      GlobalSet(GlobalSetTy::key_compare(), GlobalSetTy::allocator_type(Pool)),
+      GlobalECs(ECs) {}
 
   EquivalenceClasses<const GlobalValue*> &getGlobalECs() const { return GlobalECs; }
 
@@ -221,6 +237,7 @@ private:
 
   bool UseAuxCalls;      // Should this pass use the Aux calls vector?
 
+  DSNodePool *Pool;      // Memory of the nodes and the scalar map
   NodeListTy Nodes;
   ScalarMapTy ScalarMap;
 
@@ -260,10 +277,7 @@ public:
   // Create a new, empty, DSGraph.
   DSGraph(EquivalenceClasses<const GlobalValue*> &ECs, const TargetData &td,
           SuperSet<Type*>& tss,
-          DSGraph *GG = 0) 
-    :GlobalsGraph(GG), UseAuxCalls(false), 
-     ScalarMap(ECs), TD(td), TypeSS(tss)
-  { }
+          DSGraph *GG = 0);
 
   // Copy ctor - If you want to capture the node mapping between the source and
   // destination graph, you may optionally do this by specifying a map to record
@@ -327,6 +341,10 @@ public:
   void addNode(DSNode *N) { Nodes.push_back(N); }
   void unlinkNode(DSNode *N) { Nodes.remove(N); }
 
+  /// getNodePool - The memory the nodes of this graph are allocated from.
+  ///
+  DSNodePool &getNodePool() const { return *Pool; }
+
   /// getScalarMap - Get a map that describes what the nodes the scalars in this
   /// function point to...
   ///
@@ -632,6 +650,12 @@ public:
   /// removeDeadNodes.
   ///
   void removeTriviallyDeadNodes();
+
+  /// resolveForwarding - Point every handle of the graph past forwarded
+  /// nodes.  getNode() updates a handle that still goes through one, so this
+  /// must be done before the graph is read by several threads at once.
+  ///
+  void resolveForwarding();
 };
 
 
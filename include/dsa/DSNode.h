@@ -16,9 +16,12 @@
 
 #include <map>
 #include <set>
+#include <vector>
 
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/PointerUnion.h"
 #include "llvm/ADT/ilist_node.h"
+#include "llvm/Support/Atomic.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -26,6 +29,7 @@
 #include "dsa/super_set.h"
 #include "dsa/keyiterator.h"
 #include "dsa/DSGraph.h"
+#include "dsa/DSNodePool.h"
 #include "dsa/DSSupport.h"
 
 namespace llvm {
@@ -42,11 +46,16 @@ class DSNodeIterator;          // Data structure graph traversal iterator
 ///
 class DSNode : public ilist_node<DSNode> {
 public:
-  typedef std::map<unsigned, SuperSet<Type*>::setPtr> TyMapTy;
-  typedef std::map<unsigned, DSNodeHandle> LinkMapTy;
+  typedef std::map<unsigned, SuperSet<Type*>::setPtr, std::less<unsigned>,
+    DSPoolAllocator<std::pair<const unsigned, SuperSet<Type*>::setPtr> > >
+    TyMapTy;
+  typedef std::map<unsigned, DSNodeHandle, std::less<unsigned>,
+    DSPoolAllocator<std::pair<const unsigned, DSNodeHandle> > > LinkMapTy;
+  typedef svset<const GlobalValue*, std::less<const GlobalValue*>,
+    DSPoolAllocator<const GlobalValue*> > GlobalSetTy;
 
 private:
-  friend struct ilist_sentinel_traits<DSNode>;
+  friend struct ilist_traits<DSNode>;
   //Sentinel
   DSNode() : NumReferrers(0), Size(0), NodeType(0) {}
   
@@ -54,7 +63,7 @@ private:
   /// this is a forwarding node, then this is the number of node handles which
   /// are still forwarding over us.
   ///
-  unsigned NumReferrers;
+  sys::cas_flag NumReferrers;
 
   /// ForwardNH - This NodeHandle contain the node (and offset into the node)
   /// that this node really is.  When nodes get folded together, the node to be
@@ -68,9 +77,11 @@ private:
   ///
   unsigned Size;
 
-  /// ParentGraph - The graph this node is currently embedded into.
+  /// ParentGraph - The graph this node is currently embedded into.  Once the
+  /// node forwards, the pool of the graph it was unlinked from, which it goes
+  /// back to when the last handle forwarding over it is dropped.
   ///
-  DSGraph *ParentGraph;
+  PointerUnion<DSGraph*, DSNodePool*> ParentGraph;
 
   /// TyMap - Keep track of the loadable types and offsets those types are seen
   // at.
@@ -83,7 +94,7 @@ private:
 
   /// Globals - The list of global values that are merged into this node.
   ///
-  svset<const GlobalValue*> Globals;
+  GlobalSetTy Globals;
 
   void operator=(const DSNode &); // DO NOT IMPLEMENT
   DSNode(const DSNode &);         // DO NOT IMPLEMENT
@@ -139,6 +150,12 @@ public:
   DSNode(const DSNode &, DSGraph *G, bool NullLinks = false);
   ~DSNode();
 
+  /// operator new - Nodes live in the pool of the graph they are created in,
+  /// so they must be created with new (G) DSNode(G, ...).
+  ///
+  static void *operator new(size_t Size, DSGraph *G);
+  static void operator delete(void *P, DSGraph *G);
+
   // Iterator for graph interface... Defined in DSGraphTraits.h
   typedef DSNodeIterator<DSNode> iterator;
   typedef DSNodeIterator<const DSNode> const_iterator;
@@ -180,8 +197,12 @@ public:
   /// return the number of nodes forwarding over the node!
   unsigned getNumReferrers() const { return NumReferrers; }
 
+  /// SharedGraphs - Number of closures running with graphs read by several
+  /// threads at once.  Cloning out of a graph adds handles to its nodes, so
+  /// referrers are counted atomically while this is not zero.
+  static volatile sys::cas_flag SharedGraphs;
 
-  DSGraph *getParentGraph() const { return ParentGraph; }
+  DSGraph *getParentGraph() const { return ParentGraph.dyn_cast<DSGraph*>(); }
   void setParentGraph(DSGraph *G) { ParentGraph = G; }
 
   /// getForwardNode - This method returns the node that this node is forwarded
@@ -196,14 +217,7 @@ public:
   /// stopForwarding - When the last reference to this forwarding node has been
   /// dropped, delete the node.
   ///
-  void stopForwarding() {
-    assert(isForwarding() &&
-           "Node isn't forwarding, cannot stopForwarding()!");
-    ForwardNH.setTo(0, 0);
-    assert(ParentGraph == 0 &&
-           "Forwarding nodes must have been removed from graph!");
-    delete this;
-  }
+  void stopForwarding();
 
   void growSize(unsigned NSize) {
     assert(NSize >= Size && "Cannot shrink");
@@ -344,7 +358,7 @@ public:
   /// value leaders set that is merged into this node.  Like the getGlobalsList
   /// method, these iterators do not return globals that are part of the
   /// equivalence classes for globals in this node, but aren't leaders.
-  typedef svset<const GlobalValue*>::const_iterator globals_iterator;
+  typedef GlobalSetTy::const_iterator globals_iterator;
   globals_iterator globals_begin() const { return Globals.begin(); }
   globals_iterator globals_end() const { return Globals.end(); }
 
@@ -449,10 +463,26 @@ public:
 private:
   friend class DSNodeHandle;
 
+  void addReferrer() {
+    if (SharedGraphs) sys::AtomicIncrement(&NumReferrers);
+    else ++NumReferrers;
+  }
+
+  /// dropReferrer - Return the number of referrers left.
+  unsigned dropReferrer() {
+    if (SharedGraphs) return sys::AtomicDecrement(&NumReferrers);
+    return --NumReferrers;
+  }
+
   // static mergeNodes - Helper for mergeWith()
   static void MergeNodes(DSNodeHandle& CurNodeH, DSNodeHandle& NH);
 };
 
+inline void DSNodePool::destroy(DSNode *N) {
+  N->~DSNode();
+  deallocate(N, sizeof(DSNode));
+}
+
 //===----------------------------------------------------------------------===//
 // Define inline DSNodeHandle functions that depend on the definition of DSNode
 //
@@ -478,11 +508,11 @@ inline DSNode *DSNodeHandle::getNode() const {
 
 inline void DSNodeHandle::setTo(DSNode *n, unsigned NewOffset) const {
   assert((!n || !n->isForwarding()) && "Cannot set node to a forwarded node!");
-  if (N) getNode()->NumReferrers--;
+  if (N) getNode()->dropReferrer();
   N = n;
   Offset = NewOffset;
   if (N) {
-    N->NumReferrers++;
+    N->addReferrer();
     if (Offset >= N->Size) {
       assert((Offset == 0 || N->Size == 1) &&
              "Pointer to non-collapsed node with invalid offset!");
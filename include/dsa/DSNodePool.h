@@ -0,0 +1,128 @@
+//===- DSNodePool.h - Memory of data structure graphs -----------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file was developed by the LLVM research group and is distributed under
+// the University of Illinois Open Source License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The per-graph pool that data structure graphs allocate from, and the STL
+// allocator that lets the containers of a graph draw from it.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_ANALYSIS_DSNODEPOOL_H
+#define LLVM_ANALYSIS_DSNODEPOOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Allocator.h"
+
+namespace llvm {
+
+class DSNode;
+
+//===----------------------------------------------------------------------===//
+/// DSNodePool - The memory of a graph: its nodes, their links, types and
+/// globals, and its scalar map.  Blocks are carved out of slabs, a freed
+/// block is reused by the next block of the same size, and the slabs are only
+/// given back with the pool, all at once.  When a graph takes the nodes of
+/// another (spliceFrom), it takes its pool along.
+///
+class DSNodePool {
+  enum { SmallWords = 32 };
+
+  BumpPtrAllocator Slabs;
+  void *FreeSmall[SmallWords];          // Freed blocks by size in words,
+  DenseMap<size_t, void*> FreeLarge;    // linked through their first word.
+  std::vector<DSNodePool*> Adopted;
+
+  DSNodePool(const DSNodePool &);      // DO NOT IMPLEMENT
+  void operator=(const DSNodePool &);  // DO NOT IMPLEMENT
+
+  static size_t words(size_t Size) {
+    return Size ? (Size + sizeof(void*) - 1) / sizeof(void*) : 1;
+  }
+  void *&freeList(size_t Words) {
+    return Words < SmallWords ? FreeSmall[Words] : FreeLarge[Words];
+  }
+public:
+  DSNodePool() { std::fill(FreeSmall, FreeSmall + SmallWords, (void*)0); }
+  ~DSNodePool();
+
+  void *allocate(size_t Size) {
+    size_t Words = words(Size);
+    void *&Free = freeList(Words);
+    if (void *P = Free) {
+      Free = *static_cast<void**>(P);
+      return P;
+    }
+    return Slabs.Allocate(Words * sizeof(void*), 8);
+  }
+
+  /// deallocate - Keep P for the next block of Size bytes.  P may come from
+  /// an adopted pool.
+  void deallocate(void *P, size_t Size) {
+    void *&Free = freeList(words(Size));
+    *static_cast<void**>(P) = Free;
+    Free = P;
+  }
+
+  /// destroy - Run the destructor of N and keep its memory.
+  inline void destroy(DSNode *N);
+
+  /// adopt - Take ownership of P, whose memory now belongs to our graph.
+  void adopt(DSNodePool *P) { Adopted.push_back(P); }
+};
+
+/// DSPoolAllocator - STL allocator drawing from the pool of a graph, or from
+/// the heap when it has none (the sentinel of the node list).  Containers
+/// must be created with the allocator of the graph they belong to; copying
+/// one container into another keeps the allocator of the destination.
+///
+template<typename T>
+class DSPoolAllocator {
+public:
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T &reference;
+  typedef const T &const_reference;
+  typedef T value_type;
+  template<typename U> struct rebind { typedef DSPoolAllocator<U> other; };
+
+  DSNodePool *Pool;
+
+  DSPoolAllocator(DSNodePool *P = 0) : Pool(P) {}
+  template<typename U>
+  DSPoolAllocator(const DSPoolAllocator<U> &A) : Pool(A.Pool) {}
+
+  pointer address(reference X) const { return &X; }
+  const_pointer address(const_reference X) const { return &X; }
+
+  pointer allocate(size_type N, const void * = 0) {
+    if (Pool) return static_cast<pointer>(Pool->allocate(N * sizeof(T)));
+    return static_cast<pointer>(::operator new(N * sizeof(T)));
+  }
+  void deallocate(pointer P, size_type N) {
+    if (Pool) Pool->deallocate(P, N * sizeof(T));
+    else ::operator delete(P);
+  }
+  size_type max_size() const { return size_type(-1) / sizeof(T); }
+
+  void construct(pointer P, const T &V) { new (P) T(V); }
+  void destroy(pointer P) { P->~T(); }
+
+  bool operator==(const DSPoolAllocator &RHS) const { return Pool == RHS.Pool; }
+  bool operator!=(const DSPoolAllocator &RHS) const { return Pool != RHS.Pool; }
+};
+
+} // End llvm namespace
+
+#endif
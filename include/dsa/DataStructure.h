@@ -98,6 +98,8 @@ protected:
   
   void formGlobalFunctionList();
 
+  unsigned closureThreads(Module &M);
+
   DataStructures(char & id, const char* name) 
     : ModulePass(id), TD(0), GraphSource(0), printname(name), GlobalsGraph(0) {  
     // For now, the graphs are owned by this pass
@@ -258,6 +260,13 @@ private:
   typedef std::map<const Function*, unsigned> TarjanMap;
   typedef std::vector<const Function*>        TarjanStack;
   typedef svset<const Function*>              FuncSet;
+  typedef std::map<const Function*, FuncSet>  CalleeMap;
+  typedef DenseSet<const DSGraph*>            GraphSet;
+
+  // An SCC of the call graph inlined by parallelInline, and the waves of
+  // SCCs it inlines at the same time.
+  struct SCCTask;
+  class SCCWave;
 
   void postOrderInline (Module & M);
   unsigned calculateGraphs (const Function *F,
@@ -265,7 +274,14 @@ private:
                             unsigned & NextID,
                             TarjanMap & ValMap);
 
+  void parallelInline(Module &M, TarjanMap &ValMap, unsigned Threads);
+  unsigned findSCCs(const Function *F, TarjanStack &Stack, unsigned &NextID,
+                    TarjanMap &Index, CalleeMap &Callees,
+                    std::vector<SCCTask> &SCCs);
+
   void calculateGraph(DSGraph* G);
+  void inlineCallees(DSGraph* G, const GraphSet *Ready = 0);
+  void finishGraph(DSGraph* G);
 
   void CloneAuxIntoGlobal(DSGraph* G);
 
@@ -382,7 +398,14 @@ private:
   void markReachableFunctionsExternallyAccessible(DSNode *N,
                                                   DenseSet<DSNode*> &Visited);
 
+  // The graphs of one level of inlineInWaves
+  class CallerWave;
+
   void InlineCallersIntoGraph(DSGraph* G);
+  void prepareCallers(DSGraph* G, std::vector<CallerCallEdge> &Edges);
+  void inlineCallers(DSGraph* G, std::vector<CallerCallEdge> &Edges);
+  void finishGraph(DSGraph* G);
+  void inlineInWaves(std::vector<DSGraph*> &PostOrder, unsigned Threads);
   void ComputePostOrder(const Function &F, DenseSet<DSGraph*> &Visited,
                         std::vector<DSGraph*> &PostOrder);
 };
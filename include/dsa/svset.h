@@ -49,6 +49,10 @@ public:
   svset()
   : container_() { }
 
+  /// Empty constructor drawing from the given allocator.
+  explicit svset(const Alloc& alloc)
+  : container_(alloc) { }
+
   /// Constructor taking a range.
   template< typename Iterator >
   svset(const Iterator& begin, const Iterator& end)
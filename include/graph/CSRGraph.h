@@ -0,0 +1,255 @@
+/**
+ *  @file          include/graph/CSRGraph.h
+ *
+ *  @version       1.0
+ *  @created       06/02/2013 10:12:37 AM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *
+ *  Compressed sparse row graph.
+ *
+ *  The graph is built by adding edges between values, which number the nodes
+ *  in the order they are first seen, and is then frozen: the edges are laid
+ *  out in one contiguous array per direction, indexed by node number, in the
+ *  order they were added. A frozen graph can't be changed any more, but costs
+ *  two allocations per direction instead of a node and two vectors per value.
+ *
+ */
+
+#ifndef __CSRGRAPH_H_
+#define __CSRGRAPH_H_
+
+#include <cassert>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "graph/Container.h"
+#include "graph/Graph.h"
+#include "graph/Node.h"
+
+namespace llvm {
+
+template <typename NodeValTy>
+class CSRNode {
+  private:
+    NodeValTy val;
+    unsigned id; // position of the node in the graph
+
+  public:
+    CSRNode(NodeValTy & v, unsigned i) : val(v), id(i) {}
+
+    inline unsigned getId() const { return id; }
+    inline const NodeValTy & getNodeVal() const { return val; }
+    inline const NodeValTy * getNodeValPtr() const { return &val; }
+
+    inline void print(raw_ostream &OS)
+    {
+      OS << *myptr(val) << "\n"; // use myptr to support both pointer and reference val
+    }
+};
+
+//-=================================================================================-
+// Class: CSRGraph - Frozen graph with contiguous in and out edges
+//
+// Nodes and edges can only be added before freeze(), and the graph can only be
+// traversed after it. Node pointers are stable from then on.
+//-----------------------------------------------------------------------------------
+
+template <typename NodeValTy, typename EdgeValTy = NoneNoneType>
+class CSRGraph: public GraphBase<NodeValTy> {
+  public:
+    typedef GraphBase<NodeValTy> super;
+    typedef CSRNode<NodeValTy> NodeType;
+    typedef typename std::vector<NodeType *>::const_iterator in_iterator;
+    typedef typename std::vector<NodeType *>::const_iterator out_iterator;
+
+    class node_iterator: public iterator_adapter<typename std::vector<NodeType>::iterator> {
+      typedef iterator_adapter<typename std::vector<NodeType>::iterator> super;
+      public:
+        node_iterator() : super() {}
+        node_iterator(const typename std::vector<NodeType>::iterator & ni) : super(ni) {}
+        NodeType *operator*() const
+        {
+          return &*this->_current;
+        }
+    };
+
+  private:
+    typedef DenseMap<NodeValTy, unsigned> IdMapTy;
+
+    IdMapTy ids;
+    std::vector<NodeType> nodes;
+    bool frozen;
+
+    // Edges added so far, by node number, until freeze()
+    std::vector<std::pair<unsigned, unsigned> > pending;
+    std::vector<EdgeValTy> pending_vals;
+
+    // Edges of node i are [offsets[i], offsets[i+1]) of the targets and vals
+    std::vector<unsigned> out_offsets;
+    std::vector<NodeType *> out_targets;
+    std::vector<EdgeValTy> out_vals;
+    std::vector<unsigned> in_offsets;
+    std::vector<NodeType *> in_targets;
+    std::vector<EdgeValTy> in_vals;
+
+    CSRGraph(const CSRGraph &);       // DO NOT IMPLEMENT
+    void operator=(const CSRGraph &); // DO NOT IMPLEMENT
+
+  public:
+    CSRGraph() : frozen(false) {}
+
+    /// Number of the node of val, which is added if it's new
+    unsigned addNode(NodeValTy & val)
+    {
+      assert(!frozen && "Adding a node to a frozen graph");
+      std::pair<typename IdMapTy::iterator, bool> res =
+        ids.insert(std::make_pair(val, (unsigned) nodes.size()));
+      if (res.second) {
+        nodes.push_back(NodeType(val, res.first->second));
+        super::inc_node();
+      }
+      return res.first->second;
+    }
+
+    bool addEdge(NodeValTy &fval, NodeValTy &tval, EdgeValTy edge = EdgeValTy())
+    {
+      assert(!frozen && "Adding an edge to a frozen graph");
+      unsigned from = addNode(fval);
+      unsigned to = addNode(tval);
+      pending.push_back(std::make_pair(from, to));
+      pending_vals.push_back(edge);
+      super::inc_edge();
+      return true;
+    }
+
+    /// Lay the edges out, after which the graph can be traversed
+    void freeze()
+    {
+      if (frozen)
+        return;
+      layout(false, out_offsets, out_targets, out_vals);
+      layout(true, in_offsets, in_targets, in_vals);
+      std::vector<std::pair<unsigned, unsigned> >().swap(pending);
+      std::vector<EdgeValTy>().swap(pending_vals);
+      frozen = true;
+    }
+
+    inline bool isFrozen() const { return frozen; }
+
+    NodeType * get(NodeValTy & val)
+    {
+      assert(frozen && "Node of a graph that isn't frozen yet");
+      typename IdMapTy::iterator I = ids.find(val);
+      if (I == ids.end())
+        return NULL;
+      return &nodes[I->second];
+    }
+
+    inline node_iterator begin() { return node_iterator(nodes.begin()); }
+    inline node_iterator end() { return node_iterator(nodes.end()); }
+
+    inline in_iterator in_begin(NodeType * node) const
+    {
+      return in_targets.begin() + in_offsets[node->getId()];
+    }
+    inline in_iterator in_end(NodeType * node) const
+    {
+      return in_targets.begin() + in_offsets[node->getId() + 1];
+    }
+    inline out_iterator out_begin(NodeType * node) const
+    {
+      return out_targets.begin() + out_offsets[node->getId()];
+    }
+    inline out_iterator out_end(NodeType * node) const
+    {
+      return out_targets.begin() + out_offsets[node->getId() + 1];
+    }
+
+    /// Value of the edge I points to
+    inline const EdgeValTy & in_value(in_iterator I) const
+    {
+      return in_vals[I - in_targets.begin()];
+    }
+    inline const EdgeValTy & out_value(out_iterator I) const
+    {
+      return out_vals[I - out_targets.begin()];
+    }
+
+    virtual void print(raw_ostream &OS, bool full = true)
+    {
+      super::print(OS);
+      OS << "\n";
+      for (node_iterator I = begin(), E = end(); I != E; ++I) {
+        NodeType * node = *I;
+        if (full && frozen)
+          print_full(OS, node);
+        else
+          node->print(OS);
+      }
+    }
+
+  protected:
+    void print_full(raw_ostream &OS, NodeType * node)
+    {
+      OS << "|";
+      node->print(OS);
+      OS << "In:\n";
+      for (in_iterator I = in_begin(node), E = in_end(node); I != E; ++I) {
+        OS << " <";
+        (*I)->print(OS);
+      }
+      OS << "Out:\n";
+      for (out_iterator I = out_begin(node), E = out_end(node); I != E; ++I) {
+        OS << " >";
+        (*I)->print(OS);
+      }
+    }
+
+    /// Counting sort of the pending edges by source (or by target for the
+    /// in edges), which keeps the order they were added in for each node.
+    void layout(bool in, std::vector<unsigned> & offsets,
+        std::vector<NodeType *> & targets, std::vector<EdgeValTy> & vals)
+    {
+      size_t n = nodes.size(), m = pending.size();
+      offsets.assign(n + 1, 0);
+      for (size_t i = 0; i < m; ++i)
+        ++offsets[(in ? pending[i].second : pending[i].first) + 1];
+      for (size_t i = 0; i < n; ++i)
+        offsets[i + 1] += offsets[i];
+      targets.resize(m);
+      vals.resize(m);
+      std::vector<unsigned> next(offsets.begin(), offsets.end() - 1);
+      for (size_t i = 0; i < m; ++i) {
+        unsigned from = in ? pending[i].second : pending[i].first;
+        unsigned to = in ? pending[i].first : pending[i].second;
+        unsigned pos = next[from]++;
+        targets[pos] = &nodes[to];
+        vals[pos] = pending_vals[i];
+      }
+    }
+};
+
+} // End of llvm namespace
+
+#endif /* __CSRGRAPH_H_ */
@@ -4,11 +4,16 @@
 #ifndef SLICING_FUNCTIONSTATICSLICER_H
 #define SLICING_FUNCTIONSTATICSLICER_H
 
-#include <map>
+#include <iterator>
+#include <vector>
 
 #include "llvm/Value.h"
 #include "llvm/IntrinsicInst.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/DataTypes.h"
 #include "llvm/Support/InstIterator.h"
 
 #include "llvmslicer/PointsTo.h"
@@ -18,13 +23,122 @@
 
 namespace llvm { namespace slicing {
 
-  typedef llvm::SmallSetVector<const llvm::Value *, 10> ValSet;
-
   void printVal(const llvm::Value *val);
 
+  /// Numbering of the values a function slicer deals with, so that sets
+  /// of them can be bit vectors. Values of other functions, e.g., the
+  /// globals reaching a call, are numbered as they show up.
+  class ValueTable {
+    public:
+      unsigned getId(const llvm::Value *V) {
+        std::pair<llvm::DenseMap<const llvm::Value *, unsigned>::iterator, bool> r =
+          ids.insert(std::make_pair(V, (unsigned) values.size()));
+        if (r.second)
+          values.push_back(V);
+        return r.first->second;
+      }
+      const llvm::Value *get(unsigned id) const { return values[id]; }
+      unsigned size() const { return values.size(); }
+
+    private:
+      llvm::DenseMap<const llvm::Value *, unsigned> ids;
+      std::vector<const llvm::Value *> values;
+  };
+
+  /// A set of values of a ValueTable as a bit vector. The words come from
+  /// the arena of the function slicer and are never freed on their own, so
+  /// a ValSet has no destructor. Sets of one function may have different
+  /// lengths, missing words are zero.
+  class ValSet {
+    public:
+      typedef uint64_t Word;
+      enum { WordBits = 64 };
+
+      /// Iterates the values of a set in id order. It refers to the set
+      /// rather than its words, so it survives the set growing.
+      class const_iterator : public std::iterator<std::forward_iterator_tag,
+          const llvm::Value *> {
+        public:
+          const_iterator() : set(NULL), bit(~0u), table(NULL) {}
+          const_iterator(const ValSet *s, unsigned b, const ValueTable *t) :
+            set(s), bit(b), table(t) {
+            skip();
+          }
+          const llvm::Value *operator*() const { return table->get(bit); }
+          const_iterator &operator++() { ++bit; skip(); return *this; }
+          const_iterator operator++(int) {
+            const_iterator tmp = *this;
+            ++*this;
+            return tmp;
+          }
+          bool operator==(const const_iterator &o) const { return bit == o.bit; }
+          bool operator!=(const const_iterator &o) const { return bit != o.bit; }
+
+        private:
+          const ValSet *set;
+          unsigned bit; // ~0u at the end
+          const ValueTable *table;
+
+          void skip() {
+            while (bit < set->nwords * WordBits) {
+              Word w = set->words[bit / WordBits] >> (bit % WordBits);
+              if (w & 1)
+                return;
+              if (w == 0)
+                bit = (bit / WordBits + 1) * WordBits;
+              else
+                ++bit;
+            }
+            bit = ~0u;
+          }
+      };
+
+      ValSet() : words(NULL), nwords(0) {}
+
+      bool test(unsigned id) const {
+        return id / WordBits < nwords && (words[id / WordBits] >> (id % WordBits)) & 1;
+      }
+      bool insert(unsigned id, llvm::BumpPtrAllocator &A) {
+        grow(id / WordBits + 1, A);
+        Word bit = (Word) 1 << (id % WordBits);
+        if (words[id / WordBits] & bit)
+          return false;
+        words[id / WordBits] |= bit;
+        return true;
+      }
+      /// this |= other - except. Returns whether this changed.
+      bool unite(const ValSet &other, const ValSet *except,
+          llvm::BumpPtrAllocator &A);
+      bool intersects(const ValSet &other) const;
+      bool empty() const;
+      void clear() {
+        for (unsigned i = 0; i < nwords; ++i)
+          words[i] = 0;
+      }
+
+      const_iterator begin(const ValueTable *T) const {
+        return const_iterator(this, 0, T);
+      }
+      const_iterator end(const ValueTable *T) const {
+        return const_iterator(this, ~0u, T);
+      }
+
+    private:
+      Word *words;
+      unsigned nwords;
+
+      void grow(unsigned n, llvm::BumpPtrAllocator &A);
+  };
+
+  /// Slicing info of an instruction. RC, DEF and REF are sets over the
+  /// ValueTable of the function slicer that owns it.
   class InsInfo {
     public:
-      InsInfo(const llvm::Instruction *i, const llvm::ptr::PointsToSets &PS,
+      InsInfo(const llvm::Instruction *i, ValueTable *T,
+          llvm::BumpPtrAllocator *A) : ins(i), table(T), alloc(A), sliced(true) {}
+
+      /// Compute DEF and REF
+      void init(const llvm::ptr::PointsToSets &PS,
           const llvm::mods::Modifies &MOD);
 
       const Instruction *getIns() const { return ins; }
@@ -40,38 +154,45 @@ namespace llvm { namespace slicing {
         else
           var->dump();
 #endif
-        return RC.insert(var); 
+        return RC.insert(table->getId(var), *alloc); 
       }
-      bool addDEF(const llvm::Value *var) { return DEF.insert(var); }
-      bool addREF(const llvm::Value *var) { return REF.insert(var); }
+      bool addDEF(const llvm::Value *var) { return DEF.insert(table->getId(var), *alloc); }
+      bool addREF(const llvm::Value *var) { return REF.insert(table->getId(var), *alloc); }
       void deslice() { sliced = false; }
+      /// Forget the relevant variables and the slice, DEF and REF stay
+      void reset() { RC.clear(); sliced = true; }
 
-      ValSet::const_iterator RC_begin() const { return RC.begin(); }
-      ValSet::const_iterator RC_end() const { return RC.end(); }
-      ValSet::const_iterator DEF_begin() const { return DEF.begin(); }
-      ValSet::const_iterator DEF_end() const { return DEF.end(); }
-      ValSet::const_iterator REF_begin() const { return REF.begin(); }
-      ValSet::const_iterator REF_end() const { return REF.end(); }
+      /// RC |= S - except
+      bool uniteRC(const ValSet &S, const ValSet *except = NULL) {
+        return RC.unite(S, except, *alloc);
+      }
+
+      const ValSet &getRC() const { return RC; }
+      const ValSet &getDEF() const { return DEF; }
+      const ValSet &getREF() const { return REF; }
+
+      ValSet::const_iterator RC_begin() const { return RC.begin(table); }
+      ValSet::const_iterator RC_end() const { return RC.end(table); }
+      ValSet::const_iterator DEF_begin() const { return DEF.begin(table); }
+      ValSet::const_iterator DEF_end() const { return DEF.end(table); }
+      ValSet::const_iterator REF_begin() const { return REF.begin(table); }
+      ValSet::const_iterator REF_end() const { return REF.end(table); }
 
       bool isSliced() const { return sliced; }
 
     private:
       const llvm::Instruction *ins;
+      ValueTable *table;
+      llvm::BumpPtrAllocator *alloc;
       ValSet RC, DEF, REF;
       bool sliced;
   };
 
   class FunctionStaticSlicer {
     public:
-      typedef std::map<const llvm::Instruction *, InsInfo *> InsInfoMap;
-
       FunctionStaticSlicer(llvm::Function &F, llvm::ModulePass *MP,
-          const llvm::ptr::PointsToSets &PT, const llvm::mods::Modifies &mods, bool forward = false) :
-        fun(F), MP(MP), forward(forward) {
-          for (llvm::inst_iterator I = llvm::inst_begin(F), E = llvm::inst_end(F);
-              I != E; ++I)
-            insInfoMap.insert(InsInfoMap::value_type(&*I, new InsInfo(&*I, PT, mods)));
-        }
+          const llvm::ptr::PointsToSets &PT, const llvm::mods::Modifies &mods,
+          bool forward = false);
       ~FunctionStaticSlicer();
 
       ValSet::const_iterator relevant_begin(const llvm::Instruction *I) const {
@@ -137,21 +258,42 @@ namespace llvm { namespace slicing {
         }
         ii->deslice();
       }
+      /// Fetch what calculateStaticSlice needs from the pass manager. It
+      /// isn't thread safe, while calculateStaticSlice only touches this
+      /// slicer once prepared, so slicers of different functions can run
+      /// in parallel.
+      void prepare();
       void calculateStaticSlice();
       void dump(bool outputline = false);
+      /// Remove the sliced instructions from the function. Afterwards
+      /// the slicer can only be queried through getInsInfo.
       bool slice();
 
+      /// Forget the criteria and the slice, so that the slicer can be
+      /// used for new criteria
+      void reset();
+
+      /// Number of instructions with slicing info
+      size_t size() const { return insIds.size(); }
+
       InsInfo *getInsInfo(const llvm::Instruction *i) const {
-        InsInfoMap::const_iterator I = insInfoMap.find(i);
-        if (I == insInfoMap.end()) {
+        llvm::DenseMap<const llvm::Instruction *, unsigned>::const_iterator I =
+          insIds.find(i);
+        if (I == insIds.end()) {
           return NULL;
         }
-        // assert(I != insInfoMap.end());
-        return I->second;
+        return &infos[I->second];
       }
 
       static void removeUndefs(ModulePass *MP, Function &F);
 
+      /// Instructions the RC worklists of all slicers visited so far
+      static uint64_t rcVisits() { return RCVisits; }
+      /// Estimate of the instructions full sweeps would have visited
+      /// instead: every instruction once, and once more if an RC grew. A
+      /// lower bound, since a sweep may take more rounds than that.
+      static uint64_t rcSweepEstimate() { return RCSweepEstimate; }
+
       void addSkipAssert(const llvm::CallInst *CI) {
         skipAssert.insert(CI);
       }
@@ -161,19 +303,34 @@ namespace llvm { namespace slicing {
       }
 
     private:
+      static volatile uint64_t RCVisits;
+      static volatile uint64_t RCSweepEstimate;
+
       llvm::Function &fun;
       llvm::ModulePass *MP;
-      InsInfoMap insInfoMap;
+      /// Holds the InsInfos and their sets, freed in bulk
+      llvm::BumpPtrAllocator arena;
+      ValueTable values;
+      /// InsInfo of every instruction, in inst_iterator order
+      InsInfo *infos;
+      unsigned ninfos;
+      /// Position of an instruction in infos, erased when it's sliced away
+      llvm::DenseMap<const llvm::Instruction *, unsigned> insIds;
+      /// Position of the first instruction of a block in infos
+      llvm::DenseMap<const llvm::BasicBlock *, unsigned> blockStart;
+      /// Copy of the post-dominance frontier of fun, the pass only keeps
+      /// the one of the function it ran on last
+      llvm::PostDominanceFrontier::DomSetMapType frontiers;
+      bool prepared;
       llvm::SmallSetVector<const llvm::CallInst *, 10> skipAssert;
       bool forward;
 
-      static bool sameValues(const Value *val1, const Value *val2);
       void crawlBasicBlock(const llvm::BasicBlock *bb);
       bool computeRCi(InsInfo *insInfoi, InsInfo *insInfoj);
-      bool computeRCi(InsInfo *insInfoi);
+      void flowTargets(unsigned i, llvm::SmallVectorImpl<unsigned> &targets) const;
       void computeRC();
 
-      void computeSCi(const llvm::Instruction *i, const llvm::Instruction *j);
+      void computeSCi(InsInfo *insInfoi, InsInfo *insInfoj);
       void computeSC();
 
       bool computeBC();
@@ -8,10 +8,16 @@
 #include <set>
 #include <vector>
 
+#include "llvm/Function.h"
 #include "llvm/Value.h"
+#include "llvm/Support/DataTypes.h"
 
 #include "llvmslicer/RuleExpressions.h"
 
+namespace llvm {
+  class DataStructures;
+}
+
 namespace llvm { namespace ptr {
 
   class PointsToSets {
@@ -56,8 +62,17 @@ namespace llvm { namespace ptr {
         typedef Container::iterator iterator;
         typedef Container::const_iterator const_iterator;
 
+        /// Rules of the pointer manipulations of a function. They only
+        /// depend on the function itself, unlike the rules of its calls
+        /// and returns, which depend on the other functions of its type.
+        typedef std::map<const llvm::Function *, Container> FunctionRules;
+
         explicit ProgramStructure(Module &M);
 
+        /// The rules of the functions in rules are taken from there, those
+        /// of the other functions are generated and added to it
+        ProgramStructure(Module &M, FunctionRules &rules);
+
         llvm::Module &getModule() const { return M; }
 
         void insert(iterator it, value_type const& val) { C.insert(it,val); }
@@ -73,6 +88,8 @@ namespace llvm { namespace ptr {
     private:
         Container C;
         llvm::Module &M;
+
+        void build(FunctionRules *rules);
     };
 
 }}
@@ -84,6 +101,20 @@ namespace llvm { namespace ptr {
 
   PointsToSets &computePointsToSets(const ProgramStructure &P, PointsToSets &S);
 
+  /// Work of all the computePointsToSets so far: constraint nodes, nodes
+  /// taken off the worklist and nodes collapsed into cycles
+  void solverStats(uint64_t &nodes, uint64_t &visits, uint64_t &collapsed);
+
+  /// Points-to sets of M read off the graphs of DS, with the nodes of
+  /// different graphs unified through calls and globals. Near linear,
+  /// but coarser than computePointsToSets.
+  PointsToSets &computeDSAPointsToSets(Module &M, DataStructures &DS,
+      PointsToSets &S);
+
+  /// Work of all the computeDSAPointsToSets so far: DSA nodes read into
+  /// points-to sets and DSA nodes unified across graphs
+  void dsaStats(uint64_t &nodes, uint64_t &unified);
+
 }}
 
 #endif
@@ -0,0 +1,89 @@
+/**
+ *  @file          PointsToCache.h
+ *
+ *  @version       1.0
+ *  @created       05/24/2013 03:40:12 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *
+ *  Points-to sets and Modifies of a module kept in a file across runs,
+ *  keyed by the hashModule of the module they were computed on, along
+ *  with the points-to rules of every function, keyed by its hashFunction.
+ *  When the module changed, the rules of the unchanged functions are
+ *  reused and only those of the changed ones are generated again before
+ *  the sets are solved.
+ *
+ *  Values are saved by their position: a global value by its name, a
+ *  local by the name of its function and its position there, as numbered
+ *  by hashFunction. A constant is saved as the path of operand indices
+ *  that leads to it from the first such value that uses it. The values
+ *  of the rules of a function are only located from the function itself
+ *  and from global names, so that they stay valid as long as its hash.
+ *
+ *  Layout of the cache file, all integers in host byte order:
+ *
+ *    magic, version, nnames, module key, function offset, nvalues, nsets,
+ *      nmods, nfuncs, solved
+ *    nnames x {n, n x char}
+ *    nvalues x {kind, name, local, npath, npath x operand}
+ *    nsets x {value, n, n x value}
+ *    nmods x {function value, n, n x value}
+ *    nfuncs x {name, nvalues, hash, nrules, nvalues x value header as
+ *      above, nrules x {type, lvalue, rvalue}}
+ *
+ *  The sets and Modifies are only there if solved is set.
+ *
+ */
+
+#ifndef __POINTSTO_CACHE_H_
+#define __POINTSTO_CACHE_H_
+
+#include <stdint.h>
+
+#include "llvm/Module.h"
+
+#include "llvmslicer/Modifies.h"
+#include "llvmslicer/PointsTo.h"
+
+#define POINTSTO_CACHE_SUFFIX ".ptcache"
+#define POINTSTO_CACHE_MAGIC "PSPTCACH"
+#define POINTSTO_CACHE_MAGIC_LEN 8
+#define POINTSTO_CACHE_VERSION 2
+
+namespace llvm { namespace slicing {
+
+  /// Fill PS and MOD from the cache file fname. Fails if there is none,
+  /// or if it was written for a module with another key, in which case
+  /// PS and MOD are left alone and, if rules is given, it receives the
+  /// rules of the functions of M that didn't change since.
+  bool loadPointsToCache(const char *fname, const Module &M, uint64_t key,
+      ptr::PointsToSets &PS, mods::Modifies &MOD,
+      ptr::ProgramStructure::FunctionRules *rules = NULL);
+
+  /// Write PS, MOD and the rules of the functions of M to fname. The
+  /// values of PS and MOD that can't be located in M leave them out of
+  /// the file, and so do those of a function for its rules.
+  bool savePointsToCache(const char *fname, const Module &M, uint64_t key,
+      const ptr::PointsToSets &PS, const mods::Modifies &MOD,
+      const ptr::ProgramStructure::FunctionRules *rules = NULL);
+
+}}
+
+#endif /* __POINTSTO_CACHE_H_ */
@@ -264,6 +264,13 @@ namespace llvm { namespace ptr {
         , rvalue()
     {}
 
+    /// A rule read back from its parts, see PointsToCache.h
+    RuleCode(RuleCodeType t, MemoryLocation const l, MemoryLocation const r)
+      : type(t)
+        , lvalue(l)
+        , rvalue(r)
+    {}
+
     RuleCodeType getType() const { return type; }
     MemoryLocation const& getLvalue() const { return lvalue; }
     MemoryLocation const& getRvalue() const { return rvalue; }
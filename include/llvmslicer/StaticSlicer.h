@@ -3,6 +3,7 @@
 
 #include <map>
 #include <set>
+#include <string>
 #include <vector>
 #include <iterator>
 #include <algorithm>
@@ -13,6 +14,8 @@
 #include "llvm/Analysis/PostDominators.h"
 #include "llvm/Analysis/CallGraph.h"
 
+#include "dsa/DataStructure.h"
+
 #include "mapper/Matcher.h"
 #include "llvmslicer/FunctionStaticSlicer.h"
 #include "llvmslicer/Callgraph.h"
@@ -27,6 +30,13 @@ namespace llvm { namespace slicing {
   typedef llvm::SmallVector<const llvm::Function *, 20> WorkList;
   typedef WorkList::iterator FuncIter;
 
+  /// Where the points-to sets of the slicer come from
+  enum AliasMode {
+    ALIAS_NONE = 0, // none, quick but unsound through memory
+    ALIAS_RULES,    // computePointsToSets, precise but slow on large modules
+    ALIAS_DSA       // the graphs of EQTDDataStructures, see computeDSAPointsToSets
+  };
+
   class StaticSlicer : public ModulePass {
     public:
       static char ID;
@@ -39,7 +49,7 @@ namespace llvm { namespace slicing {
         CallsToFuncs;
 
     public:
-      StaticSlicer(bool forward, bool sound = false);
+      StaticSlicer(bool forward, AliasMode alias = ALIAS_NONE);
 
       ~StaticSlicer();
 
@@ -50,6 +60,8 @@ namespace llvm { namespace slicing {
         AU.addRequired<PostDominatorTree>();
         AU.addRequired<PostDominanceFrontier>();
         AU.addRequired<CallGraph>();
+        if (m_alias == ALIAS_DSA)
+          AU.addRequired<EQTDDataStructures>();
       }
 
       template<typename OutIterator>
@@ -73,7 +85,25 @@ namespace llvm { namespace slicing {
 
       void computeSlice();
 
+      /// Slice the functions of a wave of computeSlice on up to threads
+      /// workers. Needs LLVM to run multithreaded, otherwise one is used.
+      void setThreads(unsigned threads) { m_threads = threads ? threads : 1; }
+
+      /// Keep the points-to sets and Modifies of the module, and the rules
+      /// of its functions, in fname across runs, see PointsToCache.h. Must
+      /// be set before the pass runs.
+      void setCacheFile(const std::string &fname) { m_cacheFile = fname; }
+
       const Instruction * next();
+
+      /// Drop the criteria and the slice computed so far. The points-to
+      /// sets, Modifies and call dictionaries of the module are kept, so
+      /// one slicer can serve any number of criteria.
+      void reset();
+
+      /// Rough bytes taken by the module-wide analyses and the function
+      /// slicers
+      size_t footprint() const;
     private:
       void addInitRC(FunctionStaticSlicer *FSS, const Instruction *inst);
 
@@ -84,6 +114,7 @@ namespace llvm { namespace slicing {
 
       FunctionStaticSlicer * getFSS(const Function * F);
       FunctionStaticSlicer * newFSS(Function * F);
+      void sliceWave(const WorkList &wave);
       void buildDicts(const ptr::PointsToSets &PS);
 
       template<typename OutIterator>
@@ -100,7 +131,7 @@ namespace llvm { namespace slicing {
 
       Module *m_module;
       bool m_forward;
-      Slicers m_slicers;
+      Slicers m_slicers; // built on demand, see getFSS
       InitFuns m_initFuns;
       WorkList m_sliceFuncs;
       FuncsToCalls m_funcsToCalls;
@@ -113,7 +144,9 @@ namespace llvm { namespace slicing {
       bool m_criteriaInit;
       bool m_instInit;
       bool m_funcInit;
-      bool m_sound;
+      AliasMode m_alias;
+      unsigned m_threads;
+      std::string m_cacheFile;
   };
 
 
@@ -7,6 +7,7 @@
 #include "llvm/Pass.h"
 #include "llvm/Function.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringMap.h"
 
 #include "llvm/Analysis/DebugInfo.h"
 #include "llvm/Analysis/LoopInfo.h"
@@ -24,6 +25,7 @@
 
 #include <vector>
 #include <deque>
+#include <map>
 
 #include "commons/Scope.h"
 
@@ -74,6 +76,7 @@ class DISPCopy {
     unsigned linenumber;
     unsigned lastline;
     Function *function;
+    unsigned pathid; // interned source path, see Matcher::buildSPIndex
 
   public:
     DISPCopy(DISubprogram & DISP)
@@ -91,6 +94,7 @@ class DISPCopy {
       linenumber = DISP.getLineNumber();
       lastline = 0;
       function = DISP.getFunction();
+      pathid = 0;
     }
 };
 
@@ -114,6 +118,16 @@ class Matcher {
   public:
     typedef std::vector<DISPCopy>::iterator sp_iterator;
     typedef std::vector<DICompileUnit>::iterator cu_iterator;
+    typedef std::pair<sp_iterator, sp_iterator> sp_range;
+
+    // (line, instruction) pairs of a function, sorted by line and then
+    // by program order
+    typedef std::pair<unsigned, Instruction *> LineInst;
+    typedef std::vector<LineInst> LineIndex;
+    typedef LineIndex::const_iterator line_iterator;
+    typedef std::pair<line_iterator, line_iterator> inst_range;
+
+    static const unsigned NoPath = ~0U;
 
   protected:
     bool initialized;
@@ -122,6 +136,19 @@ class Matcher {
     const char *patchname;
     Module & module;
 
+    // Index over MySPs: every SP is tagged with the id of its stripped
+    // canonical path, and MySPs is sorted by (pathid, linenumber) so that
+    // the SPs of one file form the contiguous range SPRanges[pathid].
+    llvm::StringMap<unsigned> PathIds;
+    std::vector<std::pair<unsigned, unsigned> > SPRanges;
+    unsigned targetid; // path id of the current target, NoPath if none
+
+    // Stripped canonical path of a CU -> its index in MyCUs
+    llvm::StringMap<unsigned> CUIndex;
+
+    // Line indexes of the functions matched so far, built on demand
+    std::map<const Function *, LineIndex> LineIndexes;
+
   public:
     std::vector<DISPCopy> MySPs;
     std::vector<DICompileUnit> MyCUs;
@@ -135,6 +162,8 @@ class Matcher {
       patchstrips = p_strips; 
       debugstrips = d_strips; 
       initialized = false;
+      targetid = NoPath;
+      patchname = "";
       processCompileUnits(M); 
       processed = true;
     }
@@ -142,6 +171,9 @@ class Matcher {
 
     void processCompileUnits(Module &);
 
+    /// Full paths of the compile units of M that a Matcher can match
+    static void compileUnitPaths(Module &, std::vector<std::string> &);
+
     void processSubprograms(Module &);
     void processSubprograms(DICompileUnit &);
     void processInst(Function *);
@@ -151,7 +183,9 @@ class Matcher {
 
     cu_iterator matchCompileUnit(StringRef);
     Function * matchFunction(sp_iterator &, Scope &, bool &);
+    sp_range matchFunctions(const Scope &);
     Instruction * matchInstruction(inst_iterator &, Function *, Scope &);
+    inst_range matchInstructions(Function *, const Scope &);
     static Loop * matchLoop(LoopInfo &li, const Scope &);
 
 
@@ -166,6 +200,11 @@ class Matcher {
     {
       patchstrips = p_strips; 
       debugstrips = d_strips; 
+      // keys of both indexes depend on debugstrips
+      buildCUIndex();
+      buildSPIndex();
+      filename.clear();
+      targetid = NoPath;
     }
 
     sp_iterator resetTarget(StringRef);
@@ -188,6 +227,15 @@ class Matcher {
     bool initName(StringRef);
     void dumpSPs();
 
+    const LineIndex & getLineIndex(Function *);
+    bool debugKey(const std::string &, std::string &);
+    void buildCUIndex();
+    void buildSPIndex();
+    sp_iterator target_begin();
+    sp_iterator target_end();
+    sp_range searchRange(sp_iterator);
+    sp_iterator findSP(sp_iterator, sp_iterator, unsigned);
+
 };
 
 #endif
@@ -0,0 +1,78 @@
+//===---- ModuleRouter.h - Route Source Files To Modules ----*- C++ -*-===//
+//
+// Index from the stripped canonical path of every compile unit to the
+// modules that contain it, so that a chapter of a patch is only matched
+// against the modules that can own its file.
+//
+// The CU paths of a module are kept in a sidecar file next to its bitcode
+// (NAME.cuidx) and reused as long as the bitcode doesn't change, so that
+// routing doesn't need the modules to be loaded. The sidecar also keeps
+// the call index of the module, which lets a lazily loaded module find
+// the callers of a function without reading every function body.
+//
+//===----------------------------------------------------------------------===//
+#ifndef ___MODULE_ROUTER__H_
+#define ___MODULE_ROUTER__H_
+
+#include "llvm/Module.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include "commons/CallSiteFinder.h"
+
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+#define CUINDEX_SUFFIX ".cuidx"
+#define CUINDEX_MAGIC "PSCUIDX"
+#define CUINDEX_VERSION 2
+
+class ModuleRouter {
+  public:
+    typedef std::vector<unsigned> ModuleList; // in the order they were added
+
+  protected:
+    StringMap<ModuleList> routes;
+    std::vector<int> module_strips;
+    std::vector<CallIndex *> module_calls;
+    int patchstrips;
+
+  public:
+    ModuleRouter(int p_strips = 0) : patchstrips(p_strips) {}
+    ~ModuleRouter();
+
+    /// Index module #id from the sidecar of bcname. Fails if there is
+    /// none, or if the bitcode changed since it was written. strips < 0
+    /// means the strips inferred when the sidecar was written.
+    bool addSidecar(unsigned id, const std::string & bcname, int strips);
+
+    /// Index module #id from the debug info of M and write the sidecar
+    /// of bcname for the next run. strips < 0 means count_strips(M).
+    /// M must be fully materialized.
+    void addModule(unsigned id, Module & M, const std::string & bcname, int strips);
+
+    /// The modules that may contain the source file fullname, NULL if none
+    const ModuleList * route(StringRef fullname) const;
+
+    /// Strips of the CU paths of module #id, -1 if it isn't indexed
+    int strips(unsigned id) const
+    {
+      return id < module_strips.size() ? module_strips[id] : -1;
+    }
+
+    /// Callers of every function of module #id, NULL if it isn't indexed
+    const CallIndex * calls(unsigned id) const
+    {
+      return id < module_calls.size() ? module_calls[id] : NULL;
+    }
+
+    size_t size() const { return routes.size(); }
+
+  protected:
+    void addPaths(unsigned id, const std::vector<std::string> & paths, int strips, 
+        CallIndex * calls);
+};
+
+#endif
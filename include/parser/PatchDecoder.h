@@ -142,6 +142,8 @@ class PatchDecoder{
         FILE *fp;
         bool rewind;
         long file_offset;
+        bool fatal;        // exit on a syntax error, or stop decoding
+        std::string error; // the first syntax error when not fatal
 
 
     protected:
@@ -164,6 +166,12 @@ class PatchDecoder{
     
         // don't to shift the n,m in attribute because of *this*
         void syntaxError(const char *, ...) __attribute__ ((format (printf, 2, 3)));
+
+        // A server can't exit on a bad patch: then a syntax error only
+        // ends the input, and the callers check failed() afterwards.
+        inline void setFatal(bool f) { fatal = f; }
+        inline bool failed() const { return !error.empty(); }
+        inline const std::string & errorMessage() const { return error; }
     
 //          iterator begin() { return hunks.begin(); }
 //          iterator end() { return hunks.end(); }
@@ -0,0 +1,324 @@
+/**
+ *  @file          AnalysisCache.cpp
+ *
+ *  @version       1.0
+ *  @created       05/10/2013 10:03:17 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *
+ *  Persistent per function analysis cache implementation
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include "commons/handy.h"
+#include "commons/FunctionHash.h"
+#include "analyzer/AnalysisCache.h"
+
+namespace llvm {
+
+static void numberLoops(Loop * L, int parent, FunctionSummary & summary,
+    ScalarEvolution * SE, DenseMap<const Loop *, int> & ids)
+{
+  int id = summary.loops.size();
+  ids[L] = id;
+  LoopSummary ls;
+  ls.parent = parent;
+  ls.trip_count = 0;
+  SmallVector<BasicBlock *, 4> exits;
+  L->getExitingBlocks(exits);
+  for (SmallVector<BasicBlock *, 4>::iterator ei = exits.begin(), ee = exits.end();
+      ei != ee; ++ei) {
+    if (*ei) {
+      unsigned c = SE->getSmallConstantTripCount(L, *ei);
+      if (c > ls.trip_count)
+        ls.trip_count = c;
+    }
+  }
+  summary.loops.push_back(ls);
+  for (Loop::iterator I = L->begin(), E = L->end(); I != E; ++I)
+    numberLoops(*I, id, summary, SE, ids);
+}
+
+bool FunctionSummarizer::runOnFunction(Function &F)
+{
+  assert(summary && block_ids && "no summary to fill");
+  LoopInfo * LI = &getAnalysis<LoopInfo>();
+  ScalarEvolution * SE = &getAnalysis<ScalarEvolution>();
+  summary->loops.clear();
+  summary->block_loop.assign(F.size(), -1);
+  DenseMap<const Loop *, int> ids;
+  for (LoopInfo::iterator I = LI->begin(), E = LI->end(); I != E; ++I)
+    numberLoops(*I, -1, *summary, SE, ids);
+  if (summary->loops.empty())
+    return false;
+  for (Function::iterator FI = F.begin(), FE = F.end(); FI != FE; ++FI) {
+    Loop * L = LI->getLoopFor(FI);
+    if (L)
+      summary->block_loop[(*block_ids)[FI]] = ids[L];
+  }
+  return false;
+}
+
+void FunctionSummarizer::getAnalysisUsage(AnalysisUsage &AU) const
+{
+  AU.setPreservesAll();
+  AU.addRequired<LoopInfo>();
+  AU.addRequired<ScalarEvolution>();
+}
+
+char FunctionSummarizer::ID = 0;
+const char * FunctionSummarizer::PassName = "Function summarizer";
+
+uint64_t AnalysisCache::hash(const Function * F)
+{
+  DenseMap<const Function *, uint64_t>::iterator I = hashes.find(F);
+  if (I != hashes.end())
+    return I->second;
+  uint64_t h = hashFunction(F, &block_ids);
+  hashes[F] = h;
+  return h;
+}
+
+unsigned AnalysisCache::blockId(const BasicBlock * BB)
+{
+  DenseMap<const BasicBlock *, unsigned>::iterator I = block_ids.find(BB);
+  if (I != block_ids.end())
+    return I->second;
+  hash(BB->getParent()); // numbers the blocks
+  return block_ids[BB];
+}
+
+const FunctionSummary & AnalysisCache::summarize(Function * F)
+{
+  uint64_t h = hash(F);
+  std::map<uint64_t, FunctionSummary>::iterator I = summaries.find(h);
+  if (I != summaries.end() && I->second.block_loop.size() == F->size()) {
+    hits++;
+    return I->second;
+  }
+  misses++;
+  FunctionSummary & summary = summaries[h];
+  summary.loops.clear();
+  summary.block_loop.assign(F->size(), -1);
+  if (F->isDeclaration())
+    return summary;
+  Module * M = F->getParent();
+  std::map<Module *, ModuleSummarizer>::iterator MI = summarizers.find(M);
+  if (MI == summarizers.end()) {
+    ModuleSummarizer ms;
+    ms.manager = new FunctionPassManager(M);
+    ms.summarizer = new FunctionSummarizer();
+    ms.manager->add(ms.summarizer);
+    ms.manager->doInitialization();
+    MI = summarizers.insert(std::make_pair(M, ms)).first;
+  }
+  MI->second.summarizer->summary = &summary;
+  MI->second.summarizer->block_ids = &block_ids;
+  MI->second.manager->run(*F);
+  MI->second.summarizer->summary = NULL;
+  return summary;
+}
+
+unsigned AnalysisCache::functionCost(Function * F, CostModel * model)
+{
+  // The cost doesn't need the loops, so it may be cached alone
+  FunctionSummary & summary = summaries[hash(F)];
+  if (summary.cost != NOCOST) {
+    hits++;
+    return summary.cost;
+  }
+  misses++;
+  summary.cost = model->getFunctionCost(F);
+  return summary.cost;
+}
+
+bool AnalysisCache::lookupHotness(uint64_t key, unsigned & hot) const
+{
+  std::map<uint64_t, unsigned>::const_iterator I = hotness.find(key);
+  if (I == hotness.end())
+    return false;
+  hot = I->second;
+  return true;
+}
+
+void AnalysisCache::forget()
+{
+  for (std::map<Module *, ModuleSummarizer>::iterator I = summarizers.begin(),
+      E = summarizers.end(); I != E; ++I) {
+    I->second.manager->doFinalization();
+    delete I->second.manager; // owns the summarizer
+  }
+  summarizers.clear();
+  hashes.clear();
+  block_ids.clear();
+}
+
+void AnalysisCache::merge(const AnalysisCache & other)
+{
+  hotness.insert(other.hotness.begin(), other.hotness.end());
+  for (std::map<uint64_t, FunctionSummary>::const_iterator I = other.summaries.begin(),
+      E = other.summaries.end(); I != E; ++I) {
+    std::pair<std::map<uint64_t, FunctionSummary>::iterator, bool> r =
+      summaries.insert(*I);
+    if (r.second)
+      continue;
+    // Either side may only have the cost, see functionCost, whose entry
+    // has no blocks. Take the loops and the cost from whichever has them.
+    FunctionSummary & summary = r.first->second;
+    if (summary.block_loop.empty() && !I->second.block_loop.empty()) {
+      summary.loops = I->second.loops;
+      summary.block_loop = I->second.block_loop;
+    }
+    if (summary.cost == NOCOST)
+      summary.cost = I->second.cost;
+  }
+}
+
+struct CacheHeader {
+  char magic[ANALYSISCACHE_MAGIC_LEN];
+  uint32_t version;
+  uint32_t nsummaries;
+  uint32_t nhotness;
+};
+
+struct SummaryHeader {
+  uint64_t hash;
+  uint32_t cost;
+  uint32_t nloops;
+  uint32_t nblocks;
+};
+
+struct HotnessEntry {
+  uint64_t key;
+  uint32_t hotness;
+};
+
+bool AnalysisCache::load(const char * fname)
+{
+  FILE * fp = fopen(fname, "rb");
+  if (fp == NULL) {
+    if (errno == ENOENT) // first run
+      return true;
+    perror("Open analysis cache");
+    return false;
+  }
+  CacheHeader header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, ANALYSISCACHE_MAGIC, ANALYSISCACHE_MAGIC_LEN) != 0) {
+    fprintf(stderr, "%s is not an analysis cache\n", fname);
+    fclose(fp);
+    return false;
+  }
+  if (header.version != ANALYSISCACHE_VERSION) { // stale, start over
+    fclose(fp);
+    return true;
+  }
+  bool ok = true;
+  for (uint32_t i = 0; ok && i < header.nsummaries; ++i) {
+    SummaryHeader sh;
+    if (fread(&sh, sizeof(sh), 1, fp) != 1) {
+      ok = false;
+      break;
+    }
+    FunctionSummary summary;
+    summary.cost = sh.cost;
+    summary.loops.resize(sh.nloops);
+    summary.block_loop.resize(sh.nblocks);
+    ok = (sh.nloops == 0 ||
+          fread(&summary.loops[0], sizeof(LoopSummary), sh.nloops, fp) == sh.nloops) &&
+         (sh.nblocks == 0 ||
+          fread(&summary.block_loop[0], sizeof(int32_t), sh.nblocks, fp) == sh.nblocks);
+    if (ok)
+      summaries[sh.hash] = summary;
+  }
+  for (uint32_t i = 0; ok && i < header.nhotness; ++i) {
+    HotnessEntry he;
+    if (fread(&he, sizeof(he), 1, fp) != 1)
+      ok = false;
+    else
+      hotness[he.key] = he.hotness;
+  }
+  fclose(fp);
+  if (!ok)
+    fprintf(stderr, "Analysis cache %s is truncated\n", fname);
+  return ok;
+}
+
+bool AnalysisCache::save(const char * fname) const
+{
+  // Write a temporary and rename it, so that a crash or a concurrent
+  // run never sees a partial cache
+  std::string tmp = std::string(fname) + ".tmp";
+  FILE * fp = fopen(tmp.c_str(), "wb");
+  if (fp == NULL) {
+    perror("Write analysis cache");
+    return false;
+  }
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ANALYSISCACHE_MAGIC, ANALYSISCACHE_MAGIC_LEN);
+  header.version = ANALYSISCACHE_VERSION;
+  header.nsummaries = summaries.size();
+  header.nhotness = hotness.size();
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  for (std::map<uint64_t, FunctionSummary>::const_iterator I = summaries.begin(),
+      E = summaries.end(); ok && I != E; ++I) {
+    const FunctionSummary & summary = I->second;
+    SummaryHeader sh;
+    memset(&sh, 0, sizeof(sh));
+    sh.hash = I->first;
+    sh.cost = summary.cost;
+    sh.nloops = summary.loops.size();
+    sh.nblocks = summary.block_loop.size();
+    ok = fwrite(&sh, sizeof(sh), 1, fp) == 1 &&
+      (sh.nloops == 0 ||
+       fwrite(&summary.loops[0], sizeof(LoopSummary), sh.nloops, fp) == sh.nloops) &&
+      (sh.nblocks == 0 ||
+       fwrite(&summary.block_loop[0], sizeof(int32_t), sh.nblocks, fp) == sh.nblocks);
+  }
+  for (std::map<uint64_t, unsigned>::const_iterator I = hotness.begin(),
+      E = hotness.end(); ok && I != E; ++I) {
+    HotnessEntry he;
+    memset(&he, 0, sizeof(he));
+    he.key = I->first;
+    he.hotness = I->second;
+    ok = fwrite(&he, sizeof(he), 1, fp) == 1;
+  }
+  if (fclose(fp) != 0)
+    ok = false;
+  if (!ok || rename(tmp.c_str(), fname) != 0) {
+    perror("Write analysis cache");
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+} // End of llvm namespace
@@ -33,6 +33,8 @@
 #include <queue>
 #include <string>
 #include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "llvm/ADT/OwningPtr.h"
 #include "llvm/IntrinsicInst.h"
@@ -42,7 +44,9 @@
 
 #include "commons/handy.h"
 #include "commons/CallSiteFinder.h"
+#include "commons/FunctionHash.h"
 #include "commons/LLVMHelper.h"
+#include "commons/Profile.h"
 #include "analyzer/Evaluator.h"
 
 static int INDENT = 0;
@@ -133,20 +137,67 @@ const char * toExpStr(Expensiveness exp)
   return ExpStr[exp];
 }
 
-bool DummyLoopInfo::runOnFunction(Function &F)
+bool RiskThresholds::parse(const char * arg)
 {
-  LoopInfo *LI = &getAnalysis<LoopInfo>(); 
-  for (Function::iterator FI = F.begin() , FE = F.end(); FI != FE; ++FI) {
-    BasicBlock * BB = FI;
-    // Only inserted the BBs in the Loop.
-    // This is to mimic the LoopInfo.getLoopFor
-    if (LI->getLoopFor(BB) != NULL)
-      LoopMap[&F].insert(BB); 
+  const char * eq = strchr(arg, '=');
+  if (eq == NULL || eq[1] == '\0')
+    return false;
+  std::string key(arg, eq - arg);
+  char * end;
+  double val = strtod(eq + 1, &end);
+  if (*end != '\0' || val < 0)
+    return false;
+  if (key == "loop")
+    tight_loop = (unsigned) val;
+  else if (key == "inst")
+    inst_exp = (unsigned) val;
+  else if (key == "callers")
+    caller_hot = (unsigned) val;
+  else if (key == "exppct" && val <= 100)
+    exp_percentile = val;
+  else if (key == "hotpct" && val <= 100)
+    hot_percentile = val;
+  else
+    return false;
+  return true;
+}
+
+CallerHotnessCache::CallerHotnessCache(Module * module, AnalysisCache * analysis, 
+    const CallIndex * calls) : 
+  graph(module, calls), analysis(analysis), own_analysis(false), hits(0), misses(0)
+{
+  if (analysis == NULL) {
+    this->analysis = new AnalysisCache();
+    own_analysis = true;
   }
-  return false;
 }
 
-RiskLevel RiskEvaluator::assess(const Instruction *I,  std::map<Loop *, unsigned> & LoopDepthMap, Hotness FuncHotness)
+CallerHotnessCache::~CallerHotnessCache()
+{
+  if (own_analysis)
+    delete analysis;
+}
+
+bool CallerHotnessCache::inLoop(const Instruction * callsite)
+{
+  const BasicBlock * BB = callsite->getParent();
+  Function * caller = const_cast<Function *>(BB->getParent());
+  return analysis->summarize(caller).inLoop(analysis->blockId(BB));
+}
+
+bool CallerHotnessCache::lookup(const Function * func, int level, Hotness & hot)
+{
+  std::map<HotKeyTy, Hotness>::iterator I = hotness.find(std::make_pair(func, level));
+  if (I == hotness.end()) {
+    misses++;
+    return false;
+  }
+  hits++;
+  hot = I->second;
+  return true;
+}
+
+RiskLevel RiskEvaluator::assess(const Instruction *I, Hotness FuncHotness)
 {
   eval_debug(I);
   eval_debug("\n");
@@ -175,80 +226,71 @@ RiskLevel RiskEvaluator::assess(const Instruction *I,  std::map<Loop *, unsigned
   if (FuncHotness == Hot)
     return RiskMatrix[Hot][exp];
   Hotness hot = Regular;
-  if (!LocalLI->empty()) {
+  if (!summaryOf(I).loops.empty()) {
     errind();
     eval_debug("hotness:\n");
-    hot = calcInstHotness(I, LoopDepthMap); 
+    hot = calcInstHotness(I); 
     errind(2);
     eval_debug("%s\n", toHotStr(hot));
   }
   return RiskMatrix[hot][exp];
 }
 
-unsigned RiskEvaluator::getLoopDepth(Loop *L, std::map<Loop *, unsigned> & LoopDepthMap)
+/// Summary of the function of I. Slices reach into other functions,
+/// whose blocks are numbered and looped on their own.
+const FunctionSummary & RiskEvaluator::summaryOf(const Instruction *I)
 {
-  std::map<Loop *, unsigned>::iterator it = LoopDepthMap.find(L);
-  if (it != LoopDepthMap.end())
-    return it->second;
-  SmallVector<BasicBlock *, 4> exits;
-  L->getExitingBlocks(exits);
-  unsigned count = 0;
-  for (SmallVector<BasicBlock *, 4>::iterator ei = exits.begin(), ee = exits.end();
-      ei != ee; ++ei) {
-    if (*ei) {
-      unsigned c = SE->getSmallConstantTripCount(L, *ei); 
-      if (c > count)
-        count = c;
-    }
-  }
-  LoopDepthMap[L] = count;
-  return count;
+  assert(summary && "Require the function summary");
+  Function * F = const_cast<Function *>(I->getParent()->getParent());
+  return callers->getAnalysisCache()->summarize(F);
 }
 
-Hotness RiskEvaluator::calcInstHotness(const Instruction *I, std::map<Loop *, unsigned> & LoopDepthMap)
+Hotness RiskEvaluator::calcInstHotness(const Instruction *I)
 {
-  assert(LocalLI && SE && "Require Loop information and ScalarEvolution");
-  const BasicBlock * BB = I->getParent();
-  Loop * loop = LocalLI->getLoopFor(BB);
+  const FunctionSummary & S = summaryOf(I);
+  int loop = S.loopOf(callers->getAnalysisCache()->blockId(I->getParent()));
   unsigned depth = 0;
   Hotness hot = Cold;
-  while (loop) {
+  while (loop >= 0) {
     depth++;
     errind(2);
-    unsigned cnt = getLoopDepth(loop, LoopDepthMap);
+    unsigned cnt = S.loops[loop].trip_count;
     eval_debug("L%u trip count:%u\n", depth, cnt);
     // loop count cannot be determined, so it's potentially
     // very tight!
-    if (cnt == 0 || cnt > LOOPCOUNTTIGHT) 
+    if (cnt == 0 || cnt > thresholds.tight_loop) 
       hot = Hot;
     else
       hot = Regular;
-    loop = loop->getParentLoop();
+    loop = S.loops[loop].parent;
   }
   return hot;
 }
 
-Hotness RiskEvaluator::calcFuncHotness(const char * funcName)
+Hotness RiskEvaluator::calcFuncHotness(const ProfileEntry & entry)
 {
-  if (profile) {
-    for (Profile::iterator it = profile->begin(), ie = profile->end(); 
-        it != ie; ++it) {
-      if (it->first == FREQCALL) {
-        if (std::binary_search(it->second.begin(), it->second.end(), funcName)) {
-          errind(2);
-          eval_debug("*%s*\n",toSpeFuncStr(it->first)); 
-          return Hot;
-        }
-      }
-    }
+  if (entry.mask & SPEMASK(FREQCALL)) {
+    errind(2);
+    eval_debug("*%s*\n",toSpeFuncStr(FREQCALL)); 
+    return Hot;
+  }
+  if (profile && profile->isFrequent(entry)) {
+    errind(2);
+    eval_debug("*frequent: %llu*\n", (unsigned long long) CompiledProfile::callFreq(entry.weight)); 
+    return Hot;
   }
   return Regular;
 }
 
+Hotness RiskEvaluator::calcFuncHotness(const char * funcName)
+{
+  return calcFuncHotness(profile ? profile->lookupName(funcName) : ProfileEntry());
+}
+
 Hotness RiskEvaluator::calcFuncHotness(const Function * func)
 {
   if (func)
-    return calcFuncHotness(cpp_demangle(func->getName().data()));
+    return calcFuncHotness(profile ? profile->lookup(func) : ProfileEntry());
   return Cold;
 }
 
@@ -256,14 +298,71 @@ Hotness RiskEvaluator::calcCallerHotness(const Function * func, int level)
 {
   if (func == NULL || level <= 0)
     return Cold;
+  if (callers == NULL) { // no module given at construction
+    callers = new CallerHotnessCache(const_cast<Module *>(func->getParent()));
+    own_callers = true;
+  }
+  Hotness hot;
+  if (callers->lookup(func, level, hot)) {
+    eval_debug("Callers: %s (cached)\n", toHotStr(hot));
+    return hot;
+  }
+  AnalysisCache * analysis = callers->getAnalysisCache();
+  uint64_t key = callerHotnessKey(func, level);
+  unsigned cached;
+  if (analysis->lookupHotness(key, cached)) {
+    hot = (Hotness) cached;
+    eval_debug("Callers: %s (from cache file)\n", toHotStr(hot));
+  }
+  else {
+    hot = traceCallerHotness(func, level);
+    analysis->insertHotness(key, hot);
+  }
+  callers->insert(func, level, hot);
+  return hot;
+}
+
+// Caller hotness depends on every function traceCallerHotness may
+// visit, so the key covers the bodies and the profile entries of all
+// callers up to level, as well as the thresholds.
+uint64_t RiskEvaluator::callerHotnessKey(const Function * func, int level)
+{
+  const CallerGraph & graph = callers->getCallerGraph();
+  AnalysisCache * analysis = callers->getAnalysisCache();
+  uint64_t key = hashCombine(level, thresholds.caller_hot);
+  SmallPtrSet<const Function *, 16> visited;
+  std::queue<std::pair<const Function *, int> > bfsQueue;
+  bfsQueue.push(std::make_pair(func, 1));
+  visited.insert(func);
+  while (!bfsQueue.empty()) {
+    const Function * F = bfsQueue.front().first;
+    int dist = bfsQueue.front().second;
+    bfsQueue.pop();
+    key = hashString(key, F->getName());
+    key = hashCombine(key, analysis->hash(F));
+    key = hashCombine(key, calcFuncHotness(F));
+    if (dist >= level)
+      continue;
+    for (CallerGraph::const_cs_iterator ci = graph.begin(F), ce = graph.end(F); 
+        ci != ce; ++ci) {
+      if (visited.insert(ci->first))
+        bfsQueue.push(std::make_pair(ci->first, dist + 1));
+    }
+  }
+  return key;
+}
+
+Hotness RiskEvaluator::traceCallerHotness(const Function * func, int level)
+{
+  const CallerGraph & graph = callers->getCallerGraph();
   SmallPtrSet<const Function *, 4> visited;
   typedef std::pair<const Function *, int> FuncDep;
   std::queue<FuncDep> bfsQueue;
   bfsQueue.push(std::make_pair(func, 1));
   eval_debug("Callers:\n");
-  unsigned callers = 0;
+  unsigned ncallers = 0;
   while(!bfsQueue.empty()) {
-    callers++;
+    ncallers++;
     FuncDep & item = bfsQueue.front();
     // in case siblings with duplicates
     if (visited.count(item.first)) {
@@ -272,10 +371,8 @@ Hotness RiskEvaluator::calcCallerHotness(const Function * func, int level)
     }
     visited.insert(item.first);
     errind(2);
-    //const char *name = item.first->getName().data();
-    std::string funcname(cpp_demangle(item.first->getName().data()));
-    eval_debug("Depth #%d: %s ", item.second, funcname.c_str());
-    Hotness hot = calcFuncHotness(funcname.c_str());
+    eval_debug("Depth #%d: %s ", item.second, item.first->getName().data());
+    Hotness hot = calcFuncHotness(item.first);
     eval_debug("%s\n", toHotStr(hot));
     if (hot == Hot) {
       return Hot;
@@ -285,8 +382,7 @@ Hotness RiskEvaluator::calcCallerHotness(const Function * func, int level)
       bfsQueue.pop();
       continue;
     }
-    CallSiteFinder csf(item.first);
-    CallSiteFinder::cs_iterator ci = csf.begin(), ce = csf.end();
+    CallerGraph::const_cs_iterator ci = graph.begin(item.first), ce = graph.end(item.first);
     if(ci == ce) { 
       errind(4);
       eval_debug("no caller\n"); 
@@ -298,20 +394,12 @@ Hotness RiskEvaluator::calcCallerHotness(const Function * func, int level)
       const Function *caller = ci->first;
       if (visited.count(caller))
         continue;
-      //TODO test if CallInst is in loop
       if (!caller->isDeclaration() && ci->second) {
-        if (!loop_analyzed.count(caller)) {
-          if (func_manager) {
-            func_manager->run(*(const_cast<Function *>(caller)));
-            loop_analyzed.insert(caller);
-          }
-        }
         errind(4);
         eval_debug("called from %s [", cpp_demangle(caller->getName().data()));
         eval_debug(ci->second);
         eval_debug("], ");
-        const BasicBlock * BB = ci->second->getParent();
-        if (GlobalLI->inLoop(caller, BB)) {
+        if (callers->inLoop(ci->second)) {
           eval_debug("in loop\n");
           return Hot;
         }
@@ -321,7 +409,7 @@ Hotness RiskEvaluator::calcCallerHotness(const Function * func, int level)
     }
     bfsQueue.pop();
   }
-  if (callers > CALLERHOT)
+  if (ncallers > thresholds.caller_hot)
     return Hot;
   //TODO define cold function
   return Regular;
@@ -346,7 +434,7 @@ Expensiveness RiskEvaluator::calcInstExp(const Instruction * I)
     if (cost == 0 || cost == (unsigned) -1)
       exp = Minor;
     else
-      if (cost > INSTEXP)
+      if (cost > thresholds.inst_exp)
         exp = Expensive;
       else
         exp = Normal;
@@ -354,27 +442,31 @@ Expensiveness RiskEvaluator::calcInstExp(const Instruction * I)
   return exp;
 }
 
-Expensiveness RiskEvaluator::calcFuncExp(const char * funcName)
+Expensiveness RiskEvaluator::calcFuncExp(const ProfileEntry & entry)
 {
-  if (profile) {
-    for (Profile::iterator it = profile->begin(), ie = profile->end(); 
-        it != ie; ++it) {
-      if (it->first == SYSCALL || it->first == LOCKCALL || it->first == EXPCALL) {
-        if (std::binary_search(it->second.begin(), it->second.end(), funcName)) {
-          errind(2);
-          eval_debug("*%s*\n",toSpeFuncStr(it->first)); 
-          return Expensive;
-        }
-      }
-    }
+  unsigned mask = entry.mask & (SPEMASK(SYSCALL) | SPEMASK(LOCKCALL) | SPEMASK(EXPCALL));
+  if (mask) {
+    errind(2);
+    eval_debug("*%s*\n",toSpeFuncStr(CompiledProfile::firstType(mask))); 
+    return Expensive;
+  }
+  if (profile && profile->isCostly(entry)) {
+    errind(2);
+    eval_debug("*costly: %llu*\n", (unsigned long long) CompiledProfile::callCost(entry.weight)); 
+    return Expensive;
   }
   return Normal;
 }
 
+Expensiveness RiskEvaluator::calcFuncExp(const char * funcName)
+{
+  return calcFuncExp(profile ? profile->lookupName(funcName) : ProfileEntry());
+}
+
 Expensiveness RiskEvaluator::calcFuncExp(const Function * func)
 {
   if (func)
-    return calcFuncExp(cpp_demangle(func->getName().data()));
+    return calcFuncExp(profile ? profile->lookup(func) : ProfileEntry());
   return Minor;
 }
 
@@ -403,11 +495,13 @@ bool RiskEvaluator::runOnFunction(Function &F)
     return false;
   }
   memset(FuncRiskStat, 0, sizeof(FuncRiskStat));
-  LocalLI = &getAnalysis<LoopInfo>(); 
-  SE = &getAnalysis<ScalarEvolution>(); 
+  if (callers == NULL) { // no module given at construction
+    callers = new CallerHotnessCache(F.getParent());
+    own_callers = true;
+  }
+  summary = &callers->getAnalysisCache()->summarize(&F);
   INDENT = 4;
   InstVecTy &inst_vec = m_inst_map[&F];
-  std::map<Loop *, unsigned> LoopDepthMap;
 #if 0
   DepGraph * graph = NULL;
   DepGraphBuilder * builder = NULL; // don't use OwnigPtr;
@@ -433,7 +527,7 @@ bool RiskEvaluator::runOnFunction(Function &F)
   }
   for (InstVecIter I = inst_vec.begin(), E = inst_vec.end(); I != E; I++) {
     Instruction* inst = *I;
-    RiskLevel max = assess(inst, LoopDepthMap, funcHot);
+    RiskLevel max = assess(inst, funcHot);
     errind();
     eval_debug("%s\n", toRiskStr(max));
 
@@ -441,7 +535,7 @@ bool RiskEvaluator::runOnFunction(Function &F)
       const Instruction * propagate;
       eval_debug("Evaluating slice...\n");
       while ((propagate = slicer->next()) != NULL) {
-        RiskLevel r = assess(propagate, LoopDepthMap, funcHot);
+        RiskLevel r = assess(propagate, funcHot);
         //We could break once we reach ExtremeRisk
         //But we just iterate all over it for now
         if (r > max)
@@ -457,7 +551,7 @@ bool RiskEvaluator::runOnFunction(Function &F)
       Instruction * propagate;
       eval_debug("Evaluating slice...\n");
       while ((propagate = slicer.next()) != NULL) {
-        RiskLevel r = assess(propagate, LoopDepthMap, funcHot);
+        RiskLevel r = assess(propagate, funcHot);
         //We could break once we reach ExtremeRisk
         //But we just iterate all over it for now
         if (r > max)
@@ -486,26 +580,24 @@ bool RiskEvaluator::runOnFunction(Function &F)
 inline void RiskEvaluator::statPrint(unsigned stat[RISKLEVELS])
 {
   for (int i = 0; i < RISKLEVELS; i++) {
-    printf("%s:\t%u\n", toRiskStr((RiskLevel) i), stat[i]);
+    fprintf(out, "%s:\t%u\n", toRiskStr((RiskLevel) i), stat[i]);
   }
 }
 
 void RiskEvaluator::statFuncRisk(const char * funcname)
 {
-  printf("===='%s' risk summary====\n", funcname);
+  fprintf(out, "===='%s' risk summary====\n", funcname);
   statPrint(FuncRiskStat);
 }
 
 void RiskEvaluator::statAllRisk()
 {
-  printf("====Overall risk summary====\n");
+  fprintf(out, "====Overall risk summary====\n");
   statPrint(AllRiskStat);
 }
 
 
 char RiskEvaluator::ID = 0;
-char DummyLoopInfo::ID = 0;
 const char * RiskEvaluator::PassName = "Risk evaluator pass";
-const char * DummyLoopInfo::PassName = "Dummy Loop Info";
 } // End of llvm namespace
 
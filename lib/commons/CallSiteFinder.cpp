@@ -1,7 +1,10 @@
 #include "llvm/Instruction.h"
+#include "llvm/Instructions.h"
 #include "llvm/Support/CallSite.h"
+#include "llvm/Support/InstIterator.h"
 
 #include "commons/CallSiteFinder.h"
+#include "commons/LLVMHelper.h"
 
 using namespace llvm;
 
@@ -16,3 +19,55 @@ CallSiteFinder::CallSiteFinder(const Function * func)
     }
   }
 }
+
+void llvm::buildCallIndex(const Module * module, CallIndex & index)
+{
+  for (Module::const_iterator F = module->begin(), FE = module->end(); F != FE; ++F) {
+    for (const_inst_iterator I = inst_begin(*F), E = inst_end(*F); I != E; ++I) {
+      if (const CallInst * CI = dyn_cast<CallInst>(&*I)) {
+        const Function * callee = CI->getCalledFunction();
+        if (callee == NULL)
+          continue;
+        std::vector<std::string> & names = index[callee->getName()];
+        if (names.empty() || names.back() != F->getName()) // F is visited at once
+          names.push_back(F->getName());
+      }
+    }
+  }
+}
+
+CallerGraph::CallerGraph(Module * module, const CallIndex * index) : 
+  module(module), index(index)
+{
+  if (module == NULL || index != NULL)
+    return;
+  for (Module::const_iterator F = module->begin(), FE = module->end(); F != FE; ++F) {
+    for (const_inst_iterator I = inst_begin(*F), E = inst_end(*F); I != E; ++I) {
+      if (const CallInst * CI = dyn_cast<CallInst>(&*I)) {
+        if (const Function * callee = CI->getCalledFunction())
+          callers[callee].push_back(std::make_pair(&*F, CI));
+      }
+    }
+  }
+}
+
+const CallerGraph::CallerVecTy & CallerGraph::collect(const Function * func) const
+{
+  CallerVecTy & sites = callers[func];
+  CallIndex::const_iterator I = index->find(func->getName());
+  if (I == index->end())
+    return sites;
+  for (std::vector<std::string>::const_iterator NI = I->getValue().begin(), 
+      NE = I->getValue().end(); NI != NE; ++NI) {
+    Function * caller = module->getFunction(*NI);
+    if (caller == NULL || !materialize(caller))
+      continue;
+    for (const_inst_iterator II = inst_begin(*caller), IE = inst_end(*caller); II != IE; ++II) {
+      if (const CallInst * CI = dyn_cast<CallInst>(&*II)) {
+        if (CI->getCalledFunction() == func)
+          sites.push_back(std::make_pair(caller, CI));
+      }
+    }
+  }
+  return sites;
+}
@@ -0,0 +1,265 @@
+/**
+ *  @file          FunctionHash.cpp
+ *
+ *  @version       1.0
+ *  @created       05/10/2013 09:12:40 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *
+ *  Structural hash of a function
+ *
+ */
+
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/InlineAsm.h"
+#include "llvm/Instructions.h"
+#include "llvm/IntrinsicInst.h"
+#include "llvm/Module.h"
+
+#include "commons/FunctionHash.h"
+
+namespace llvm {
+
+uint64_t hashString(uint64_t h, StringRef s)
+{
+  uint64_t v = 14695981039346656037ULL; // FNV-1a
+  for (size_t i = 0; i < s.size(); ++i) {
+    v ^= (unsigned char) s[i];
+    v *= 1099511628211ULL;
+  }
+  return hashCombine(h, v);
+}
+
+namespace {
+
+enum OperandTag {LocalTag = 1, ConstantTag, AsmTag, OtherTag, SeenTag};
+
+class FunctionHasher {
+  private:
+    uint64_t h;
+    DenseMap<const Value *, unsigned> locals; // arguments, blocks and instructions
+    // Types and constants hashed so far, in order. Nested ones are hashed
+    // in full the first time and by their number afterwards, which keeps
+    // shared subexpressions linear and ends the recursion of unnamed
+    // structs.
+    DenseMap<const void *, unsigned> seen;
+
+  public:
+    FunctionHasher() : h(0) {}
+
+    void mix(uint64_t v) { h = hashCombine(h, v); }
+
+    void mixAPInt(const APInt & val)
+    {
+      mix(val.getBitWidth());
+      const uint64_t * words = val.getRawData();
+      for (unsigned i = 0; i < val.getNumWords(); ++i)
+        mix(words[i]);
+    }
+
+    /// Whether P was hashed before, in which case its number is mixed
+    bool mixSeen(const void * P)
+    {
+      std::pair<DenseMap<const void *, unsigned>::iterator, bool> r =
+        seen.insert(std::make_pair(P, (unsigned) seen.size()));
+      if (r.second)
+        return false;
+      mix(SeenTag);
+      mix(r.first->second);
+      return true;
+    }
+
+    void mixType(Type * T)
+    {
+      mix(T->getTypeID());
+      if (IntegerType * IT = dyn_cast<IntegerType>(T)) {
+        mix(IT->getBitWidth());
+        return;
+      }
+      if (StructType * ST = dyn_cast<StructType>(T)) {
+        if (ST->hasName()) {
+          h = hashString(h, ST->getName());
+          return;
+        }
+      }
+      if (mixSeen(T))
+        return;
+      if (ArrayType * AT = dyn_cast<ArrayType>(T))
+        mix(AT->getNumElements());
+      else if (VectorType * VT = dyn_cast<VectorType>(T))
+        mix(VT->getNumElements());
+      else if (PointerType * PT = dyn_cast<PointerType>(T))
+        mix(PT->getAddressSpace());
+      mix(T->getNumContainedTypes());
+      for (unsigned i = 0; i < T->getNumContainedTypes(); ++i)
+        mixType(T->getContainedType(i));
+    }
+
+    void mixConstant(const Constant * C)
+    {
+      mix(C->getValueID());
+      mixType(C->getType());
+      if (const GlobalValue * GV = dyn_cast<GlobalValue>(C)) {
+        h = hashString(h, GV->getName());
+        return;
+      }
+      if (const ConstantInt * CI = dyn_cast<ConstantInt>(C)) {
+        mixAPInt(CI->getValue());
+        return;
+      }
+      if (const ConstantFP * CF = dyn_cast<ConstantFP>(C)) {
+        mixAPInt(CF->getValueAPF().bitcastToAPInt());
+        return;
+      }
+      if (const ConstantDataSequential * CD = dyn_cast<ConstantDataSequential>(C)) {
+        h = hashString(h, CD->getRawDataValues());
+        return;
+      }
+      if (mixSeen(C))
+        return;
+      if (const ConstantExpr * CE = dyn_cast<ConstantExpr>(C))
+        mix(CE->getOpcode());
+      mix(C->getNumOperands());
+      for (unsigned i = 0; i < C->getNumOperands(); ++i)
+        mixConstant(cast<Constant>(C->getOperand(i)));
+    }
+
+    void mixOperand(const Value * V)
+    {
+      DenseMap<const Value *, unsigned>::iterator I = locals.find(V);
+      if (I != locals.end()) {
+        mix(LocalTag);
+        mix(I->second);
+      }
+      else if (const Constant * C = dyn_cast<Constant>(V)) {
+        mix(ConstantTag);
+        mixConstant(C);
+      }
+      else if (const InlineAsm * IA = dyn_cast<InlineAsm>(V)) {
+        mix(AsmTag);
+        h = hashString(h, IA->getAsmString());
+        h = hashString(h, IA->getConstraintString());
+      }
+      else { // metadata
+        mix(OtherTag);
+        mix(V->getValueID());
+      }
+    }
+
+    void mixInstruction(const Instruction * I)
+    {
+      mix(I->getOpcode());
+      mixType(I->getType());
+      mix(I->getNumOperands());
+      for (unsigned i = 0; i < I->getNumOperands(); ++i)
+        mixOperand(I->getOperand(i));
+      if (const CmpInst * CI = dyn_cast<CmpInst>(I))
+        mix(CI->getPredicate());
+      else if (const LoadInst * LI = dyn_cast<LoadInst>(I)) {
+        mix(LI->isVolatile());
+        mix(LI->getAlignment());
+      }
+      else if (const StoreInst * SI = dyn_cast<StoreInst>(I)) {
+        mix(SI->isVolatile());
+        mix(SI->getAlignment());
+      }
+      else if (const GetElementPtrInst * GEP = dyn_cast<GetElementPtrInst>(I))
+        mix(GEP->isInBounds());
+      else if (const PHINode * PN = dyn_cast<PHINode>(I)) {
+        // The incoming blocks are not operands
+        for (unsigned i = 0; i < PN->getNumIncomingValues(); ++i)
+          mixOperand(PN->getIncomingBlock(i));
+      }
+      else if (const CallInst * CI = dyn_cast<CallInst>(I))
+        mix(CI->getCallingConv());
+      else if (const InvokeInst * II = dyn_cast<InvokeInst>(I))
+        mix(II->getCallingConv());
+    }
+
+    uint64_t hash(const Function * F, DenseMap<const BasicBlock *, unsigned> * block_ids)
+    {
+      mixType(F->getFunctionType());
+      mix(F->getCallingConv());
+      // Number the locals up front, phis and branches refer forward
+      unsigned id = 0;
+      for (Function::const_arg_iterator AI = F->arg_begin(), AE = F->arg_end();
+          AI != AE; ++AI)
+        locals[AI] = id++;
+      unsigned bb = 0;
+      for (Function::const_iterator BI = F->begin(), BE = F->end(); BI != BE; ++BI, ++bb) {
+        locals[BI] = id++;
+        if (block_ids)
+          (*block_ids)[BI] = bb;
+        for (BasicBlock::const_iterator II = BI->begin(), IE = BI->end(); II != IE; ++II) {
+          if (!isa<DbgInfoIntrinsic>(II))
+            locals[II] = id++;
+        }
+      }
+      for (Function::const_iterator BI = F->begin(), BE = F->end(); BI != BE; ++BI) {
+        mix(locals[BI]);
+        for (BasicBlock::const_iterator II = BI->begin(), IE = BI->end(); II != IE; ++II) {
+          if (!isa<DbgInfoIntrinsic>(II))
+            mixInstruction(II);
+        }
+      }
+      return h;
+    }
+
+    uint64_t hashModule(const Module * M)
+    {
+      for (Module::const_global_iterator GI = M->global_begin(), GE = M->global_end();
+          GI != GE; ++GI) {
+        h = hashString(h, GI->getName());
+        mixType(GI->getType());
+        mix(GI->isConstant());
+        mix(GI->hasInitializer());
+        if (GI->hasInitializer())
+          mixConstant(GI->getInitializer());
+      }
+      for (Module::const_alias_iterator AI = M->alias_begin(), AE = M->alias_end();
+          AI != AE; ++AI) {
+        h = hashString(h, AI->getName());
+        mixConstant(AI->getAliasee());
+      }
+      for (Module::const_iterator FI = M->begin(), FE = M->end(); FI != FE; ++FI) {
+        h = hashString(h, FI->getName());
+        mix(FI->isDeclaration());
+        mix(hashFunction(FI));
+      }
+      return h;
+    }
+};
+
+} // End of anonymous namespace
+
+uint64_t hashFunction(const Function * F, DenseMap<const BasicBlock *, unsigned> * block_ids)
+{
+  FunctionHasher hasher;
+  return hasher.hash(F, block_ids);
+}
+
+uint64_t hashModule(const Module * M)
+{
+  FunctionHasher hasher;
+  return hasher.hashModule(M);
+}
+
+} // End of llvm namespace
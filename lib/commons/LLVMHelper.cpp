@@ -65,7 +65,8 @@ static const char * SpeTypeName[HOTTYPES] = {
   "SYSCALL",
   "LOCKCALL",
   "EXPCALL",
-  "FREQCALL"
+  "FREQCALL",
+  "SAMPLED"
 };
 
 static const char * SpeTypeStr[HOTTYPES] = {
@@ -73,7 +74,8 @@ static const char * SpeTypeStr[HOTTYPES] = {
   "system call",
   "lock call",
   "expensive call",
-  "frequent call"
+  "frequent call",
+  "sampled call"
 };
 
 const char * toSpeFuncStr(const SpeFuncType type)
@@ -94,12 +96,12 @@ SpeFuncType fromSpeTypeName(const char * name)
 {
   int i;
   SpeFuncType type;
-  for (i = SYSCALL; i <= FREQCALL; i++) {
+  for (i = SYSCALL; i <= SAMPLED; i++) {
     type = (SpeFuncType) i;
     if (strcmp(name, toSpeFuncName(type)) == 0)
       break;
   }
-  if (i > FREQCALL)
+  if (i > SAMPLED)
     return INVALIDTYPE;
   return type;
 }
@@ -147,15 +149,31 @@ size_t count_strips(Module * M)
   return 0;
 }
 
-Module *ReadModule(LLVMContext &Context, StringRef Name)
+Module *ReadModule(LLVMContext &Context, StringRef Name, bool lazy)
 {
   SMDiagnostic Diag;
-  Module *M = ParseIRFile(Name, Diag, Context);
+  Module *M;
+  if (lazy) // textual IR is still parsed as a whole
+    M = getLazyIRFileModule(Name, Diag, Context);
+  else
+    M = ParseIRFile(Name, Diag, Context);
   if (!M)
     std::cerr << "IR file parsing failed: " << Diag.getMessage() << std::endl;
   return M;
 }
 
+bool materialize(Function *F)
+{
+  if (F == NULL || !F->isMaterializable())
+    return true;
+  std::string Err;
+  if (F->Materialize(&Err)) {
+    std::cerr << "Cannot read function " << F->getName().str() << ": " << Err << std::endl;
+    return false;
+  }
+  return true;
+}
+
 TargetMachine * getTargetMachine()
 {
   const std::string TripleStr = llvm::sys::getHostTriple();
@@ -214,18 +232,48 @@ void indent(raw_ostream & OS, int space)
   }
 }
 
-bool parseProfile(const char *fname, Profile &profile)
+// Read a whole line into a growing buffer, without the newline
+static bool readProfileLine(FILE *fp, char *&buf, size_t &cap)
+{
+  if (getline(&buf, &cap, fp) < 0)
+    return false;
+  buf[strcspn(buf, "\r\n")] = '\0';
+  return true;
+}
+
+// Split the weight fields off a function line
+static FuncWeight parseWeight(char *buf)
+{
+  FuncWeight w;
+  char *p = strchr(buf, PROFILE_WEIGHT_SEP);
+  if (p == NULL)
+    return w;
+  *p++ = '\0';
+  uint64_t *fields[] = {&w.self, &w.inclusive, &w.calls};
+  for (unsigned i = 0; i < 3 && *p; i++) {
+    char *end;
+    *fields[i] = strtoull(p, &end, 10);
+    if (*end != PROFILE_WEIGHT_SEP)
+      break;
+    p = end + 1;
+  }
+  return w;
+}
+
+bool parseProfile(const char *fname, Profile &profile, ProfileWeights *weights)
 {
   FILE *fp = fopen(fname,"r");
   if (fp == NULL) {
     perror("Read profile file");
     return false;
   }
-  char buf[256];
+  char *buf = NULL;
+  size_t cap = 0;
   bool preamble = false;
+  bool ok = true;
   SpeFuncType type = INVALIDTYPE; 
   unsigned line = 0;
-  while (fgetline(fp, buf, 256) != NULL) {
+  while (readProfileLine(fp, buf, cap)) {
     line++;
     if (strcmp(buf, "") == 0) // skip empty line
       continue;
@@ -235,19 +283,22 @@ bool parseProfile(const char *fname, Profile &profile)
       }
       // Preamble detected. Expect next line to be 
       // segment type
-      if (fgetline(fp, buf, 256) == NULL) {
+      if (!readProfileLine(fp, buf, cap)) {
         syntaxerr("expected profile segment type", line);
-        return false;
+        ok = false;
+        break;
       }
       line++;
       type = fromSpeTypeName(buf);
       if (type == INVALIDTYPE) {
         syntaxerr("unknown profile segment type", line);
-        return false;
+        ok = false;
+        break;
       }
-      if (fgetline(fp, buf, 256) == NULL || strcmp(buf, PROFILE_SEGMENT_END) != 0) {
+      if (!readProfileLine(fp, buf, cap) || strcmp(buf, PROFILE_SEGMENT_END) != 0) {
         syntaxerr("expected profile segment end", line);
-        return false;
+        ok = false;
+        break;
       }
       line++;
       preamble = true;
@@ -256,23 +307,32 @@ bool parseProfile(const char *fname, Profile &profile)
     else
       if (strcmp(buf, PROFILE_SEGMENT_END) == 0) {
         syntaxerr("expected profile segment begin", line);
-        return false;
+        ok = false;
+        break;
       }
       else {
         if (type == INVALIDTYPE) {
           syntaxerr("no profile segment type specified", line);
-          return false;
+          ok = false;
+          break;
         }
         preamble = false;
-        if (strlen(buf))
+        FuncWeight w = parseWeight(buf);
+        if (strlen(buf)) {
           profile[type].push_back(buf);
+          if (weights && !w.empty())
+            (*weights)[buf].merge(w);
+        }
       }
   }
+  free(buf);
+  fclose(fp);
+  if (!ok)
+    return false;
   for (Profile::iterator it = profile.begin(), ie = profile.end(); it != ie; ++it) {
     std::vector<std::string> &vec = it->second;
     std::sort(vec.begin(), vec.end());
   }
-  fclose(fp);
   return true;
 }
 
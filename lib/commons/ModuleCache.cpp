@@ -0,0 +1,140 @@
+/**
+ *  @file          ModuleCache.cpp
+ *
+ *  @version       1.0
+ *  @created       05/18/2013 02:26:51 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *  
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *     
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *  
+ *  Modules loaded on demand under a memory budget
+ *
+ */
+
+#include "commons/ModuleCache.h"
+
+// Average in-memory sizes, operands and debug locations included
+#define GLOBAL_BYTES    128
+#define FUNCTION_BYTES  256
+#define BLOCK_BYTES     96
+#define INST_BYTES      160
+// Builtin types and the uniquing tables of an empty context
+#define CONTEXT_BYTES   16384
+// Types, constants and metadata the module adds to its context, per
+// global and per instruction
+#define UNIQUED_BYTES   32
+
+namespace llvm {
+
+size_t moduleFootprint(const Module * M)
+{
+  size_t bytes = CONTEXT_BYTES + M->global_size() * (GLOBAL_BYTES + UNIQUED_BYTES);
+  for (Module::const_iterator F = M->begin(), FE = M->end(); F != FE; ++F) {
+    bytes += FUNCTION_BYTES + UNIQUED_BYTES;
+    for (Function::const_iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+      bytes += BLOCK_BYTES + BB->size() * (INST_BYTES + UNIQUED_BYTES);
+  }
+  return bytes;
+}
+
+ModuleCache::ModuleCache(std::vector<ModuleArg> & mods, size_t budget) : 
+  mods(mods), entries(mods.size()), budget(budget), used(0), hits(0), misses(0),
+  evictions(0)
+{
+  for (unsigned id = 0; id < mods.size(); ++id) {
+    if (mods[id].module == NULL)
+      continue;
+    entries[id].cached = true;
+    entries[id].context = &mods[id].module->getContext();
+    entries[id].pos = lru.insert(lru.end(), id);
+    entries[id].footprint = moduleFootprint(mods[id].module);
+    used += entries[id].footprint;
+  }
+}
+
+Module * ModuleCache::get(unsigned id)
+{
+  Entry & entry = entries[id];
+  if (entry.cached) {
+    hits++;
+    lru.splice(lru.begin(), lru, entry.pos);
+    return mods[id].module;
+  }
+  misses++;
+  LLVMContext * context = new LLVMContext();
+  if (!load(id, mods[id], *context)) {
+    delete context;
+    return NULL;
+  }
+  entry.context = context;
+  entry.cached = true;
+  entry.pos = lru.insert(lru.begin(), id);
+  update(id);
+  return mods[id].module;
+}
+
+void ModuleCache::setState(unsigned id, ModuleState * state)
+{
+  Entry & entry = entries[id];
+  if (entry.state != state)
+    delete entry.state;
+  entry.state = state;
+}
+
+void ModuleCache::update(unsigned id)
+{
+  Entry & entry = entries[id];
+  if (!entry.cached)
+    return;
+  used -= entry.footprint;
+  entry.footprint = moduleFootprint(mods[id].module);
+  if (entry.state)
+    entry.footprint += entry.state->footprint();
+  used += entry.footprint;
+  // The module in use is kept even if it doesn't fit alone
+  while (budget && used > budget && lru.back() != id) {
+    drop(lru.back());
+    evictions++;
+  }
+}
+
+void ModuleCache::drop(unsigned id)
+{
+  Entry & entry = entries[id];
+  // The state may refer to the module
+  delete entry.state;
+  entry.state = NULL;
+  release(id, mods[id]);
+  delete mods[id].module;
+  mods[id].module = NULL;
+  delete entry.context;
+  entry.context = NULL;
+  lru.erase(entry.pos);
+  entry.cached = false;
+  used -= entry.footprint;
+  entry.footprint = 0;
+}
+
+void ModuleCache::clear()
+{
+  while (!lru.empty())
+    drop(lru.front());
+}
+
+} // End of llvm namespace
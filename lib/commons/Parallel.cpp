@@ -0,0 +1,92 @@
+/**
+ *  @file          Parallel.cpp
+ *
+ *  @version       1.0
+ *  @created       05/02/2013 10:20:04 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *
+ *  Worker pool implementation
+ *
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+#include "commons/handy.h"
+#include "commons/Parallel.h"
+
+namespace {
+
+struct WorkerArg {
+  ParallelTask * task;
+  unsigned n;
+  unsigned worker;
+  volatile unsigned * next;
+};
+
+void * worker_main(void * p)
+{
+  WorkerArg * arg = (WorkerArg *) p;
+  for (;;) {
+    unsigned index = __sync_fetch_and_add(arg->next, 1);
+    if (index >= arg->n)
+      break;
+    arg->task->run(index, arg->worker);
+  }
+  return NULL;
+}
+
+} // End of anonymous namespace
+
+unsigned hardware_threads()
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (unsigned) n : 1;
+}
+
+void parallel_for(ParallelTask & task, unsigned n, unsigned threads)
+{
+  if (threads > n)
+    threads = n;
+  if (threads <= 1) {
+    for (unsigned i = 0; i < n; ++i)
+      task.run(i, 0);
+    return;
+  }
+  volatile unsigned next = 0;
+  std::vector<WorkerArg> args(threads);
+  std::vector<pthread_t> tids(threads);
+  for (unsigned i = 0; i < threads; ++i) {
+    args[i].task = &task;
+    args[i].n = n;
+    args[i].worker = i;
+    args[i].next = &next;
+  }
+  // the calling thread acts as worker #0
+  for (unsigned i = 1; i < threads; ++i) {
+    if (pthread_create(&tids[i], NULL, worker_main, &args[i]) != 0)
+      diegrace("Cannot create worker thread #%u", i);
+  }
+  worker_main(&args[0]);
+  for (unsigned i = 1; i < threads; ++i)
+    pthread_join(tids[i], NULL);
+}
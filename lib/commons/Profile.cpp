@@ -0,0 +1,152 @@
+/**
+ *  @file          Profile.cpp
+ *
+ *  @version       1.0
+ *  @created       05/04/2013 03:31:08 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *  
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *     
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *  
+ *  Compiled profile implementation
+ *
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "commons/handy.h"
+#include "commons/Profile.h"
+
+namespace llvm {
+
+void CompiledProfile::add(const Profile & profile)
+{
+  for (Profile::const_iterator it = profile.begin(), ie = profile.end(); 
+      it != ie; ++it) {
+    for (std::vector<std::string>::const_iterator ni = it->second.begin(),
+        ne = it->second.end(); ni != ne; ++ni)
+      add(*ni, it->first);
+  }
+}
+
+void CompiledProfile::add(const ProfileWeights & weights)
+{
+  for (ProfileWeights::const_iterator it = weights.begin(), ie = weights.end(); 
+      it != ie; ++it)
+    names.GetOrCreateValue(it->first).getValue().weight.merge(it->second);
+  symbols.clear(); // memoized entries may be stale now
+}
+
+void CompiledProfile::add(StringRef name, SpeFuncType type)
+{
+  names.GetOrCreateValue(name).getValue().mask |= SPEMASK(type);
+  symbols.clear();
+}
+
+ProfileEntry CompiledProfile::lookupName(StringRef name) const
+{
+  ProfileEntry entry;
+  if (db) {
+    if (const ProfileDBEntry * E = db->find(name)) {
+      entry.mask = E->mask;
+      entry.weight = FuncWeight(E->self, E->inclusive, E->calls);
+    }
+  }
+  StringMap<ProfileEntry>::const_iterator I = names.find(name);
+  if (I != names.end())
+    entry.merge(I->getValue());
+  return entry;
+}
+
+const ProfileEntry & CompiledProfile::lookup(StringRef symbol)
+{
+  StringMap<ProfileEntry>::iterator I = symbols.find(symbol);
+  if (I != symbols.end())
+    return I->getValue();
+  // Profiles list demangled names, but a mangled one matches as well
+  std::string sym = symbol.str();
+  ProfileEntry entry = lookupName(sym);
+  const char * dname = cpp_demangle(sym.c_str());
+  if (dname != NULL && sym != dname)
+    entry.merge(lookupName(dname));
+  return symbols.GetOrCreateValue(symbol, entry).getValue();
+}
+
+uint64_t CompiledProfile::callCost(const FuncWeight & w)
+{
+  uint64_t cost = w.inclusive ? w.inclusive : w.self;
+  return w.calls ? cost / w.calls : cost;
+}
+
+uint64_t CompiledProfile::callFreq(const FuncWeight & w)
+{
+  return w.calls ? w.calls : w.self;
+}
+
+static uint64_t percentile(std::vector<uint64_t> & values, double pct)
+{
+  if (values.empty() || pct <= 0)
+    return 0;
+  if (pct > 100)
+    pct = 100;
+  size_t k = (size_t) ((values.size() - 1) * pct / 100);
+  std::nth_element(values.begin(), values.begin() + k, values.end());
+  uint64_t v = values[k];
+  return v ? v : 1; // 0 would disable the cutoff
+}
+
+static void addWeight(const FuncWeight & w, std::vector<uint64_t> & costs,
+    std::vector<uint64_t> & freqs)
+{
+  if (CompiledProfile::callCost(w))
+    costs.push_back(CompiledProfile::callCost(w));
+  if (CompiledProfile::callFreq(w))
+    freqs.push_back(CompiledProfile::callFreq(w));
+}
+
+/// One weight per function, merged from both sources as lookupName
+/// does, so that a function in both isn't counted twice
+void CompiledProfile::setCutoffs(double cost_percentile, double freq_percentile)
+{
+  std::vector<uint64_t> costs, freqs;
+  for (StringMap<ProfileEntry>::const_iterator I = names.begin(), E = names.end(); 
+      I != E; ++I)
+    addWeight(lookupName(I->getKey()).weight, costs, freqs);
+  if (db) {
+    for (unsigned i = 0; i < db->slot_size(); ++i) {
+      if (names.count(db->slot_name(i)))
+        continue;
+      addWeight(db->slot_weight(i), costs, freqs);
+    }
+  }
+  cost_cutoff = percentile(costs, cost_percentile);
+  freq_cutoff = percentile(freqs, freq_percentile);
+}
+
+SpeFuncType CompiledProfile::firstType(unsigned mask)
+{
+  for (int i = SYSCALL; i <= SAMPLED; i++) {
+    if (mask & SPEMASK(i))
+      return (SpeFuncType) i;
+  }
+  return INVALIDTYPE;
+}
+
+} // End of llvm namespace
@@ -0,0 +1,311 @@
+/**
+ *  @file          ProfileDB.cpp
+ *
+ *  @version       1.0
+ *  @created       05/06/2013 10:05:33 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *  
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *  
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *     
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *  
+ *  Binary profile database implementation
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "commons/handy.h"
+#include "commons/ProfileDB.h"
+
+// Give up on a bucket after this many displacements and retry 
+// with a larger table
+#define MAX_DISPLACEMENT (1 << 20)
+
+namespace llvm {
+
+static uint32_t pdb_hash(const char * s, size_t n, uint32_t seed)
+{
+  uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u); // FNV-1a
+  for (size_t i = 0; i < n; ++i) {
+    h ^= (unsigned char) s[i];
+    h *= 16777619u;
+  }
+  h ^= h >> 15; // FNV mixes the last bytes poorly
+  h *= 0x2c1b3c6du;
+  h ^= h >> 12;
+  return h;
+}
+
+// Entries hold 64 bit weights
+static inline size_t align8(size_t n)
+{
+  return (n + 7) & ~(size_t) 7;
+}
+
+bool ProfileDB::open(const char * fname)
+{
+  close();
+  int fd = ::open(fname, O_RDONLY);
+  if (fd < 0) {
+    perror("Open profile database");
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    perror("Stat profile database");
+    ::close(fd);
+    return false;
+  }
+  length = st.st_size;
+  if (length < sizeof(ProfileDBHeader)) {
+    fprintf(stderr, "Profile database %s is truncated\n", fname);
+    ::close(fd);
+    return false;
+  }
+  base = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    perror("Map profile database");
+    base = NULL;
+    return false;
+  }
+  const char * p = (const char *) base;
+  header = (const ProfileDBHeader *) p;
+  if (memcmp(header->magic, PROFILEDB_MAGIC, PROFILEDB_MAGIC_LEN) != 0 ||
+      header->version != PROFILEDB_VERSION) {
+    fprintf(stderr, "%s is not a profile database of version %d\n", fname, 
+        PROFILEDB_VERSION);
+    close();
+    return false;
+  }
+  if (header->nbuckets == 0 || header->nslots < header->nentries ||
+      header->disp_off + (uint64_t) header->nbuckets * sizeof(int32_t) > length ||
+      header->slot_off + (uint64_t) header->nslots * sizeof(ProfileDBEntry) > length ||
+      header->str_off + (uint64_t) header->str_size > length) {
+    fprintf(stderr, "Profile database %s is corrupted\n", fname);
+    close();
+    return false;
+  }
+  disps = (const int32_t *) (p + header->disp_off);
+  slots = (const ProfileDBEntry *) (p + header->slot_off);
+  strings = p + header->str_off;
+  for (unsigned i = 0; i < header->nslots; ++i) {
+    if ((uint64_t) slots[i].name_off + slots[i].name_len > header->str_size) {
+      fprintf(stderr, "Profile database %s is corrupted\n", fname);
+      close();
+      return false;
+    }
+  }
+  return true;
+}
+
+void ProfileDB::close()
+{
+  if (base)
+    munmap(base, length);
+  base = NULL;
+  length = 0;
+  header = NULL;
+  disps = NULL;
+  slots = NULL;
+  strings = NULL;
+}
+
+const ProfileDBEntry * ProfileDB::find(StringRef name) const
+{
+  if (header == NULL || header->nentries == 0 || name.empty())
+    return NULL;
+  uint32_t b = pdb_hash(name.data(), name.size(), 0) % header->nbuckets;
+  int32_t d = disps[b];
+  uint32_t slot;
+  if (d < 0)
+    slot = -d - 1;
+  else
+    slot = pdb_hash(name.data(), name.size(), d) % header->nslots;
+  if (slot >= header->nslots)
+    return NULL;
+  const ProfileDBEntry & E = slots[slot];
+  if (E.name_len != name.size() || 
+      memcmp(strings + E.name_off, name.data(), name.size()) != 0)
+    return NULL;
+  return &E;
+}
+
+bool isProfileDB(const char * fname)
+{
+  FILE * fp = fopen(fname, "rb");
+  if (fp == NULL)
+    return false;
+  char magic[PROFILEDB_MAGIC_LEN];
+  bool is = fread(magic, 1, PROFILEDB_MAGIC_LEN, fp) == PROFILEDB_MAGIC_LEN &&
+    memcmp(magic, PROFILEDB_MAGIC, PROFILEDB_MAGIC_LEN) == 0;
+  fclose(fp);
+  return is;
+}
+
+typedef std::vector<unsigned> BucketTy;
+
+struct BucketOrder {
+  const std::vector<BucketTy> & buckets;
+  BucketOrder(const std::vector<BucketTy> & buckets) : buckets(buckets) {}
+  bool operator()(unsigned a, unsigned b) const
+  {
+    return buckets[a].size() > buckets[b].size();
+  }
+};
+
+/// Hash and displace: place the keys of the largest buckets first, 
+/// searching for each bucket a seed that sends all of its keys to 
+/// free slots. Buckets of one key take any free slot directly.
+static bool placeKeys(const std::vector<std::string> & keys, uint32_t nbuckets,
+    uint32_t nslots, std::vector<int32_t> & disps, std::vector<int> & owner)
+{
+  std::vector<BucketTy> buckets(nbuckets);
+  for (unsigned i = 0; i < keys.size(); ++i)
+    buckets[pdb_hash(keys[i].data(), keys[i].size(), 0) % nbuckets].push_back(i);
+  std::vector<unsigned> order(nbuckets);
+  for (unsigned b = 0; b < nbuckets; ++b)
+    order[b] = b;
+  std::stable_sort(order.begin(), order.end(), BucketOrder(buckets));
+
+  disps.assign(nbuckets, 0);
+  owner.assign(nslots, -1);
+  unsigned next_free = 0;
+  std::vector<uint32_t> taken;
+  for (unsigned o = 0; o < nbuckets; ++o) {
+    unsigned b = order[o];
+    const BucketTy & bucket = buckets[b];
+    if (bucket.empty())
+      break;
+    if (bucket.size() == 1) {
+      while (owner[next_free] >= 0)
+        next_free++;
+      owner[next_free] = bucket[0];
+      disps[b] = -(int32_t) next_free - 1;
+      continue;
+    }
+    int32_t d;
+    for (d = 1; d < MAX_DISPLACEMENT; ++d) {
+      taken.clear();
+      BucketTy::const_iterator ki = bucket.begin(), ke = bucket.end();
+      for (; ki != ke; ++ki) {
+        uint32_t slot = pdb_hash(keys[*ki].data(), keys[*ki].size(), d) % nslots;
+        if (owner[slot] >= 0 || std::find(taken.begin(), taken.end(), slot) != taken.end())
+          break;
+        taken.push_back(slot);
+      }
+      if (ki == ke)
+        break;
+    }
+    if (d == MAX_DISPLACEMENT)
+      return false;
+    for (unsigned i = 0; i < bucket.size(); ++i)
+      owner[taken[i]] = bucket[i];
+    disps[b] = d;
+  }
+  return true;
+}
+
+bool writeProfileDB(const char * fname, const Profile & profile, 
+    const ProfileWeights * weights)
+{
+  std::map<std::string, unsigned> masks;
+  for (Profile::const_iterator it = profile.begin(), ie = profile.end(); 
+      it != ie; ++it) {
+    for (std::vector<std::string>::const_iterator ni = it->second.begin(),
+        ne = it->second.end(); ni != ne; ++ni) {
+      if (!ni->empty())
+        masks[*ni] |= SPEMASK(it->first);
+    }
+  }
+  std::vector<std::string> keys;
+  for (std::map<std::string, unsigned>::iterator mi = masks.begin(), 
+      me = masks.end(); mi != me; ++mi)
+    keys.push_back(mi->first);
+
+  uint32_t nentries = keys.size();
+  uint32_t nbuckets = nentries / 2 + 1;
+  uint32_t nslots = nentries > 0 ? nentries : 1;
+  std::vector<int32_t> disps;
+  std::vector<int> owner;
+  while (!placeKeys(keys, nbuckets, nslots, disps, owner))
+    nslots += nslots / 10 + 1;
+
+  ProfileDBHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PROFILEDB_MAGIC, PROFILEDB_MAGIC_LEN);
+  header.version = PROFILEDB_VERSION;
+  header.nentries = nentries;
+  header.nbuckets = nbuckets;
+  header.nslots = nslots;
+  header.disp_off = align8(sizeof(header));
+  header.slot_off = align8(header.disp_off + nbuckets * sizeof(int32_t));
+  header.str_off = header.slot_off + nslots * sizeof(ProfileDBEntry);
+
+  std::vector<ProfileDBEntry> slots(nslots);
+  std::string strings;
+  for (uint32_t i = 0; i < nslots; ++i) {
+    memset(&slots[i], 0, sizeof(ProfileDBEntry));
+    if (owner[i] < 0)
+      continue;
+    const std::string & key = keys[owner[i]];
+    slots[i].name_off = strings.size();
+    slots[i].name_len = key.size();
+    slots[i].mask = masks[key];
+    if (weights) {
+      ProfileWeights::const_iterator wi = weights->find(key);
+      if (wi != weights->end()) {
+        slots[i].self = wi->second.self;
+        slots[i].inclusive = wi->second.inclusive;
+        slots[i].calls = wi->second.calls;
+      }
+    }
+    strings.append(key);
+  }
+  header.str_size = strings.size();
+
+  FILE * fp = fopen(fname, "wb");
+  if (fp == NULL) {
+    perror("Write profile database");
+    return false;
+  }
+  static const char zeros[8] = {0};
+  size_t pad1 = header.disp_off - sizeof(header);
+  size_t pad2 = header.slot_off - header.disp_off - nbuckets * sizeof(int32_t);
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+    fwrite(zeros, 1, pad1, fp) == pad1 &&
+    fwrite(&disps[0], sizeof(int32_t), nbuckets, fp) == nbuckets &&
+    fwrite(zeros, 1, pad2, fp) == pad2 &&
+    fwrite(&slots[0], sizeof(ProfileDBEntry), nslots, fp) == nslots &&
+    fwrite(strings.data(), 1, strings.size(), fp) == strings.size();
+  if (fclose(fp) != 0)
+    ok = false;
+  if (!ok)
+    fprintf(stderr, "Failed to write profile database %s\n", fname);
+  return ok;
+}
+
+} // End of llvm namespace
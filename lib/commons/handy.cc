@@ -3,10 +3,12 @@
 
 #include "commons/handy.h"
 
-static char PBUF1[MAX_PATH];
-static char PBUF2[MAX_PATH];
-static char *MBUF = NULL;
-static size_t MBUF_LEN = 0;
+// Scratch buffers are per thread so that path matching and demangling
+// can be used from the analysis workers.
+static __thread char PBUF1[MAX_PATH];
+static __thread char PBUF2[MAX_PATH];
+static __thread char *MBUF = NULL;
+static __thread size_t MBUF_LEN = 0;
 
 static const char *SOURCE_SUFFIX[] = {
     ".c",
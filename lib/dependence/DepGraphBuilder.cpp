@@ -87,6 +87,7 @@ bool DepGraphBuilder::buildMemDepGraph()
     errs() << "\n";
     #endif
   }
+  m_graph->mem_graph->freeze();
   //m_graph->mem_graph->print(errs());
   return true;
 }
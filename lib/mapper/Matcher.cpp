@@ -1,4 +1,7 @@
+#include <limits.h>
+
 #include "commons/handy.h"
+#include "commons/LLVMHelper.h"
 #include "mapper/Matcher.h"
 
 static bool LOCAL_DEBUG = false;
@@ -35,6 +38,32 @@ bool cmpDISPCopy(const DISPCopy & SP1, const DISPCopy & SP2)
   return cmp >= 0 ? false : true;
 }
 
+// Order of the SP index: per file, by line
+static bool cmpSPIndex(const DISPCopy & SP1, const DISPCopy & SP2)
+{
+  if (SP1.pathid != SP2.pathid)
+    return SP1.pathid < SP2.pathid;
+  return SP1.linenumber < SP2.linenumber;
+}
+
+static bool lineBeforeSP(unsigned line, const DISPCopy & SP)
+{
+  return line < SP.linenumber;
+}
+
+static bool spBeforeLine(const DISPCopy & SP, unsigned line)
+{
+  return SP.linenumber < line;
+}
+
+// Filename may already contain the path information
+static std::string debugPath(StringRef directory, StringRef filename)
+{
+  if (filename.size() > 0 && filename[0] == '/')
+    return filename.str();
+  return directory.str() + "/" + filename.str();
+}
+
 bool skipFunction(Function *F)
 {
   // Skip intrinsic functions and function declaration because DT only 
@@ -184,6 +213,16 @@ void Matcher::processLoops(LoopInfo & li)
   }
 }
 
+void Matcher::compileUnitPaths(Module &M, std::vector<std::string> & paths)
+{
+  if (NamedMDNode *CU_Nodes = M.getNamedMetadata("llvm.dbg.cu"))
+    for (unsigned i = 0, e = CU_Nodes->getNumOperands(); i != e; ++i) {
+      DICompileUnit DICU(CU_Nodes->getOperand(i));
+      if (DICU.getVersion() > LLVMDebugVersion10)
+        paths.push_back(debugPath(DICU.getDirectory(), DICU.getFilename()));
+    }
+}
+
 void Matcher::processCompileUnits(Module &M)
 {
   MyCUs.clear();
@@ -196,6 +235,7 @@ void Matcher::processCompileUnits(Module &M)
 
   /** Sort based on file name, directory and line number **/
   std::sort(MyCUs.begin(), MyCUs.end(), cmpDICU);
+  buildCUIndex();
   if (LOCAL_DEBUG) {
     cu_iterator I, E;
     for (I = MyCUs.begin(), E = MyCUs.end(); I != E; I++) {
@@ -213,6 +253,10 @@ void Matcher::processSubprograms(DICompileUnit &DICU)
       DISPCopy Copy(DISP);
       if (Copy.name.empty() || Copy.filename.empty() || Copy.linenumber == 0)
         continue;
+      // Only the functions of the CUs that are matched against are read
+      // from a lazily loaded module
+      if (!materialize(Copy.function))
+        Copy.function = NULL;
       Copy.lastline = ScopeInfoFinder::getLastLine(Copy.function);
       MySPs.push_back(Copy);
     }
@@ -229,6 +273,129 @@ void Matcher::dumpSPs()
   }
 }
 
+/// Key a debug info path the way pathneq compares it against the
+/// stripped patch name.
+bool Matcher::debugKey(const std::string & debugname, std::string & key)
+{
+  char *canon = canonpath(debugname.c_str(), NULL);
+  if (canon == NULL)
+    return false;
+  key.assign(stripname(canon, debugstrips));
+  free(canon);
+  return true;
+}
+
+void Matcher::buildCUIndex()
+{
+  CUIndex.clear();
+  std::string key;
+  for (unsigned i = 0, e = MyCUs.size(); i != e; ++i) {
+    if (debugKey(debugPath(MyCUs[i].getDirectory(), MyCUs[i].getFilename()), key))
+      CUIndex.GetOrCreateValue(key, i); // the first one wins, as with a scan
+  }
+}
+
+/// Intern the paths of MySPs, group the SPs by file and fill in the
+/// last lines that are not known from the debug locations: a function
+/// ends right before the next one in the same file, the last function
+/// of a file extends to its end.
+void Matcher::buildSPIndex()
+{
+  PathIds.clear();
+  SPRanges.clear();
+  std::string key;
+  for (sp_iterator I = sp_begin(), E = sp_end(); I != E; ++I) {
+    if (debugKey(debugPath(I->directory, I->filename), key))
+      I->pathid = PathIds.GetOrCreateValue(key, PathIds.size()).getValue();
+    else
+      I->pathid = NoPath;
+  }
+  std::sort(MySPs.begin(), MySPs.end(), cmpSPIndex);
+  SPRanges.resize(PathIds.size(), std::make_pair(0U, 0U));
+  for (unsigned i = 0, e = MySPs.size(); i != e; ++i) {
+    unsigned id = MySPs[i].pathid;
+    if (id == NoPath)
+      break; // sorted last
+    if (i == 0 || MySPs[i - 1].pathid != id)
+      SPRanges[id].first = i;
+    SPRanges[id].second = i + 1;
+  }
+  for (unsigned id = 0, e = SPRanges.size(); id != e; ++id) {
+    for (unsigned i = SPRanges[id].first, last = SPRanges[id].second; i != last; ++i) {
+      DISPCopy & SP = MySPs[i];
+      if (SP.lastline != 0)
+        continue;
+      if (i + 1 == last) {
+        SP.lastline = UINT_MAX;
+        continue;
+      }
+      DISPCopy & next = MySPs[i + 1];
+      if (SP.linenumber == next.linenumber) {
+        errs() << "Warning two functions overlap: ";
+        if (SP.function && next.function) {
+          errs() << SP.function->getName() << ", ";
+          errs() << next.function->getName();
+        }
+        errs() << "\n";
+        SP.lastline = next.linenumber;
+      }
+      else
+        SP.lastline = next.linenumber - 1;
+    }
+  }
+}
+
+/// SPs of the current target file. Without a target (self-testing),
+/// all of them.
+Matcher::sp_iterator Matcher::target_begin()
+{
+  if (targetid == NoPath)
+    return strlen(patchname) == 0 ? sp_begin() : sp_end();
+  return sp_begin() + SPRanges[targetid].first;
+}
+
+Matcher::sp_iterator Matcher::target_end()
+{
+  if (targetid == NoPath)
+    return sp_end();
+  return sp_begin() + SPRanges[targetid].second;
+}
+
+/// SPs to search for a scope starting from I: those of the current
+/// target file. When self-testing, MySPs is only sorted by line within
+/// each file, so the search stays in the file of I.
+Matcher::sp_range Matcher::searchRange(sp_iterator I)
+{
+  sp_iterator B = target_begin(), E = target_end();
+  if (targetid != NoPath || B == E)
+    return sp_range(B, E);
+  if (I < B)
+    I = B;
+  if (I >= E)
+    return sp_range(E, E);
+  unsigned id = I->pathid;
+  if (id != NoPath)
+    return sp_range(sp_begin() + SPRanges[id].first, sp_begin() + SPRanges[id].second);
+  // the SPs without a path are sorted last, by line
+  for (B = I; B != sp_begin() && (B - 1)->pathid == NoPath; --B);
+  return sp_range(B, E);
+}
+
+/// The first SP in [I, E) that ends after line, or is a one line
+/// function on line. [I, E) must be sorted by line.
+Matcher::sp_iterator Matcher::findSP(sp_iterator I, sp_iterator E, unsigned line)
+{
+  // start from the function that begins at or right before line
+  sp_iterator J = std::upper_bound(I, E, line, lineBeforeSP);
+  if (J != I) {
+    --J;
+    J = std::lower_bound(I, J, J->linenumber, spBeforeLine);
+  }
+  while (J != E && !(J->lastline > line || (J->lastline == line && J->lastline == J->linenumber)))
+    ++J;
+  return J;
+}
+
 void Matcher::processSubprograms(Module &M)
 {
   //////////////Off-the-shelf SP finder Begin//////////////////////
@@ -261,6 +428,7 @@ void Matcher::processSubprograms(Module &M)
 
   /** Sort based on file name, directory and line number **/
   std::sort(MySPs.begin(), MySPs.end(), cmpDISPCopy);
+  buildSPIndex();
   if (LOCAL_DEBUG)
     dumpSPs();
 }
@@ -298,24 +466,12 @@ Matcher::cu_iterator Matcher::matchCompileUnit(StringRef fullname)
 
   initialized = true;
 
-  /* TODO use binary search here */
-
-  cu_iterator I = cu_begin(), E = cu_end();
-
-  while(I != E) {
-    std::string debugname;
-    // Filename may already contains the path information
-    if (I->getFilename().size() > 0 && I->getFilename()[0] == '/')
-      debugname = I->getFilename();
-    else
-      debugname = I->getDirectory().str() + "/" + I->getFilename().str();
-    if (pathneq(debugname.c_str(), patchname, debugstrips))
-      break;
-    I++;
-  }
-  if (I == E)
+  StringMap<unsigned>::iterator I = CUIndex.find(patchname);
+  if (I == CUIndex.end()) {
     errs() << "Warning: no matching file(" << patchname << ") was found in the CUs\n";
-  return I;
+    return cu_end();
+  }
+  return cu_begin() + I->getValue();
 }
 
 bool Matcher::initName(StringRef fname)
@@ -343,6 +499,7 @@ Matcher::sp_iterator Matcher::resetTarget(StringRef target)
   if (target.empty()) {
     processSubprograms(module); 
     patchname="";
+    targetid = NoPath;
     initialized = true;
     return sp_begin();
   }
@@ -360,6 +517,7 @@ Matcher::sp_iterator Matcher::resetTarget(StringRef target)
     MySPs.clear();
     processSubprograms(*ci);
     std::sort(MySPs.begin(), MySPs.end(), cmpDISPCopy);
+    buildSPIndex();
     if (LOCAL_DEBUG) 
       dumpSPs();
   }
@@ -380,22 +538,14 @@ Matcher::sp_iterator Matcher::slideSPToTarget(StringRef fname)
     errs() << "Warning: Matcher hasn't processed module\n";
     return sp_end();
   }
-  sp_iterator I = sp_begin(), E = sp_end();
-
-  while(I != E) {
-    std::string debugname;
-    if (I->filename.size() > 0 && I->filename[0] == '/')
-      debugname = I->filename;
-    else
-      debugname = I->directory + "/" + I->filename;
-    if (pathneq(debugname.c_str(), patchname, debugstrips)) {
-      break;
-    }
-    I++;
-  }
-  if (I == E)
+  StringMap<unsigned>::iterator I = PathIds.find(patchname);
+  if (I == PathIds.end()) {
     errs() << "Warning: no matching file(" << patchname << ") was found in the CU\n";
-  return I;
+    targetid = NoPath;
+    return sp_end();
+  }
+  targetid = I->getValue();
+  return target_begin();
 }
 
 Instruction * Matcher::matchInstruction(inst_iterator &fi, Function * f, Scope & scope)
@@ -436,6 +586,45 @@ Instruction * Matcher::matchInstruction(inst_iterator &fi, Function * f, Scope &
   return inst;
 }
 
+static bool cmpLineInst(const Matcher::LineInst & L1, const Matcher::LineInst & L2)
+{
+  return L1.first < L2.first;
+}
+
+const Matcher::LineIndex & Matcher::getLineIndex(Function * f)
+{
+  std::map<const Function *, LineIndex>::iterator I = LineIndexes.find(f);
+  if (I != LineIndexes.end())
+    return I->second;
+  LineIndex & index = LineIndexes[f];
+  for (inst_iterator fi = inst_begin(f), fe = inst_end(f); fi != fe; ++fi) {
+    unsigned l = ScopeInfoFinder::getInstLine(&*fi);
+    if (l != 0)
+      index.push_back(LineInst(l, &*fi));
+  }
+  // stable: instructions of one line stay in program order
+  std::stable_sort(index.begin(), index.end(), cmpLineInst);
+  return index;
+}
+
+/**
+ * All instructions of f located within scope, including every one
+ * of those that share a line. The index of f is built on the first
+ * call for it.
+ *
+ */
+Matcher::inst_range Matcher::matchInstructions(Function * f, const Scope & scope)
+{
+  const LineIndex & index = getLineIndex(f);
+  if (scope.begin > scope.end)
+    return inst_range(index.end(), index.end());
+  line_iterator b = std::lower_bound(index.begin(), index.end(), 
+      LineInst(scope.begin, NULL), cmpLineInst);
+  line_iterator e = std::upper_bound(b, index.end(), 
+      LineInst(scope.end, NULL), cmpLineInst);
+  return inst_range(b, e);
+}
+
 Loop * Matcher::matchLoop(LoopInfo &li, const Scope & scope)
 {
   Scope ls;
@@ -492,46 +681,13 @@ Function * Matcher::matchFunction(sp_iterator & I, Scope &scope, bool & multiple
   if (scope.end < scope.begin) {
     return NULL;
   }
-  /** Off-the-shelf SP finder **/
-  sp_iterator E = sp_end();
-  while (I != E) {
-    if (strlen(patchname) != 0) {
-      std::string debugname = I->directory + "/" + I->filename;
-      if (I->filename.size() > 0 && I->filename[0] == '/')
-        debugname = I->filename;
-      else
-        debugname = I->directory + "/" + I->filename;
-      if (!pathneq(debugname.c_str(), patchname,  debugstrips)) {
-        errs() << "Warning: Reaching the end of " << patchname << " in current CU\n";
-        return NULL;
-      }
-    }
-    if (I->lastline == 0) {
-      if (I + 1 == E)
-        return I->function; // It's tricky to return I here. Maybe NULL is better
-      // Line number is guaranteed to be positive, no need to check overflow here.
-      if (I->linenumber == (I + 1)->linenumber) {
-        errs() << "Warning two functions overlap: ";
-        if (I->function && (I + 1)->function) {
-          errs() << I->function->getName() << ", ";
-          errs() << (I + 1)->function->getName();
-        }
-        errs() << "\n";
-        I->lastline = (I + 1)->linenumber;
-      }
-      else
-        I->lastline = (I + 1)->linenumber - 1;             
-      if (I->lastline < I->linenumber) {
-        errs() << "Bad things happened in " << patchname << ":" << scope << ", " <<
-           I->lastline << "," << I->linenumber << "\n";
-        assert(false); // Unless the two are modifying the same line.
-      }
-    }
-    // For boundary case, we only break if that function is one line function.
-    if (I->lastline > scope.begin || (I->lastline == scope.begin && I->lastline == I->linenumber))
-      break;
-    I++;
-  }
+  sp_range R = searchRange(I);
+  sp_iterator B = R.first, E = R.second;
+  if (I < B)
+    I = B;
+  if (I >= E)
+    return NULL;
+  I = findSP(I, E, scope.begin);
   if (I == E)
     return NULL;
 
@@ -556,10 +712,35 @@ Function * Matcher::matchFunction(sp_iterator & I, Scope &scope, bool & multiple
     scope.begin = I->lastline + 1;  // adjust beginning to next
     multiple = true;
   }
-  multiple = false;
+  else
+    multiple = false;
   return I->function; 
 }
 
+/**
+ * All functions of the current target that scope touches, in line
+ * order, by the same rules as matchFunction.
+ *
+ */
+Matcher::sp_range Matcher::matchFunctions(const Scope & scope)
+{
+  sp_range R = searchRange(target_begin());
+  sp_iterator E = R.second;
+  if (!initialized) {
+    errs() << "Matcher is not initialized\n";
+    return sp_range(E, E);
+  }
+  if (scope.end < scope.begin)
+    return sp_range(E, E);
+  sp_iterator lo = findSP(R.first, E, scope.begin);
+  sp_iterator hi = std::upper_bound(lo, E, scope.end, lineBeforeSP);
+  // Case (1): ending on the first line of a function doesn't touch it
+  while (hi != lo && (hi - 1)->linenumber == scope.end && 
+      (hi - 1)->lastline > (hi - 1)->linenumber)
+    --hi;
+  return sp_range(lo, hi);
+}
+
 /**
  * @Deprecated
  *
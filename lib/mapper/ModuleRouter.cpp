@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "commons/handy.h"
+#include "commons/LLVMHelper.h"
+#include "mapper/Matcher.h"
+#include "mapper/ModuleRouter.h"
+
+static bool LOCAL_DEBUG = false;
+
+static std::string sidecarName(const std::string & bcname)
+{
+  return bcname + CUINDEX_SUFFIX;
+}
+
+ModuleRouter::~ModuleRouter()
+{
+  for (std::vector<CallIndex *>::iterator I = module_calls.begin(), E = module_calls.end();
+      I != E; ++I)
+    delete *I;
+}
+
+void ModuleRouter::addPaths(unsigned id, const std::vector<std::string> & paths, int strips,
+    CallIndex * calls)
+{
+  if (module_strips.size() <= id) {
+    module_strips.resize(id + 1, -1);
+    module_calls.resize(id + 1, NULL);
+  }
+  module_strips[id] = strips;
+  delete module_calls[id];
+  module_calls[id] = calls;
+  for (std::vector<std::string>::const_iterator I = paths.begin(), E = paths.end();
+      I != E; ++I) {
+    char *canon = canonpath(I->c_str(), NULL);
+    if (canon == NULL)
+      continue;
+    ModuleList & owners = routes.GetOrCreateValue(stripname(canon, strips)).getValue();
+    if (owners.empty() || owners.back() != id)
+      owners.push_back(id);
+    free(canon);
+  }
+}
+
+/// Layout of a sidecar:
+///
+///   PSCUIDX version bitcode-size bitcode-mtime strips ncus
+///   ncus x CU path
+///   callee<TAB>caller, one line per call edge
+bool ModuleRouter::addSidecar(unsigned id, const std::string & bcname, int strips)
+{
+  struct stat st;
+  if (stat(bcname.c_str(), &st) != 0)
+    return false;
+  FILE *fp = fopen(sidecarName(bcname).c_str(), "r");
+  if (fp == NULL)
+    return false;
+  char magic[16];
+  unsigned version, ncus;
+  long long size, mtime;
+  int inferred;
+  if (fscanf(fp, "%15s %u %lld %lld %d %u\n", magic, &version, &size, &mtime, 
+        &inferred, &ncus) != 6 ||
+      strcmp(magic, CUINDEX_MAGIC) != 0 || version != CUINDEX_VERSION ||
+      size != (long long) st.st_size || mtime != (long long) st.st_mtime) {
+    if (LOCAL_DEBUG)
+      errs() << "Stale CU index for " << bcname << "\n";
+    fclose(fp);
+    return false;
+  }
+  std::vector<std::string> paths;
+  CallIndex * calls = new CallIndex();
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  while ((len = getline(&line, &cap, fp)) > 0) {
+    if (line[len - 1] == '\n')
+      line[--len] = '\0';
+    if (paths.size() < ncus) {
+      paths.push_back(line);
+      continue;
+    }
+    char *tab = strchr(line, '\t');
+    if (tab == NULL)
+      continue;
+    *tab = '\0';
+    calls->GetOrCreateValue(line).getValue().push_back(tab + 1);
+  }
+  free(line);
+  fclose(fp);
+  if (paths.size() < ncus) { // truncated
+    delete calls;
+    return false;
+  }
+  addPaths(id, paths, strips < 0 ? inferred : strips, calls);
+  return true;
+}
+
+void ModuleRouter::addModule(unsigned id, Module & M, const std::string & bcname, int strips)
+{
+  std::vector<std::string> paths;
+  Matcher::compileUnitPaths(M, paths);
+  CallIndex * calls = new CallIndex();
+  buildCallIndex(&M, *calls);
+  int inferred = count_strips(&M);
+  addPaths(id, paths, strips < 0 ? inferred : strips, calls);
+
+  struct stat st;
+  if (stat(bcname.c_str(), &st) != 0)
+    return;
+  // Write a temporary and rename it, so that concurrent runs never
+  // see a partial index. Failures only cost the next run a reload.
+  std::string sidecar = sidecarName(bcname);
+  std::string tmp = sidecar + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "w");
+  if (fp == NULL) {
+    if (LOCAL_DEBUG)
+      errs() << "Cannot write CU index " << sidecar << "\n";
+    return;
+  }
+  fprintf(fp, "%s %u %lld %lld %d %u\n", CUINDEX_MAGIC, CUINDEX_VERSION,
+      (long long) st.st_size, (long long) st.st_mtime, inferred, (unsigned) paths.size());
+  for (std::vector<std::string>::iterator I = paths.begin(), E = paths.end(); I != E; ++I)
+    fprintf(fp, "%s\n", I->c_str());
+  for (CallIndex::iterator I = calls->begin(), E = calls->end(); I != E; ++I) {
+    std::vector<std::string> & callers = I->getValue();
+    for (std::vector<std::string>::iterator CI = callers.begin(), CE = callers.end(); 
+        CI != CE; ++CI)
+      fprintf(fp, "%s\t%s\n", I->getKey().str().c_str(), CI->c_str());
+  }
+  if (fclose(fp) != 0 || rename(tmp.c_str(), sidecar.c_str()) != 0)
+    unlink(tmp.c_str());
+}
+
+const ModuleRouter::ModuleList * ModuleRouter::route(StringRef fullname) const
+{
+  char *canon = canonpath(fullname.str().c_str(), NULL);
+  if (canon == NULL)
+    return NULL;
+  StringMap<ModuleList>::const_iterator I = routes.find(stripname(canon, patchstrips));
+  free(canon);
+  if (I == routes.end())
+    return NULL;
+  return &I->getValue();
+}
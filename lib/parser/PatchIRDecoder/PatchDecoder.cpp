@@ -60,10 +60,12 @@ unsigned parseInt(const char **s, PatchDecoder *decoder)
         n = c - '0';
         if (n < 0 || n > 9) {
             decoder->syntaxError("Invalid hunk line number");
+            return 0;
         }
         lineno = no * 10 + n;
         if (lineno / 10 != no) {
             decoder->syntaxError("Hunk line number too big");
+            return 0;
         }
         no = lineno;
         ss++;
@@ -332,6 +334,7 @@ Hunk * Chapter::next_hunk()
 
     if (strncmp(line, HHEADER, PLEN) != 0) {
         decoder->syntaxError("Expecting hunk header");
+        return NULL;
     }
     unsigned lineno = 0;
     unsigned replineno = 0;
@@ -339,19 +342,23 @@ Hunk * Chapter::next_hunk()
     lineno = parseInt(&s, decoder);
     if (lineno <= 0) {
         decoder->syntaxError("Invalid hunk line number");
+        return NULL;
     }
     if (*s != ',') {
         decoder->syntaxError("Expecting replace hunk line number");
+        return NULL;
     }
     s++;
     replineno = parseInt(&s, decoder);
     if (replineno <= 0) {
         decoder->syntaxError("Invalid hunk line number");
+        return NULL;
     }
 
     line = decoder->next_line(chars_read);
     if (line == NULL) {
         decoder->syntaxError("Invalid hunk control sequence");
+        return NULL;
     }
     if (hunk != NULL) {
         delete hunk;
@@ -427,6 +434,7 @@ Chapter * Patch::next_chapter()
 
     if (strncmp(line, FHEADER, FLEN) != 0) {
         decoder->syntaxError("Expecting chapter header");
+        return NULL;
     }
     line = decoder->next_line(chars_read);
     if (line == NULL)
@@ -458,19 +466,26 @@ void PatchDecoder::init()
     rewind = false;
     file_offset = 0;
     readchars = 0;
+    fatal = true;
 }
 
 
 void PatchDecoder::syntaxError(const char *format, ...)
 {
-    fprintf(stderr, "Syntax error(\"");
+    char msg[256];
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vsnprintf(msg, sizeof(msg), format, args);
     va_end(args);
-    fprintf(stderr, "\") at line %d: %s\n", lineno, buf);
+    fprintf(stderr, "Syntax error(\"%s\") at line %d: %s\n", msg, lineno, buf);
     fflush(stderr);
-    exit(1);
+    if (fatal)
+        exit(1);
+    if (error.empty()) {
+        char where[32];
+        snprintf(where, sizeof(where), " at line %d", lineno);
+        error = std::string(msg) + where;
+    }
 }
 
 Patch * PatchDecoder::next_patch()
@@ -521,6 +536,10 @@ bool PatchDecoder::unget_line()
 
 const char * PatchDecoder::next_line(size_t & chars_read)
 {
+    if (failed()) { // the rest of the input can't be trusted
+        chars_read = 0;
+        return NULL;
+    }
     if (rewind) {
         rewind = false;
         chars_read = readchars;
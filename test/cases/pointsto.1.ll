@@ -0,0 +1,24 @@
+; Points-to sets of the Andersen solver, see test/driver/StaticSlicerDriver.
+; The store of null through %x goes to what %x points to, not to %x.
+
+@g = global i32 0
+@gp = global i32* @g
+
+define void @main() {
+entry:
+  %a = alloca i32
+  %b = alloca i32
+  %p = alloca i32*
+  %q = alloca i32*
+  %pp = alloca i32**
+  store i32* %a, i32** %p
+  store i32* %b, i32** %q
+  store i32** %p, i32*** %pp
+  %x = load i32*** %pp
+  %y = load i32** %q
+  store i32* %y, i32** %x
+  %z = load i32** %p
+  %gv = load i32** @gp
+  store i32* null, i32** %x
+  ret void
+}
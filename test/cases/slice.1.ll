@@ -0,0 +1,24 @@
+; Slice from the stores to %product, see test/driver/StaticSlicerDriver.
+; The store in %then is control dependent on the branch of %entry, which
+; brings %cmp into the slice on the second round of RC, SC and BC.
+
+define void @f(i32 %n) {
+entry:
+  %product = alloca i32
+  %sum = alloca i32
+  %s = add i32 %n, 3
+  store i32 %s, i32* %sum
+  %cmp = icmp sgt i32 %n, 0
+  br i1 %cmp, label %then, label %join
+
+then:
+  %t = mul i32 %n, 2
+  store i32 %t, i32* %product
+  br label %join
+
+join:
+  %v = load i32* %product
+  %w = add i32 %v, 1
+  store i32 %w, i32* %product
+  ret void
+}
@@ -0,0 +1,167 @@
+/**
+ *  @file          test/driver/StaticSlicerDriver/TestStaticSlicer.cpp
+ *
+ *  @version       1.0
+ *  @created       06/11/2013 04:27:53 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *
+ *  Test driver for the points-to sets and the slices of LLVMSlicer. Both
+ *  passes print to stdout in an order that doesn't depend on addresses,
+ *  so that the output can be compared with the .expected files of
+ *  test/cases:
+ *
+ *    -tpointsto: "p -> l1 l2 ..." for every pointer with a points-to set
+ *    -tslice:    per instruction, '+' if it's in the slice (SC, BC) or
+ *                '-' if not, then its RC, slicing from the stores to the
+ *                variables named product*
+ *
+ */
+
+#include <set>
+#include <string>
+
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/Instruction.h"
+#include "llvm/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "llvmslicer/Callgraph.h"
+#include "llvmslicer/FunctionStaticSlicer.h"
+#include "llvmslicer/Modifies.h"
+#include "llvmslicer/PointsTo.h"
+#include "llvmslicer/PostDominanceFrontier.h"
+
+using namespace llvm;
+using namespace llvm::slicing;
+
+static std::string valueName(const Value * V)
+{
+  if (isa<ConstantPointerNull>(V))
+    return "null";
+  if (!V->hasName()) {
+    if (const Instruction * I = dyn_cast<Instruction>(V))
+      return I->getOpcodeName();
+    return "<unnamed>";
+  }
+  return (isa<GlobalValue>(V) ? "@" : "%") + V->getName().str();
+}
+
+static void computePointsTo(Module & M, ptr::PointsToSets & PS)
+{
+  ptr::ProgramStructure P(M);
+  computePointsToSets(P, PS);
+}
+
+static void computeModSets(Module & M, const ptr::PointsToSets & PS,
+    mods::Modifies & MOD)
+{
+  callgraph::Callgraph CG(M, PS);
+  mods::ProgramStructure P1(M);
+  computeModifies(P1, CG, PS, MOD);
+}
+
+namespace {
+
+  class PointsToTest: public ModulePass {
+    public:
+      static char ID; // Pass identification, replacement for typeid
+      PointsToTest() : ModulePass(ID) {}
+
+      virtual bool runOnModule(Module &M)
+      {
+        ptr::PointsToSets PS;
+        computePointsTo(M, PS);
+        std::set<std::string> lines;
+        for (ptr::PointsToSets::const_iterator I = PS.begin(), E = PS.end();
+            I != E; ++I) {
+          std::set<std::string> locs;
+          for (ptr::PointsToSets::PointsToSet::const_iterator LI = I->second.begin(),
+              LE = I->second.end(); LI != LE; ++LI)
+            locs.insert(valueName(*LI));
+          std::string line = valueName(I->first) + " ->";
+          for (std::set<std::string>::iterator LI = locs.begin(), LE = locs.end();
+              LI != LE; ++LI)
+            line += " " + *LI;
+          lines.insert(line);
+        }
+        for (std::set<std::string>::iterator I = lines.begin(), E = lines.end();
+            I != E; ++I)
+          outs() << *I << "\n";
+        return false;
+      }
+
+      virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+        AU.setPreservesAll();
+      }
+  };
+
+  class SliceTest: public ModulePass {
+    public:
+      static char ID; // Pass identification, replacement for typeid
+      SliceTest() : ModulePass(ID) {}
+
+      virtual bool runOnModule(Module &M)
+      {
+        ptr::PointsToSets PS;
+        mods::Modifies MOD;
+        computePointsTo(M, PS);
+        computeModSets(M, PS, MOD);
+        for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
+          if (F->isDeclaration())
+            continue;
+          FunctionStaticSlicer ss(*F, this, PS, MOD);
+          findInitialCriterion(*F, ss);
+          ss.calculateStaticSlice();
+          outs() << F->getName() << "\n";
+          for (inst_iterator I = inst_begin(*F), E = inst_end(*F); I != E; ++I) {
+            const Instruction * inst = &*I;
+            std::set<std::string> rc;
+            for (ValSet::const_iterator VI = ss.relevant_begin(inst),
+                VE = ss.relevant_end(inst); VI != VE; ++VI)
+              rc.insert(valueName(*VI));
+            outs() << (ss.isSliced(inst) ? "- " : "+ ") << valueName(inst) << " {";
+            for (std::set<std::string>::iterator RI = rc.begin(), RE = rc.end();
+                RI != RE; ++RI)
+              outs() << " " << *RI;
+            outs() << " }\n";
+          }
+        }
+        return false;
+      }
+
+      virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+        AU.addRequired<PostDominatorTree>();
+        AU.addRequired<PostDominanceFrontier>();
+        AU.setPreservesAll();
+      }
+  };
+
+}
+
+char PointsToTest::ID = 0;
+static RegisterPass<PointsToTest> X("tpointsto", "Points-to Sets Test Pass");
+
+char SliceTest::ID = 0;
+static RegisterPass<SliceTest> Y("tslice", "Static Slicer Test Pass");
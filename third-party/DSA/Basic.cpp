@@ -39,8 +39,8 @@ bool BasicDataStructures::runOnModule(Module &M) {
   // Create a void pointer type.  This is simply a pointer to an 8 bit value.
   //
 
-  DSNode * GVNodeInternal = new DSNode(GlobalsGraph);
-  DSNode * GVNodeExternal = new DSNode(GlobalsGraph);
+  DSNode * GVNodeInternal = new (GlobalsGraph) DSNode(GlobalsGraph);
+  DSNode * GVNodeExternal = new (GlobalsGraph) DSNode(GlobalsGraph);
   for (Module::global_iterator I = M.global_begin(), E = M.global_end();
        I != E; ++I) {
     if (I->isDeclaration() || (!(I->hasInternalLinkage()))) {
@@ -63,7 +63,7 @@ bool BasicDataStructures::runOnModule(Module &M) {
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
     if (!F->isDeclaration()) {
       DSGraph* G = new DSGraph(GlobalECs, getTargetData(), *TypeSS, GlobalsGraph);
-      DSNode * Node = new DSNode(G);
+      DSNode * Node = new (G) DSNode(G);
           
       if (!F->hasInternalLinkage())
         Node->setExternalMarker();
@@ -24,6 +24,8 @@
 #include "dsa/DataStructure.h"
 #include "dsa/DSGraph.h"
 
+#include "commons/Parallel.h"
+
 using namespace llvm;
 
 namespace {
@@ -43,6 +45,38 @@ namespace {
 
 char BUDataStructures::ID;
 
+// SCCTask - An SCC of the call graph that parallelInline inlines as one task.
+struct BUDataStructures::SCCTask {
+  std::vector<const Function*> Members;
+  DSGraph *G;                     // The graph of all the members
+  FuncSet Callees;                // Members and their callees before inlining
+  std::vector<unsigned> CalleeSCCs;
+  unsigned Level;                 // 1 + the highest level of the callee SCCs
+  bool Dirty;                     // Left for calculateGraphs
+
+  SCCTask() : G(0), Level(0), Dirty(false) {}
+};
+
+// SCCWave - The SCCs of one level, inlined on several threads.  Each task
+// only writes the graph of its SCC.
+class BUDataStructures::SCCWave : public ParallelTask {
+public:
+  std::vector<unsigned> Tasks;
+
+  SCCWave(BUDataStructures &bu, std::vector<SCCTask> &sccs,
+          const GraphSet &ready)
+    : BU(bu), SCCs(sccs), Ready(ready) {}
+
+  virtual void run(unsigned index, unsigned worker) {
+    BU.inlineCallees(SCCs[Tasks[index]].G, &Ready);
+  }
+
+private:
+  BUDataStructures &BU;
+  std::vector<SCCTask> &SCCs;
+  const GraphSet &Ready;
+};
+
 // run - Calculate the bottom up data structure graphs for each function in the
 // program.
 //
@@ -293,13 +327,21 @@ BUDataStructures::postOrderInline (Module & M) {
     }
   }
  
+  //
+  // Inline the SCCs that don't depend on each other at the same time if we
+  // may use several threads.  What is left is done by the traversal below.
+  //
+  unsigned Threads = closureThreads(M);
+  if (Threads > 1)
+    parallelInline(M, ValMap, Threads);
+
   //
   // Start the post order traversal with the main() function.  If there is no
   // main() function, don't worry; we'll have a separate traversal for inlining
   // graphs for functions not reachable from main().
   //
   Function *MainFunc = M.getFunction ("main");
-  if (MainFunc && !MainFunc->isDeclaration()) {
+  if (MainFunc && !MainFunc->isDeclaration() && !ValMap.count(MainFunc)) {
     calculateGraphs(MainFunc, Stack, NextID, ValMap);
     CloneAuxIntoGlobal(getDSGraph(*MainFunc));
   }
@@ -527,6 +569,235 @@ BUDataStructures::calculateGraphs (const Function *F,
   }
 }
 
+//
+// Method: findSCCs()
+//
+// Description:
+//  Find the SCCs reachable from F with Tarjan's algorithm, over the callees
+//  of the graphs before any inlining, and splice the graphs of each SCC into
+//  one as calculateGraphs does.  SCCs are added to the list callees first.
+//
+// Inputs:
+//  Index - The Tarjan numbers; functions that are already processed are
+//          in it with ~0U.
+//
+// Outputs:
+//  Callees - The resolvable callees of each function visited.
+//  SCCs - The SCCs found.
+//
+unsigned
+BUDataStructures::findSCCs(const Function *F, TarjanStack &Stack,
+                           unsigned &NextID, TarjanMap &Index,
+                           CalleeMap &Callees, std::vector<SCCTask> &SCCs) {
+  unsigned Min = NextID++, MyID = Min;
+  Index[F] = Min;
+  Stack.push_back(F);
+
+  FuncSet &FCallees = Callees[F];
+  getAllAuxCallees(getOrCreateGraph(F), FCallees);
+  for (FuncSet::iterator I = FCallees.begin(), E = FCallees.end();
+       I != E; ++I) {
+    if ((*I)->isDeclaration())
+      continue;
+    unsigned M;
+    TarjanMap::iterator It = Index.find(*I);
+    if (It == Index.end())
+      M = findSCCs(*I, Stack, NextID, Index, Callees, SCCs);
+    else
+      M = It->second;
+    if (M < Min) Min = M;
+  }
+
+  if (Min != MyID)
+    return Min;
+
+  SCCs.push_back(SCCTask());
+  SCCTask &SCC = SCCs.back();
+  const Function *NF;
+  do {
+    NF = Stack.back();
+    Stack.pop_back();
+    Index[NF] = ~0U;
+    SCC.Members.push_back(NF);
+  } while (NF != F);
+
+  unsigned SCCSize = 1;
+  SCC.G = getDSGraph(*F);
+  for (unsigned i = 0, e = SCC.Members.size(); i != e; ++i) {
+    DSGraph *NFG = getDSGraph(*SCC.Members[i]);
+    if (NFG == SCC.G)
+      continue;
+    for (DSGraph::retnodes_iterator I = NFG->retnodes_begin(),
+           E = NFG->retnodes_end(); I != E; ++I)
+      setDSGraph(*I->first, SCC.G);
+    SCC.G->spliceFrom(NFG);
+    delete NFG;
+    ++SCCSize;
+  }
+  if (MaxSCC < SCCSize)
+    MaxSCC = SCCSize;
+  if (SCC.Members.size() > 1)
+    SCC.G->removeDeadNodes(DSGraph::KeepUnreachableGlobals);
+
+  // A graph that also holds functions of other SCCs (EQBU merges them) may
+  // only be inlined by one of them at a time.
+  if (SCC.G->getReturnNodes().size() != SCC.Members.size())
+    SCC.Dirty = true;
+  return MyID;
+}
+
+//
+// Method: parallelInline()
+//
+// Description:
+//  Inline the graphs of the functions that are not processed yet in waves of
+//  SCCs.  An SCC only calls SCCs of earlier waves, so the SCCs of a wave are
+//  inlined on several threads, each writing the graph of its own SCC and
+//  reading those of its callees.  The call graph and the globals graph are
+//  shared by all the graphs, so they are updated between the parallel steps,
+//  one SCC at a time in the order of the SCCs.
+//
+//  An SCC that has new callees once it is inlined is recalculated by
+//  calculateGraphs, with callees that may not be processed yet.  It is left
+//  to the serial traversal, along with all the SCCs that call it, and so is
+//  an SCC that shares its graph with another one.
+//
+// Inputs:
+//  ValMap - The functions already processed, with ~0U.
+//  Threads - The number of threads to inline on.
+//
+// Outputs:
+//  ValMap - The functions processed here are added to it with ~0U.
+//
+void BUDataStructures::parallelInline(Module &M, TarjanMap &ValMap,
+                                      unsigned Threads) {
+  std::vector<SCCTask> SCCs;
+  CalleeMap Callees;
+  TarjanMap Index(ValMap);
+  TarjanStack Stack;
+  unsigned NextID = 1;
+
+  // The serial traversal starts from main() too
+  std::vector<const Function*> Roots;
+  Function *MainFunc = M.getFunction ("main");
+  if (MainFunc && !MainFunc->isDeclaration())
+    Roots.push_back(MainFunc);
+  for (Module::iterator I = M.begin(), E = M.end(); I != E; ++I)
+    if (!I->isDeclaration())
+      Roots.push_back(I);
+  for (unsigned i = 0, e = Roots.size(); i != e; ++i)
+    if (!Index.count(Roots[i]))
+      findSCCs(Roots[i], Stack, NextID, Index, Callees, SCCs);
+
+  // SCCs come callees first, so the level of the callees of an SCC is known
+  // when it is reached.
+  TarjanMap SCCOf;
+  for (unsigned i = 0, e = SCCs.size(); i != e; ++i)
+    for (unsigned j = 0, je = SCCs[i].Members.size(); j != je; ++j)
+      SCCOf[SCCs[i].Members[j]] = i;
+  unsigned MaxLevel = 0;
+  for (unsigned i = 0, e = SCCs.size(); i != e; ++i) {
+    SCCTask &SCC = SCCs[i];
+    for (unsigned j = 0, je = SCC.Members.size(); j != je; ++j) {
+      const FuncSet &FCallees = Callees[SCC.Members[j]];
+      SCC.Callees.insert(SCC.Members[j]);
+      SCC.Callees.insert(FCallees.begin(), FCallees.end());
+      for (FuncSet::const_iterator I = FCallees.begin(), E = FCallees.end();
+           I != E; ++I) {
+        TarjanMap::iterator It = SCCOf.find(*I);
+        if (It == SCCOf.end() || It->second == i)
+          continue;
+        SCC.CalleeSCCs.push_back(It->second);
+        if (SCC.Level <= SCCs[It->second].Level)
+          SCC.Level = SCCs[It->second].Level + 1;
+      }
+    }
+    if (MaxLevel < SCC.Level)
+      MaxLevel = SCC.Level;
+  }
+
+  // The graphs that can be inlined from, which must not change while a wave
+  // reads them.
+  GraphSet Ready;
+  for (TarjanMap::iterator I = ValMap.begin(), E = ValMap.end(); I != E; ++I)
+    if (!I->first->isDeclaration() && hasDSGraph(*I->first)) {
+      DSGraph *G = getDSGraph(*I->first);
+      if (Ready.insert(G).second)
+        G->resolveForwarding();
+    }
+
+  SCCWave Wave(*this, SCCs, Ready);
+  for (unsigned Level = 0; Level <= MaxLevel; ++Level) {
+    Wave.Tasks.clear();
+    for (unsigned i = 0, e = SCCs.size(); i != e; ++i) {
+      SCCTask &SCC = SCCs[i];
+      if (SCC.Level != Level)
+        continue;
+      for (unsigned j = 0, je = SCC.CalleeSCCs.size(); j != je; ++j)
+        if (SCCs[SCC.CalleeSCCs[j]].Dirty)
+          SCC.Dirty = true;
+      if (!SCC.Dirty)
+        Wave.Tasks.push_back(i);
+    }
+    DEBUG(errs() << "[BU] Inlining " << Wave.Tasks.size()
+          << " SCCs of level " << Level << "\n");
+
+    // The steps of calculateGraph that update the shared graphs are done
+    // around the parallel step.
+    for (unsigned i = 0, e = Wave.Tasks.size(); i != e; ++i)
+      SCCs[Wave.Tasks[i]].G->buildCallGraph(callgraph, GlobalFunctionList,
+                                            filterCallees);
+    sys::AtomicIncrement(&DSNode::SharedGraphs);
+    parallel_for(Wave, Wave.Tasks.size(), Threads);
+    sys::AtomicDecrement(&DSNode::SharedGraphs);
+
+    for (unsigned i = 0, e = Wave.Tasks.size(); i != e; ++i) {
+      SCCTask &SCC = SCCs[Wave.Tasks[i]];
+      finishGraph(SCC.G);
+
+      FuncSet NewCallees;
+      getAllAuxCallees(SCC.G, NewCallees);
+      if (!NewCallees.empty()) {
+        if (hasNewCallees(NewCallees, SCC.Callees)) {
+          DEBUG(errs() << "Recalculating " << SCC.G->getFunctionNames()
+                << " serially due to new knowledge\n");
+          SCC.Dirty = true;
+          ++NumRecalculations;
+          continue;
+        }
+        ++NumRecalculationsSkipped;
+      }
+      SCC.G->resolveForwarding();
+      Ready.insert(SCC.G);
+      for (unsigned j = 0, je = SCC.Members.size(); j != je; ++j)
+        ValMap[SCC.Members[j]] = ~0U;
+    }
+  }
+
+  // The serial traversal clones the unresolved call sites of the functions
+  // it starts from into the globals graph: main(), then each function not
+  // reached from the ones before.  Do it for those that are done here.
+  DenseSet<const Function*> Reached;
+  std::vector<const Function*> Worklist;
+  for (unsigned i = 0, e = Roots.size(); i != e; ++i) {
+    const Function *F = Roots[i];
+    if (!Callees.count(F) || Reached.count(F))
+      continue;
+    Worklist.push_back(F);
+    Reached.insert(F);
+    while (!Worklist.empty()) {
+      const FuncSet &FCallees = Callees[Worklist.back()];
+      Worklist.pop_back();
+      for (FuncSet::const_iterator I = FCallees.begin(), E = FCallees.end();
+           I != E; ++I)
+        if (Callees.count(*I) && Reached.insert(*I).second)
+          Worklist.push_back(*I);
+    }
+    if (ValMap.count(F))
+      CloneAuxIntoGlobal(getDSGraph(*F));
+  }
+}
+
 //
 // Method: CloneAuxIntoGlobal()
 //
@@ -626,7 +897,23 @@ void BUDataStructures::CloneAuxIntoGlobal(DSGraph* G) {
 void BUDataStructures::calculateGraph(DSGraph* Graph) {
   DEBUG(Graph->AssertGraphOK(); Graph->getGlobalsGraph()->AssertGraphOK());
   Graph->buildCallGraph(callgraph, GlobalFunctionList, filterCallees);
+  inlineCallees(Graph);
+  finishGraph(Graph);
+}
 
+//
+// Method: inlineCallees()
+//
+// Description:
+//  Inline the graphs of the callees of the resolvable call sites of Graph and
+//  recompute its flags.  Only Graph is written; the graphs of the callees and
+//  the globals graph are only read.
+//
+// Inputs:
+//  Ready - If not null, the graphs that may be inlined besides Graph itself.
+//          A call site that may call another graph stays unresolved.
+//
+void BUDataStructures::inlineCallees(DSGraph* Graph, const GraphSet *Ready) {
   // Move our call site list into TempFCs so that inline call sites go into the
   // new call site list and doesn't invalidate our iterators!
   DSGraph::FunctionListTy TempFCs;
@@ -672,6 +959,21 @@ void BUDataStructures::calculateGraph(DSGraph* Graph) {
     assert((CS.isDirectCall() || CS.getCalleeNode()->isCompleteNode())
        && "Resolving an indirect incomplete call site");
 
+    if (Ready) {
+      FuncSet::iterator FI = CalledFuncs.begin(), FE = CalledFuncs.end();
+      for (; FI != FE; ++FI) {
+        DSGraph *G = getDSGraph(**FI);
+        if (G != Graph && !Ready->count(G))
+          break;
+      }
+      if (FI != FE) {
+        // Another thread may be inlining the callee.  Copy the call site, as
+        // splicing it out of TempFCs would skip the next one.
+        AuxCallsList.push_back(CS);
+        continue;
+      }
+    }
+
     if (CS.isIndirectCall()) {
         ++NumIndResolved;
     }
@@ -713,7 +1015,16 @@ void BUDataStructures::calculateGraph(DSGraph* Graph) {
   Graph->markIncompleteNodes(DSGraph::MarkFormalArgs);
   Graph->computeExternalFlags(DSGraph::DontMarkFormalsExternal);
   Graph->computeIntPtrFlags();
+}
 
+//
+// Method: finishGraph()
+//
+// Description:
+//  Once the callees are inlined, update the call graph, remove the dead nodes
+//  and clone what is left about the globals into the globals graph.
+//
+void BUDataStructures::finishGraph(DSGraph* Graph) {
   //
   // Update the callgraph with the new information that we have gleaned.
   // NOTE : This must be called before removeDeadNodes, so that no 
@@ -107,10 +107,17 @@ std::string DSGraph::getFunctionNames() const {
   }
 }
 
+DSGraph::DSGraph(EquivalenceClasses<const GlobalValue*> &ECs,
+                 const TargetData &td, SuperSet<Type*>& tss, DSGraph *GG)
+  : GlobalsGraph(GG), UseAuxCalls(false), Pool(new DSNodePool()),
+    ScalarMap(ECs, Pool), TD(td), TypeSS(tss) {
+}
+
 DSGraph::DSGraph(DSGraph* G, EquivalenceClasses<const GlobalValue*> &ECs,
                  SuperSet<Type*>& tss, NodeMapTy &NodeMap,
                  unsigned CloneFlags)
-  : GlobalsGraph(0), ScalarMap(ECs), TD(G->TD), TypeSS(tss) {
+  : GlobalsGraph(0), Pool(new DSNodePool()), ScalarMap(ECs, Pool), TD(G->TD),
+    TypeSS(tss) {
   UseAuxCalls = false;
   cloneInto(G, NodeMap, CloneFlags);
 }
@@ -118,7 +125,8 @@ DSGraph::DSGraph(DSGraph* G, EquivalenceClasses<const GlobalValue*> &ECs,
 DSGraph::DSGraph(DSGraph* G, EquivalenceClasses<const GlobalValue*> &ECs,
                  SuperSet<Type*>& tss,
                  unsigned CloneFlags)
-  : GlobalsGraph(0), ScalarMap(ECs), TD(G->TD), TypeSS(tss) {
+  : GlobalsGraph(0), Pool(new DSNodePool()), ScalarMap(ECs, Pool), TD(G->TD),
+    TypeSS(tss) {
   UseAuxCalls = false;
   cloneInto(G, CloneFlags);
 }
@@ -130,12 +138,11 @@ DSGraph::~DSGraph() {
   ReturnNodes.clear();
   VANodes.clear();
 
-  // Drop all intra-node references, so that assertions don't fail...
-  for (node_iterator NI = node_begin(), E = node_end(); NI != E; ++NI)
-    NI->dropAllReferences();
-
-  // Free all of the nodes.
-  Nodes.clear();
+  // Nothing outside the graph points to its nodes any more, and everything
+  // the nodes own (links, types, globals, forwarding nodes) is in the pool,
+  // so the nodes are not destroyed one by one: the pool goes in one piece.
+  Nodes.clearAndLeakNodesUnsafely();
+  delete Pool;
 }
 
 // dump - Allow inspection of graph in a debugger.
@@ -169,7 +176,7 @@ void DSGraph::removeFunctionCalls(Function& F) {
 /// and does not point to any other objects in the graph.
 DSNode *DSGraph::addObjectToGraph(Value *Ptr, bool UseDeclaredType) {
   assert(isa<PointerType>(Ptr->getType()) && "Ptr is not a pointer!");
-  DSNode *N = new DSNode(this);
+  DSNode *N = new (this) DSNode(this);
   assert(ScalarMap[Ptr].isNull() && "Object already in this graph!");
   ScalarMap[Ptr] = N;
 
@@ -206,7 +213,7 @@ void DSGraph::cloneInto( DSGraph* G, NodeMapTy &OldNodeMap, unsigned CloneFlags)
   for (node_const_iterator I = G->node_begin(), E = G->node_end(); I != E; ++I) {
     assert(!I->isForwarding() &&
            "Forward nodes shouldn't be in node list!");
-    DSNode *New = new DSNode(*I, this);
+    DSNode *New = new (this) DSNode(*I, this);
     New->maskNodeTypes(~BitsToClear);
     OldNodeMap[I] = New;
   }
@@ -284,8 +291,10 @@ void DSGraph::spliceFrom(DSGraph* RHS) {
   for (NodeListTy::iterator I = RHS->Nodes.begin(), E = RHS->Nodes.end();
        I != E; ++I)
     I->setParentGraph(this);
-  // Take all of the nodes.
+  // Take all of the nodes, and the memory they live in.
   splice(Nodes, RHS->Nodes);
+  Pool->adopt(RHS->Pool);
+  RHS->Pool = new DSNodePool();
 
   // Take all of the calls.
   splice(FunctionCalls, RHS->FunctionCalls);
@@ -997,6 +1006,39 @@ void DSGraph::removeTriviallyDeadNodes() {
   removeIdenticalCalls(AuxFunctionCalls);
 }
 
+static void resolveCallForwarding(const DSCallSite &CS) {
+  CS.getRetVal().getNode();
+  CS.getVAVal().getNode();
+  if (CS.isIndirectCall())
+    CS.getCalleeNode();
+  for (unsigned i = 0, e = CS.getNumPtrArgs(); i != e; ++i)
+    CS.getPtrArg(i).getNode();
+}
+
+// resolveForwarding - Unlike removeTriviallyDeadNodes, this also goes through
+// the return, var-arg and call site handles, and removes nothing.
+//
+void DSGraph::resolveForwarding() {
+  for (node_iterator NI = node_begin(), E = node_end(); NI != E; ++NI)
+    for (DSNode::edge_iterator ii = NI->edge_begin(), ee = NI->edge_end();
+         ii != ee; ++ii)
+      ii->second.getNode();
+
+  for (DSScalarMap::iterator I = ScalarMap.begin(), E = ScalarMap.end();
+       I != E; ++I)
+    I->second.getNode();
+  for (ReturnNodesTy::iterator I = ReturnNodes.begin(), E = ReturnNodes.end();
+       I != E; ++I)
+    I->second.getNode();
+  for (VANodesTy::iterator I = VANodes.begin(), E = VANodes.end(); I != E; ++I)
+    I->second.getNode();
+
+  for (fc_iterator I = fc_begin(), E = fc_end(); I != E; ++I)
+    resolveCallForwarding(*I);
+  for (afc_iterator I = afc_begin(), E = afc_end(); I != E; ++I)
+    resolveCallForwarding(*I);
+}
+
 // CanReachAliveNodes - Simple graph walker that recursively traverses the graph
 // looking for a node that is marked alive.  If an alive node is found, return
 // true, otherwise return false.  If an alive node is reachable, this node is
@@ -1202,7 +1244,7 @@ void DSGraph::removeDeadNodes(unsigned Flags) {
 
   // Delete all dead nodes now since their referrer counts are zero.
   for (unsigned i = 0, e = DeadNodes.size(); i != e; ++i)
-    delete DeadNodes[i];
+    getNodePool().destroy(DeadNodes[i]);
 
   DEBUG(AssertGraphOK(); GlobalsGraph->AssertGraphOK());
 }
@@ -19,6 +19,7 @@
 #include "llvm/GlobalVariable.h"
 #include "llvm/Instructions.h"
 #include "llvm/DerivedTypes.h"
+#include "llvm/TypeFinder.h"
 #include "llvm/Target/TargetData.h"
 #include "llvm/Assembly/Writer.h"
 #include "llvm/Support/CommandLine.h"
@@ -27,6 +28,7 @@
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/SCCIterator.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -44,6 +46,12 @@ namespace {
   STATISTIC (NumNodeAllocated  , "Number of nodes allocated");
 }
 
+cl::opt<unsigned> DSAThreads("dsa-threads",
+                             cl::desc("Threads for the bottom-up and top-down closures"),
+                             cl::init(1));
+
+volatile sys::cas_flag DSNode::SharedGraphs = 0;
+
 /// isForwarding - Return true if this NodeHandle is forwarding to another
 /// one.
 bool DSNodeHandle::isForwarding() const {
@@ -67,13 +75,13 @@ DSNode *DSNodeHandle::HandleForwarding() const {
   DSNode *Next = N->ForwardNH.getNode();  // Cause recursive shrinkage
   Offset += N->ForwardNH.getOffset();
 
-  if (--N->NumReferrers == 0) {
+  if (N->dropReferrer() == 0) {
     // Removing the last referrer to the node, sever the forwarding link
     N->stopForwarding();
   }
 
   N = Next;
-  N->NumReferrers++;
+  N->addReferrer();
 
   if (N->getSize() <= Offset) {
     assert(N->getSize() <= 1 && "Forwarded to shrunk but not collapsed node?");
@@ -131,16 +139,26 @@ void DSScalarMap::spliceFrom(DSScalarMap &RHS) {
 //===----------------------------------------------------------------------===//
 
 DSNode::DSNode(DSGraph *G)
-  : NumReferrers(0), Size(0), ParentGraph(G), NodeType(0) {
+  : NumReferrers(0), Size(0), ParentGraph(G),
+  TyMap(TyMapTy::key_compare(), G ? &G->getNodePool() : 0),
+  Links(LinkMapTy::key_compare(), G ? &G->getNodePool() : 0),
+  Globals(GlobalSetTy::allocator_type(G ? &G->getNodePool() : 0)),
+  NodeType(0) {
     // Add the type entry if it is specified...
     if (G) G->addNode(this);
     ++NumNodeAllocated;
   }
 
-// DSNode copy constructor... do not copy over the referrers list!
+// DSNode copy constructor... do not copy over the referrers list!  The
+// containers are copied by assignment, which keeps the allocator of G.
 DSNode::DSNode(const DSNode &N, DSGraph *G, bool NullLinks)
-  : NumReferrers(0), Size(N.Size), ParentGraph(G), TyMap(N.TyMap),
-  Globals(N.Globals), NodeType(N.NodeType) {
+  : NumReferrers(0), Size(N.Size), ParentGraph(G),
+  TyMap(TyMapTy::key_compare(), &G->getNodePool()),
+  Links(LinkMapTy::key_compare(), &G->getNodePool()),
+  Globals(GlobalSetTy::allocator_type(&G->getNodePool())),
+  NodeType(N.NodeType) {
+    TyMap = N.TyMap;
+    Globals = N.Globals;
     if (!NullLinks) Links = N.Links;
     G->addNode(this);
     ++NumNodeAllocated;
@@ -151,17 +169,58 @@ DSNode::~DSNode() {
   assert(hasNoReferrers() && "Referrers to dead node exist!");
 }
 
+void *DSNode::operator new(size_t Size, DSGraph *G) {
+  assert(G && Size == sizeof(DSNode) && "Nodes are allocated by their graph!");
+  return G->getNodePool().allocate(Size);
+}
+
+/// operator delete - Only called if the constructor throws.
+void DSNode::operator delete(void *P, DSGraph *G) {
+  G->getNodePool().deallocate(P, sizeof(DSNode));
+}
+
+void DSNode::stopForwarding() {
+  assert(isForwarding() &&
+         "Node isn't forwarding, cannot stopForwarding()!");
+  ForwardNH.setTo(0, 0);
+  assert(getParentGraph() == 0 &&
+         "Forwarding nodes must have been removed from graph!");
+  ParentGraph.get<DSNodePool*>()->destroy(this);
+}
+
+//===----------------------------------------------------------------------===//
+// DSNodePool Implementation
+//===----------------------------------------------------------------------===//
+
+DSNodePool::~DSNodePool() {
+  for (std::vector<DSNodePool*>::iterator I = Adopted.begin(),
+       E = Adopted.end(); I != E; ++I)
+    delete *I;
+}
+
+DSNode *ilist_traits<DSNode>::createSentinel() {
+  return ::new DSNode();
+}
+
+void ilist_traits<DSNode>::destroySentinel(DSNode *N) {
+  ::delete N;
+}
+
+void ilist_traits<DSNode>::deleteNode(DSNode *N) {
+  N->getParentGraph()->getNodePool().destroy(N);
+}
+
 void DSNode::assertOK() const {
   //  assert(((Ty && Ty->getTypeID() != Type::VoidTyID) ||
   //         ((!Ty || Ty->getTypeID() == Type::VoidTyID) && (Size == 0 ||
   //         (NodeType & DSNode::ArrayNode)))) &&
   //         "Node not OK!");
 
-  assert(ParentGraph && "Node has no parent?");
+  assert(getParentGraph() && "Node has no parent?");
   for (globals_iterator ii = globals_begin(), ee = globals_end();
        ii != ee; ++ii) {
-    assert(ParentGraph->getScalarMap().global_count(*ii));
-    assert(ParentGraph->getScalarMap().find(*ii)->second.getNode() == this);
+    assert(getParentGraph()->getScalarMap().global_count(*ii));
+    assert(getParentGraph()->getScalarMap().find(*ii)->second.getNode() == this);
   }
 }
 
@@ -199,8 +258,10 @@ void DSNode::forwardNode(DSNode *To, unsigned Offset) {
   Links.clear();
 
   // Remove this node from the parent graph's Nodes list.
-  ParentGraph->unlinkNode(this);
-  ParentGraph = 0;
+  // From now on, ParentGraph is the pool the node goes back to.
+  DSGraph *G = getParentGraph();
+  G->unlinkNode(this);
+  ParentGraph = &G->getNodePool();
 }
 
 // addGlobal - Add an entry for a global value to the Globals list.  This also
@@ -253,7 +314,7 @@ void DSNode::foldNodeCompletely() {
     // Create the node we are going to forward to.  This is required because
     // some referrers may have an offset that is > 0.  By forcing them to
     // forward, the forwarder has the opportunity to correct the offset.
-    DSNode *DestNode = new DSNode(ParentGraph);
+    DSNode *DestNode = new (getParentGraph()) DSNode(getParentGraph());
     DestNode->NodeType = NodeType;
     DestNode->setCollapsedMarker();
     DestNode->Size = 1;
@@ -787,7 +848,7 @@ DSNodeHandle ReachabilityCloner::getClonedNH(const DSNodeHandle &SrcNH) {
 
   if (!createDest) return DSNodeHandle(0,0);
 
-  DSNode *DN = new DSNode(*SN, Dest, true /* Null out all links */);
+  DSNode *DN = new (Dest) DSNode(*SN, Dest, true /* Null out all links */);
   DN->maskNodeTypes(BitsToKeep);
   NH = DN;
 
@@ -958,7 +1019,7 @@ void ReachabilityCloner::merge(const DSNodeHandle &NH,
   } else {
     // We cannot handle this case without allocating a temporary node.  Fall
     // back on being simple.
-    DSNode *NewDN = new DSNode(*SN, Dest, true /* Null out all links */);
+    DSNode *NewDN = new (Dest) DSNode(*SN, Dest, true /* Null out all links */);
     NewDN->maskNodeTypes(BitsToKeep);
 
 #ifndef NDEBUG
@@ -1496,6 +1557,26 @@ void DataStructures::init(TargetData* T) {
   GlobalsGraph = new DSGraph(GlobalECs, *T, *TypeSS);
 }
 
+/// closureThreads - Number of threads a closure may inline independent SCCs
+/// on.  The graphs share state that is filled in on demand, which is done
+/// here for the whole module before they are merged on several threads.
+unsigned DataStructures::closureThreads(Module &M) {
+  if (DSAThreads <= 1 || !llvm_is_multithreaded())
+    return 1;
+  // Struct layouts are cached by TargetData as they are asked for
+  TypeFinder StructTypes;
+  StructTypes.run(M, false);
+  for (TypeFinder::iterator I = StructTypes.begin(), E = StructTypes.end();
+       I != E; ++I)
+    if ((*I)->isSized())
+      TD->getStructLayout(*I);
+  // Leaders of the global ECs are found with path compression
+  for (EquivalenceClasses<const GlobalValue*>::iterator I = GlobalECs.begin(),
+       E = GlobalECs.end(); I != E; ++I)
+    GlobalECs.findLeader(I);
+  return DSAThreads;
+}
+
 // CBU has the correct call graph. All the passes that follow it 
 // must resotre the call graph, at the end, so that it it correct.
 // This is simpler than keeping all the CBU data structures around.
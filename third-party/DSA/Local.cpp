@@ -86,7 +86,7 @@ namespace {
     ///
     DSNode *createNode() 
     {   
-      DSNode* ret = new DSNode(&G);
+      DSNode* ret = new (&G) DSNode(&G);
       assert(ret->getParentGraph() && "No parent?");
       return ret;
     }
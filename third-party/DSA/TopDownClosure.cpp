@@ -20,10 +20,14 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/Timer.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/Statistic.h"
 
 #include "dsa/DataStructure.h"
 #include "dsa/DSGraph.h"
+
+#include "commons/Parallel.h"
+
 using namespace llvm;
 
 #define TIME_REGION(VARNAME, DESC)
@@ -41,6 +45,23 @@ namespace {
 char TDDataStructures::ID;
 char EQTDDataStructures::ID;
 
+// CallerWave - Graphs of the same level of inlineInWaves, whose callers are
+// inlined into them on several threads.
+class TDDataStructures::CallerWave : public ParallelTask {
+public:
+  std::vector<DSGraph*> Graphs;
+  std::vector<std::vector<CallerCallEdge> > Edges;
+
+  explicit CallerWave(TDDataStructures &td) : Pass(td) {}
+
+  virtual void run(unsigned index, unsigned worker) {
+    Pass.inlineCallers(Graphs[index], Edges[index]);
+  }
+
+private:
+  TDDataStructures &Pass;
+};
+
 TDDataStructures::~TDDataStructures() {
   releaseMemory();
 }
@@ -146,6 +167,11 @@ bool TDDataStructures::runOnModule(Module &M) {
 
 {TIME_REGION(XXX, "td:Inline stuff");
 
+  // Graphs that don't call each other may be inlined at the same time.
+  unsigned Threads = closureThreads(M);
+  if (Threads > 1)
+    inlineInWaves(PostOrder, Threads);
+
   // Visit each of the graphs in reverse post-order now!
   while (!PostOrder.empty()) {
     InlineCallersIntoGraph(PostOrder.back());
@@ -229,12 +255,100 @@ void TDDataStructures::ComputePostOrder(const Function &F,
   PostOrder.push_back(G);
 }
 
+/// inlineInWaves - Inline the callers of the graphs of PostOrder in waves.  A
+/// graph is inlined after the graphs that call it and come before it in
+/// reverse post-order, and no later than those that call it and come after
+/// it, so it gets the same caller edges as when the graphs are visited one at
+/// a time.  The graphs of a wave only read the graphs of their callers, so
+/// they are inlined on several threads; the globals graph and the caller
+/// edges are updated between the waves, one graph at a time in reverse
+/// post-order.  The graphs of a wave see the globals graph as it was when the
+/// wave started.
+void TDDataStructures::inlineInWaves(std::vector<DSGraph*> &PostOrder,
+                                     unsigned Threads) {
+  unsigned N = PostOrder.size();
+  DenseMap<DSGraph*, unsigned> Order;   // Position in reverse post-order
+  for (unsigned i = 0; i != N; ++i)
+    Order[PostOrder[N-1-i]] = i;
+
+  // The callees of a graph are the graphs it records caller edges for.
+  std::vector<unsigned> Level(N, 0);
+  unsigned MaxLevel = 0;
+  for (unsigned i = 0; i != N; ++i) {
+    DSGraph *G = PostOrder[N-1-i];
+    std::vector<unsigned> Callees;
+    for (DSGraph::fc_iterator CI = G->fc_begin(), CE = G->fc_end();
+         CI != CE; ++CI) {
+      svset<const Function*> AllCallees;
+      if (CI->isDirectCall())
+        AllCallees.insert(CI->getCalleeFunc());
+      else
+        callgraph.addFullFunctionSet(CI->getCallSite(), AllCallees);
+      for (svset<const Function*>::iterator I = AllCallees.begin(),
+           E = AllCallees.end(); I != E; ++I) {
+        if ((*I)->isDeclaration())
+          continue;
+        DenseMap<DSGraph*, unsigned>::iterator It =
+          Order.find(getDSGraph(**I));
+        if (It != Order.end() && It->second != i)
+          Callees.push_back(It->second);
+      }
+    }
+    for (unsigned j = 0, e = Callees.size(); j != e; ++j)
+      if (Callees[j] < i && Level[i] < Level[Callees[j]])
+        Level[i] = Level[Callees[j]];
+    for (unsigned j = 0, e = Callees.size(); j != e; ++j)
+      if (Callees[j] > i && Level[Callees[j]] <= Level[i])
+        Level[Callees[j]] = Level[i] + 1;
+    if (MaxLevel < Level[i])
+      MaxLevel = Level[i];
+  }
+
+  CallerWave Wave(*this);
+  for (unsigned L = 0; L <= MaxLevel; ++L) {
+    Wave.Graphs.clear();
+    for (unsigned i = 0; i != N; ++i)
+      if (Level[i] == L)
+        Wave.Graphs.push_back(PostOrder[N-1-i]);
+    Wave.Edges.clear();
+    Wave.Edges.resize(Wave.Graphs.size());
+    DEBUG(errs() << "[TD] Inlining callers into " << Wave.Graphs.size()
+          << " graphs of level " << L << "\n");
+
+    // Callers are done with, but may still have handles to forwarded nodes
+    DenseSet<DSGraph*> Callers;
+    for (unsigned k = 0, e = Wave.Graphs.size(); k != e; ++k) {
+      prepareCallers(Wave.Graphs[k], Wave.Edges[k]);
+      for (unsigned j = 0, je = Wave.Edges[k].size(); j != je; ++j)
+        if (Callers.insert(Wave.Edges[k][j].CallerGraph).second)
+          Wave.Edges[k][j].CallerGraph->resolveForwarding();
+    }
+
+    sys::AtomicIncrement(&DSNode::SharedGraphs);
+    parallel_for(Wave, Wave.Graphs.size(), Threads);
+    sys::AtomicDecrement(&DSNode::SharedGraphs);
+
+    for (unsigned k = 0, e = Wave.Graphs.size(); k != e; ++k)
+      finishGraph(Wave.Graphs[k]);
+  }
+  PostOrder.clear();
+}
+
 /// InlineCallersIntoGraph - Inline all of the callers of the specified DS graph
 /// into it, then recompute completeness of nodes in the resultant graph.
 void TDDataStructures::InlineCallersIntoGraph(DSGraph* DSG) {
+  std::vector<CallerCallEdge> EdgesFromCaller;
+  prepareCallers(DSG, EdgesFromCaller);
+  inlineCallers(DSG, EdgesFromCaller);
+  finishGraph(DSG);
+}
+
+/// prepareCallers - Take the call sites that call into the graph, sorted by
+/// caller graph, and clone the globals graph into it.
+void TDDataStructures::prepareCallers(DSGraph* DSG,
+                                      std::vector<CallerCallEdge> &EdgesFromCaller) {
   // Inline caller graphs into this graph.  First step, get the list of call
   // sites that call into this graph.
-  std::vector<CallerCallEdge> EdgesFromCaller;
   std::map<DSGraph*, std::vector<CallerCallEdge> >::iterator
     CEI = CallerEdges.find(DSG);
   if (CEI != CallerEdges.end()) {
@@ -253,7 +367,13 @@ void TDDataStructures::InlineCallersIntoGraph(DSGraph* DSG) {
   // removeDeadNodes and gut removeDeadNodes at the same time first though. :(
   cloneGlobalsInto(DSG, DSGraph::DontCloneCallNodes |
                         DSGraph::DontCloneAuxCallNodes);
+}
 
+/// inlineCallers - Inline the call sites of EdgesFromCaller into the graph
+/// and recompute its flags.  Only the graph is written; its callers are only
+/// read.
+void TDDataStructures::inlineCallers(DSGraph* DSG,
+                                     std::vector<CallerCallEdge> &EdgesFromCaller) {
   DEBUG(errs() << "[TD] Inlining callers into '"
         << DSG->getFunctionNames() << "'\n");
 
@@ -321,7 +441,11 @@ void TDDataStructures::InlineCallersIntoGraph(DSGraph* DSG) {
     = isExternallyCallable ? DSGraph::MarkFormalsExternal : DSGraph::DontMarkFormalsExternal;
   DSG->computeExternalFlags(ExtFlags);
   DSG->computeIntPtrFlags();
+}
 
+/// finishGraph - Clone what the graph knows about the globals into the globals
+/// graph, remove its dead nodes, and record the edges to its callees.
+void TDDataStructures::finishGraph(DSGraph* DSG) {
   cloneIntoGlobals(DSG, DSGraph::DontCloneCallNodes |
                         DSGraph::DontCloneAuxCallNodes);
   //
@@ -0,0 +1,316 @@
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+
+#include <map>
+#include <vector>
+
+#include "llvm/Constants.h"
+#include "llvm/InlineAsm.h"
+#include "llvm/Instructions.h"
+#include "llvm/IntrinsicInst.h"
+#include "llvm/Module.h"
+#include "llvm/ADT/EquivalenceClasses.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/InstIterator.h"
+
+#include "dsa/DataStructure.h"
+#include "dsa/DSGraph.h"
+
+#include "llvmslicer/LLVM.h"
+#include "llvmslicer/PointsTo.h"
+
+namespace llvm { namespace ptr {
+
+namespace {
+
+  // Work of all the computeDSAPointsToSets so far, see dsaStats
+  volatile uint64_t DSANodes = 0;
+  volatile uint64_t DSAUnified = 0;
+
+  typedef PointsToSets::PointsToSet Locations;
+
+  /*
+   * DSA keeps a graph per function, shared by the functions of an SCC or
+   * of an equivalence class, whose nodes are the memory objects the
+   * function can reach. The nodes of a caller and of a callee that stand
+   * for the same objects are unified through the arguments, the return
+   * value and the globals of every call, which turns the classes into
+   * module-wide abstract objects. The locations of a class are the
+   * allocas, malloc calls and globals that allocate it.
+   *
+   * The sets follow the rule-based analysis: a value with an extra
+   * reference (alloca, global) points to what is stored in it, any other
+   * pointer to the locations of its node, and a malloc call to both.
+   */
+  class NodeClasses {
+  public:
+    explicit NodeClasses(DataStructures &DS) : nodes(0), unified(0), DS(DS) {}
+
+    void unifyGraphs(Module &M);
+    void collectLocations(Module &M);
+    void fill(Module &M, PointsToSets &S);
+
+    unsigned nodes;   // DSA nodes read into points-to sets
+    unsigned unified; // DSA nodes unified across graphs
+
+  private:
+    typedef std::map<const DSNode *, Locations> ClassLocations;
+
+    DSNodeHandle nodeFor(const DSGraph *G, const Value *V) const;
+    const DSNode *leader(const DSNode *N);
+    void unify(const DSNodeHandle &A, const DSNodeHandle &B);
+    void unifyCall(DSGraph *G, const Instruction *I);
+    void addGlobals(const DSGraph *G);
+    const Locations &locations(const DSNode *N);
+    const Locations &contents(const DSNode *N);
+    void add(PointsToSets &S, const Value *V, const Locations &L);
+
+    DataStructures &DS;
+    std::vector<DSGraph *> graphs; // each graph once, the globals graph last
+    EquivalenceClasses<const DSNode *> classes;
+    ClassLocations locs;           // by leader
+    ClassLocations stored;         // by leader, see contents
+  };
+
+  DSNodeHandle NodeClasses::nodeFor(const DSGraph *G, const Value *V) const
+  {
+    // find() goes through the leader of the class of a global
+    DSScalarMap::const_iterator I = G->getScalarMap().find(V);
+    if (I == G->getScalarMap().end())
+      return DSNodeHandle();
+    return I->second;
+  }
+
+  const DSNode *NodeClasses::leader(const DSNode *N)
+  {
+    classes.insert(N);
+    return classes.getLeaderValue(N);
+  }
+
+  void NodeClasses::unify(const DSNodeHandle &A, const DSNodeHandle &B)
+  {
+    SmallVector<std::pair<DSNodeHandle, DSNodeHandle>, 16> work;
+    work.push_back(std::make_pair(A, B));
+    while (!work.empty()) {
+      DSNodeHandle X = work.back().first, Y = work.back().second;
+      work.pop_back();
+      const DSNode *N1 = X.getNode(), *N2 = Y.getNode();
+      if (N1 == NULL || N2 == NULL || leader(N1) == leader(N2))
+        continue;
+      classes.unionSets(N1, N2);
+      ++unified;
+      // Fields at the same offset from the handles are the same objects,
+      // anything goes to the only field of a collapsed node
+      for (DSNode::const_edge_iterator I = N1->edge_begin(),
+          E = N1->edge_end(); I != E; ++I) {
+        unsigned off = 0;
+        if (!N2->isCollapsedNode()) {
+          if (I->first + Y.getOffset() < X.getOffset())
+            continue;
+          off = I->first + Y.getOffset() - X.getOffset();
+        }
+        if (off < N2->getSize() && N2->hasLink(off))
+          work.push_back(std::make_pair(I->second, N2->getLink(off)));
+      }
+    }
+  }
+
+  void NodeClasses::unifyCall(DSGraph *G, const Instruction *I)
+  {
+    CallSite CS(const_cast<Instruction *>(I));
+    if (isa<InlineAsm>(CS.getCalledValue()) || isa<IntrinsicInst>(I))
+      return;
+    SmallPtrSet<const Function *, 4> callees;
+    if (const Function *F = CS.getCalledFunction())
+      callees.insert(F);
+    const DSCallGraph &CG = DS.getCallGraph();
+    callees.insert(CG.callee_begin(CS), CG.callee_end(CS));
+    for (SmallPtrSet<const Function *, 4>::iterator FI = callees.begin(),
+        FE = callees.end(); FI != FE; ++FI) {
+      const Function *F = *FI;
+      if (F->isDeclaration() || !DS.hasDSGraph(*F))
+        continue;
+      DSGraph *FG = DS.getDSGraph(*F);
+      if (FG == G) // an SCC, already one graph
+        continue;
+      if (I->getType()->isPointerTy()) {
+        DSGraph::ReturnNodesTy::const_iterator R = FG->getReturnNodes().find(F);
+        if (R != FG->getReturnNodes().end())
+          unify(nodeFor(G, I), R->second);
+      }
+      // extra arguments of a vararg call have no formal to go to
+      Function::const_arg_iterator P = F->arg_begin(), PE = F->arg_end();
+      for (unsigned a = 0; a < CS.arg_size() && P != PE; ++a, ++P) {
+        const Value *A = CS.getArgument(a);
+        if (A->getType()->isPointerTy())
+          unify(nodeFor(G, A), nodeFor(FG, &*P));
+      }
+    }
+  }
+
+  void NodeClasses::unifyGraphs(Module &M)
+  {
+    SmallPtrSet<DSGraph *, 64> seen;
+    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+      if (!F->isDeclaration() && DS.hasDSGraph(*F) &&
+          seen.insert(DS.getDSGraph(*F)))
+        graphs.push_back(DS.getDSGraph(*F));
+    DSGraph *GG = DS.getGlobalsGraph();
+    for (std::vector<DSGraph *>::iterator G = graphs.begin(), GE = graphs.end();
+        G != GE; ++G) {
+      DSScalarMap &SM = (*G)->getScalarMap();
+      for (DSScalarMap::global_iterator I = SM.global_begin(),
+          E = SM.global_end(); I != E; ++I)
+        unify(SM[*I], nodeFor(GG, *I));
+    }
+    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+      if (F->isDeclaration() || !DS.hasDSGraph(*F))
+        continue;
+      DSGraph *G = DS.getDSGraph(*F);
+      for (inst_iterator I = inst_begin(*F), IE = inst_end(*F); I != IE; ++I)
+        if (isa<CallInst>(&*I) || isa<InvokeInst>(&*I))
+          unifyCall(G, &*I);
+    }
+    graphs.push_back(GG);
+  }
+
+  void NodeClasses::addGlobals(const DSGraph *G)
+  {
+    EquivalenceClasses<const GlobalValue *> &ECs = DS.getGlobalECs();
+    const DSScalarMap &SM = G->getScalarMap();
+    for (DSScalarMap::global_iterator I = SM.global_begin(),
+        E = SM.global_end(); I != E; ++I) {
+      const DSNode *N = nodeFor(G, *I).getNode();
+      if (N == NULL)
+        continue;
+      Locations &L = locs[leader(N)];
+      EquivalenceClasses<const GlobalValue *>::iterator EC = ECs.findValue(*I);
+      if (EC == ECs.end()) {
+        L.insert(*I);
+        continue;
+      }
+      for (EquivalenceClasses<const GlobalValue *>::member_iterator
+          MI = ECs.member_begin(EC), ME = ECs.member_end(); MI != ME; ++MI)
+        L.insert(*MI);
+    }
+  }
+
+  void NodeClasses::collectLocations(Module &M)
+  {
+    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+      if (F->isDeclaration() || !DS.hasDSGraph(*F))
+        continue;
+      const DSGraph *G = DS.getDSGraph(*F);
+      for (inst_iterator I = inst_begin(*F), IE = inst_end(*F); I != IE; ++I) {
+        const CallInst *C = dyn_cast<CallInst>(&*I);
+        if (!isa<AllocaInst>(&*I) &&
+            !(C && isMemoryAllocation(C->getCalledValue())))
+          continue;
+        if (const DSNode *N = nodeFor(G, &*I).getNode())
+          locs[leader(N)].insert(&*I);
+      }
+    }
+    for (std::vector<DSGraph *>::iterator G = graphs.begin(), GE = graphs.end();
+        G != GE; ++G)
+      addGlobals(*G);
+  }
+
+  const Locations &NodeClasses::locations(const DSNode *N)
+  {
+    return locs[leader(N)];
+  }
+
+  const Locations &NodeClasses::contents(const DSNode *N)
+  {
+    const DSNode *L = leader(N);
+    ClassLocations::iterator I = stored.find(L);
+    if (I != stored.end())
+      return I->second;
+    // Every node of the class, the links of one graph may be missing in
+    // another. leader() inserts, so the targets are gathered first.
+    std::vector<const DSNode *> targets;
+    for (EquivalenceClasses<const DSNode *>::member_iterator
+        MI = classes.member_begin(classes.findValue(L)),
+        ME = classes.member_end(); MI != ME; ++MI)
+      for (DSNode::const_edge_iterator EI = (*MI)->edge_begin(),
+          EE = (*MI)->edge_end(); EI != EE; ++EI)
+        if (const DSNode *T = EI->second.getNode())
+          targets.push_back(T);
+    Locations pts;
+    for (std::vector<const DSNode *>::iterator T = targets.begin(),
+        TE = targets.end(); T != TE; ++T) {
+      const Locations &TL = locations(*T);
+      pts.insert(TL.begin(), TL.end());
+    }
+    Locations &result = stored[L];
+    result.swap(pts);
+    return result;
+  }
+
+  void NodeClasses::add(PointsToSets &S, const Value *V, const Locations &L)
+  {
+    if (!L.empty())
+      S[V].insert(L.begin(), L.end());
+  }
+
+  void NodeClasses::fill(Module &M, PointsToSets &S)
+  {
+    for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+      if (F->isDeclaration() || !DS.hasDSGraph(*F))
+        continue;
+      const DSGraph *G = DS.getDSGraph(*F);
+      for (Function::arg_iterator A = F->arg_begin(), AE = F->arg_end();
+          A != AE; ++A)
+        if (const DSNode *N = nodeFor(G, &*A).getNode())
+          add(S, &*A, locations(N));
+      for (inst_iterator I = inst_begin(*F), IE = inst_end(*F); I != IE; ++I) {
+        if (!I->getType()->isPointerTy())
+          continue;
+        const DSNode *N = nodeFor(G, &*I).getNode();
+        if (N == NULL)
+          continue;
+        ++nodes;
+        if (hasExtraReference(&*I)) {
+          add(S, &*I, contents(N));
+          continue;
+        }
+        add(S, &*I, locations(N));
+        if (const CallInst *C = dyn_cast<CallInst>(&*I))
+          if (isMemoryAllocation(C->getCalledValue()))
+            add(S, &*I, contents(N));
+      }
+    }
+    // What is stored in a global, whichever graph it was seen in
+    for (std::vector<DSGraph *>::iterator G = graphs.begin(), GE = graphs.end();
+        G != GE; ++G) {
+      for (Module::global_iterator GV = M.global_begin(), E = M.global_end();
+          GV != E; ++GV)
+        if (const DSNode *N = nodeFor(*G, &*GV).getNode())
+          add(S, &*GV, contents(N));
+    }
+  }
+
+}
+
+  PointsToSets &computeDSAPointsToSets(Module &M, DataStructures &DS,
+      PointsToSets &S)
+  {
+    NodeClasses classes(DS);
+    classes.unifyGraphs(M);
+    classes.collectLocations(M);
+    classes.fill(M, S);
+    // The DSA of different modules may run in parallel
+    __sync_fetch_and_add(&DSANodes, (uint64_t) classes.nodes);
+    __sync_fetch_and_add(&DSAUnified, (uint64_t) classes.unified);
+    return S;
+  }
+
+  void dsaStats(uint64_t &nodes, uint64_t &unified)
+  {
+    nodes = DSANodes;
+    unified = DSAUnified;
+  }
+
+}}
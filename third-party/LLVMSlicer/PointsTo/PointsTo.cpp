@@ -1,9 +1,16 @@
 // This file is distributed under the University of Illinois Open Source
 // License. See LICENSE.TXT for details.
 
+#include <deque>
+#include <set>
+#include <vector>
+
 #include "llvm/BasicBlock.h"
 #include "llvm/Instruction.h"
 #include "llvm/Module.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SparseBitVector.h"
 
 #include "llvmslicer/PointsTo.h"
 #include "llvmslicer/RuleExpressions.h"
@@ -13,203 +20,326 @@
 
 namespace llvm { namespace ptr {
 
-  static bool applyRule(PointsToSets &S, ASSIGNMENT<
-      VARIABLE<const llvm::Value *>,
-      VARIABLE<const llvm::Value *>
-      > const& E) {
-    typedef PointsToSets::PointsToSet PTSet;
-    const llvm::Value *lval = E.getArgument1().getArgument();
-    const llvm::Value *rval = E.getArgument2().getArgument();
-    PTSet &L = S[lval];
-    const PTSet &R = S[rval];
-    const std::size_t old_size = L.size();
+namespace {
 
-    std::copy(R.begin(), R.end(), std::inserter(L, L.end()));
+  typedef llvm::SparseBitVector<> Locations;
 
-    return old_size != L.size();
+  /*
+   * The rules of a ProgramStructure as inclusion constraints between
+   * numbered values, solved with a worklist that only pushes the part of
+   * a points-to set its edges haven't seen yet (difference propagation).
+   * Copy edges whose ends end up with equal sets are checked once for a
+   * cycle, which is then collapsed into one node (lazy cycle detection,
+   * Hardekopf and Lin, PLDI'07).
+   *
+   * The id of a value is both its node and its abstract location. Merged
+   * nodes stay distinct locations, only the node a location is loaded
+   * from or stored to goes through the union-find.
+   */
+  class ConstraintGraph {
+  public:
+    explicit ConstraintGraph(const ProgramStructure &P);
+
+    void solve();
+    void collect(PointsToSets &S) const;
+    unsigned size() const { return nodes.size(); }
+
+    unsigned visits;    // nodes taken off the worklist
+    unsigned collapsed; // nodes collapsed into cycles
+
+  private:
+    struct Node {
+      unsigned rep;                      // union-find parent
+      Locations pts;                     // locations it may point to
+      Locations done;                    // part of pts its edges have seen
+      Locations copyTo;                  // n = this
+      std::vector<unsigned> loads;       // n = *this
+      std::vector<unsigned> stores;      // *this = n
+      std::vector<unsigned> addrStores;  // *this = &n, *this = null
+    };
+
+    std::vector<Node> nodes;
+    std::vector<const llvm::Value *> values; // NULL for temporaries
+    llvm::DenseMap<const llvm::Value *, unsigned> ids;
+    std::deque<unsigned> work;
+    std::vector<bool> queued;
+    std::set<std::pair<unsigned, unsigned> > checked; // edges seen by LCD
+
+    unsigned getId(const llvm::Value *V);
+    unsigned newTemporary();
+    unsigned find(unsigned n);
+    void push(unsigned n);
+    bool addEdge(unsigned from, unsigned to);
+    void unite(unsigned from, unsigned to);
+    void collapseCycles(unsigned root);
+  };
+
+  struct Constraint {
+    RuleCodeType type;
+    unsigned l, r;
+  };
+
+}
+
+  // Work of all the solvers so far, see solverStats
+  static volatile uint64_t PTNodes = 0;
+  static volatile uint64_t PTVisits = 0;
+  static volatile uint64_t PTCollapsed = 0;
+
+  unsigned ConstraintGraph::getId(const llvm::Value *V) {
+    std::pair<llvm::DenseMap<const llvm::Value *, unsigned>::iterator, bool> r =
+      ids.insert(std::make_pair(V, (unsigned) values.size()));
+    if (r.second)
+      values.push_back(V);
+    return r.first->second;
   }
 
-  static bool applyRule(PointsToSets &S, ASSIGNMENT<
-      VARIABLE<const llvm::Value *>,
-      REFERENCE<VARIABLE<const llvm::Value *> >
-      > const& E) {
-    const llvm::Value *lval = E.getArgument1().getArgument();
-    const llvm::Value *rval = E.getArgument2().getArgument().getArgument();
-    PointsToSets::PointsToSet &L = S[lval];
-    const std::size_t old_size = L.size();
-
-    L.insert(rval);
-
-    return old_size != L.size();
+  unsigned ConstraintGraph::newTemporary() {
+    values.push_back(NULL);
+    return values.size() - 1;
   }
 
-  static bool applyRule(PointsToSets &S, ASSIGNMENT<
-      VARIABLE<const llvm::Value *>,
-      DEREFERENCE< VARIABLE<const llvm::Value *> >
-      > const& E)
-  {
-    typedef PointsToSets::PointsToSet PTSet;
-    const llvm::Value *lval = E.getArgument1().getArgument();
-    const llvm::Value *rval = E.getArgument2().getArgument().getArgument();
-    PTSet &L = S[lval];
-    PTSet &R = S[rval];
-    const std::size_t old_size = L.size();
-
-    for (PTSet::const_iterator i = R.begin(); i!=R.end(); ++i) {
-      PTSet &X = S[*i];
-      std::copy(X.begin(), X.end(), std::inserter(L, L.end()));
+  ConstraintGraph::ConstraintGraph(const ProgramStructure &P) :
+    visits(0), collapsed(0) {
+    // Number everything first, so that nodes never move once created
+    std::vector<Constraint> constraints;
+    constraints.reserve(P.size());
+    for (ProgramStructure::const_iterator I = P.begin(), E = P.end();
+        I != E; ++I) {
+      if (I->getType() == RCT_DEALLOC)
+        continue;
+      Constraint c;
+      c.type = I->getType();
+      c.l = getId(I->getLvalue());
+      c.r = getId(I->getRvalue());
+      constraints.push_back(c);
     }
-
-    return old_size != L.size();
-  }
-
-  static bool applyRule(PointsToSets &S, ASSIGNMENT<
-      DEREFERENCE<VARIABLE<const llvm::Value *> >,
-      VARIABLE<const llvm::Value *>
-      > const& E)
-  {
-    typedef PointsToSets::PointsToSet PTSet;
-    const llvm::Value *lval = E.getArgument1().getArgument().getArgument();
-    const llvm::Value *rval = E.getArgument2().getArgument();
-    PTSet &L = S[lval];
-    PTSet &R = S[rval];
-    bool change = false;
-
-    for (PTSet::const_iterator i = L.begin(); i != L.end(); ++i) {
-      PTSet &X = S[*i];
-      const std::size_t old_size = X.size();
-
-      std::copy(R.begin(), R.end(), std::inserter(X, X.end()));
-      change = change || X.size() != old_size;
+    unsigned nvalues = values.size();
+    for (std::vector<Constraint>::const_iterator I = constraints.begin(),
+        E = constraints.end(); I != E; ++I)
+      if (I->type == RCT_DREF_VAR_ASGN_DREF_VAR)
+        newTemporary();
+
+    nodes.resize(values.size());
+    queued.resize(values.size(), false);
+    for (unsigned n = 0; n < nodes.size(); ++n)
+      nodes[n].rep = n;
+
+    unsigned temp = nvalues;
+    for (std::vector<Constraint>::const_iterator I = constraints.begin(),
+        E = constraints.end(); I != E; ++I) {
+      switch (I->type) {
+        case RCT_VAR_ASGN_ALLOC:
+        case RCT_VAR_ASGN_NULL:
+        case RCT_VAR_ASGN_REF_VAR:
+          nodes[I->l].pts.set(I->r);
+          break;
+        case RCT_VAR_ASGN_VAR:
+          nodes[I->r].copyTo.set(I->l);
+          break;
+        case RCT_VAR_ASGN_DREF_VAR:
+          nodes[I->r].loads.push_back(I->l);
+          break;
+        case RCT_DREF_VAR_ASGN_VAR:
+          nodes[I->l].stores.push_back(I->r);
+          break;
+        case RCT_DREF_VAR_ASGN_NULL:
+        case RCT_DREF_VAR_ASGN_REF_VAR:
+          nodes[I->l].addrStores.push_back(I->r);
+          break;
+        case RCT_DREF_VAR_ASGN_DREF_VAR:
+          // *l = *r is t = *r; *l = t
+          nodes[I->r].loads.push_back(temp);
+          nodes[I->l].stores.push_back(temp);
+          temp++;
+          break;
+        default:
+          assert(0);
+      }
     }
-
-    return change;
   }
 
-  static bool applyRule(PointsToSets &S, ASSIGNMENT<
-      DEREFERENCE<VARIABLE<const llvm::Value *> >,
-      REFERENCE<VARIABLE<const llvm::Value *> >
-      > const &E)
-  {
-    typedef PointsToSets::PointsToSet PTSet;
-    const llvm::Value *lval = E.getArgument1().getArgument().getArgument();
-    const llvm::Value *rval = E.getArgument2().getArgument().getArgument();
-    PTSet &L = S[lval];
-    bool change = false;
-
-    for (PTSet::const_iterator i = L.begin(); i != L.end(); ++i) {
-      PTSet &X = S[*i];
-      const std::size_t old_size = X.size();
-
-      X.insert(rval);
-      change = change || X.size() != old_size;
+  unsigned ConstraintGraph::find(unsigned n) {
+    while (nodes[n].rep != n) {
+      nodes[n].rep = nodes[nodes[n].rep].rep; // path halving
+      n = nodes[n].rep;
     }
-
-    return change;
+    return n;
   }
 
-  static bool applyRule(PointsToSets &S, ASSIGNMENT<
-      DEREFERENCE<VARIABLE<const llvm::Value *> >,
-      DEREFERENCE<VARIABLE<const llvm::Value *> >
-      > const& E)
-  {
-    typedef PointsToSets::PointsToSet PTSet;
-    const llvm::Value *lval = E.getArgument1().getArgument().getArgument();
-    const llvm::Value *rval = E.getArgument2().getArgument().getArgument();
-    PTSet &L = S[lval];
-    bool change = false;
-
-    for (PTSet::const_iterator i = L.begin(); i != L.end(); ++i)
-      if (applyRule(S, (ruleVar(*i) = *ruleVar(rval)).getSort()))
-        change = true;
-
-    return change;
+  void ConstraintGraph::push(unsigned n) {
+    if (queued[n])
+      return;
+    queued[n] = true;
+    work.push_back(n);
   }
 
-  static bool applyRule(PointsToSets &S, ASSIGNMENT<
-      VARIABLE<const llvm::Value *>,
-      ALLOC<const llvm::Value *>
-      > const &E)
-  {
-    const llvm::Value *lval = E.getArgument1().getArgument();
-    const llvm::Value *rval = E.getArgument2().getArgument();
-    PointsToSets::PointsToSet &L = S[lval];
-    const std::size_t old_size = L.size();
-
-    L.insert(rval);
-
-    return old_size != L.size();
+  /// A new edge carries the whole set of from, not only its difference
+  bool ConstraintGraph::addEdge(unsigned from, unsigned to) {
+    from = find(from);
+    to = find(to);
+    if (from == to || !nodes[from].copyTo.test_and_set(to))
+      return false;
+    if (nodes[to].pts |= nodes[from].pts)
+      push(to);
+    return true;
   }
 
-  static bool applyRule(PointsToSets &S, ASSIGNMENT<
-      VARIABLE<const llvm::Value *>,
-      NULLPTR<const llvm::Value *>
-      > const &E)
-  {
-    const llvm::Value *lval = E.getArgument1().getArgument();
-    const llvm::Value *rval = E.getArgument2().getArgument();
-    PointsToSets::PointsToSet &L = S[lval];
-    const std::size_t old_size = L.size();
-
-    L.insert(rval);
-
-    return old_size != L.size();
+  void ConstraintGraph::unite(unsigned from, unsigned to) {
+    Node &F = nodes[from], &T = nodes[to];
+    F.rep = to;
+    T.pts |= F.pts;
+    // What only one of them has seen has to go through the edges again
+    T.done &= F.done;
+    T.copyTo |= F.copyTo;
+    T.loads.insert(T.loads.end(), F.loads.begin(), F.loads.end());
+    T.stores.insert(T.stores.end(), F.stores.begin(), F.stores.end());
+    T.addrStores.insert(T.addrStores.end(), F.addrStores.begin(),
+        F.addrStores.end());
+    F.pts.clear();
+    F.done.clear();
+    F.copyTo.clear();
+    std::vector<unsigned>().swap(F.loads);
+    std::vector<unsigned>().swap(F.stores);
+    std::vector<unsigned>().swap(F.addrStores);
+    collapsed++;
+    push(to);
   }
 
-  static bool applyRule(PointsToSets &S, ASSIGNMENT<
-      DEREFERENCE<VARIABLE<const llvm::Value *> >,
-      NULLPTR<const llvm::Value *>
-      > const &E)
-  {
-    typedef PointsToSets::PointsToSet PTSet;
-    const llvm::Value *lval = E.getArgument1().getArgument().getArgument();
-    const llvm::Value *rval = E.getArgument2().getArgument();
-    PTSet &L = S[lval];
-    bool change = false;
-
-    for (PTSet::const_iterator i = L.begin(); i != L.end(); ++i) {
-      PTSet &X = S[*i];
-      const std::size_t old_size = X.size();
-
-      L.insert(rval);
-      change = change || X.size() != old_size;
+  /// Collapse the cycles of copy edges reachable from root, with an
+  /// iterative Tarjan so that long chains don't overflow the stack
+  void ConstraintGraph::collapseCycles(unsigned root) {
+    struct Frame {
+      unsigned node;
+      std::vector<unsigned> succs;
+      unsigned next;
+    };
+    llvm::DenseMap<unsigned, unsigned> index, low;
+    llvm::DenseSet<unsigned> onStack;
+    std::vector<unsigned> stack;
+    std::vector<Frame> dfs;
+    unsigned counter = 0;
+
+    root = find(root);
+    dfs.push_back(Frame());
+    dfs.back().node = root;
+    dfs.back().next = 0;
+    while (!dfs.empty()) {
+      unsigned v = dfs.back().node;
+      if (dfs.back().next == 0 && !index.count(v)) {
+        index[v] = low[v] = counter++;
+        stack.push_back(v);
+        onStack.insert(v);
+        const Locations &succs = nodes[v].copyTo;
+        for (Locations::iterator I = succs.begin(), E = succs.end(); I != E; ++I)
+          if (find(*I) != v)
+            dfs.back().succs.push_back(find(*I));
+      }
+      Frame &F = dfs.back();
+      if (F.next < F.succs.size()) {
+        unsigned w = F.succs[F.next++];
+        if (!index.count(w)) {
+          dfs.push_back(Frame());
+          dfs.back().node = w;
+          dfs.back().next = 0;
+        } else if (onStack.count(w) && index[w] < low[v])
+          low[v] = index[w];
+        continue;
+      }
+      dfs.pop_back();
+      if (!dfs.empty()) {
+        unsigned u = dfs.back().node;
+        if (low[v] < low[u])
+          low[u] = low[v];
+      }
+      if (low[v] != index[v])
+        continue;
+      unsigned w;
+      do {
+        w = stack.back();
+        stack.pop_back();
+        onStack.erase(w);
+        if (w != v)
+          unite(w, v);
+      } while (w != v);
     }
-
-    return change;
   }
 
-  static bool applyRule(PointsToSets &S, DEALLOC<const llvm::Value *>) {
-    return false;
+  void ConstraintGraph::solve() {
+    for (unsigned n = 0; n < nodes.size(); ++n)
+      if (!nodes[n].pts.empty())
+        push(n);
+    std::vector<unsigned> candidates;
+    while (!work.empty()) {
+      unsigned n = work.front();
+      work.pop_front();
+      queued[n] = false;
+      if (find(n) != n)
+        continue;
+      visits++;
+      Node &N = nodes[n];
+      Locations diff;
+      diff.intersectWithComplement(N.pts, N.done);
+      if (diff.empty())
+        continue;
+      N.done |= diff;
+
+      for (Locations::iterator I = diff.begin(), E = diff.end(); I != E; ++I) {
+        unsigned o = find(*I);
+        for (std::vector<unsigned>::const_iterator L = N.loads.begin(),
+            LE = N.loads.end(); L != LE; ++L)
+          addEdge(o, *L);
+        for (std::vector<unsigned>::const_iterator S = N.stores.begin(),
+            SE = N.stores.end(); S != SE; ++S)
+          addEdge(*S, o);
+        for (std::vector<unsigned>::const_iterator A = N.addrStores.begin(),
+            AE = N.addrStores.end(); A != AE; ++A)
+          if (nodes[o].pts.test_and_set(*A))
+            push(o);
+      }
+
+      candidates.clear();
+      for (Locations::iterator I = N.copyTo.begin(), E = N.copyTo.end();
+          I != E; ++I) {
+        unsigned m = find(*I);
+        if (m == n)
+          continue;
+        if (nodes[m].pts |= diff)
+          push(m);
+        if (nodes[m].pts == N.pts &&
+            checked.insert(std::make_pair(n, m)).second)
+          candidates.push_back(m);
+      }
+      for (std::vector<unsigned>::const_iterator I = candidates.begin(),
+          E = candidates.end(); I != E; ++I)
+        collapseCycles(*I);
+    }
   }
 
-  static bool applyRules(const RuleCode &RC, PointsToSets &S)
-  {
-    const llvm::Value *lval = RC.getLvalue();
-    const llvm::Value *rval = RC.getRvalue();
-
-    switch (RC.getType()) {
-      case RCT_VAR_ASGN_ALLOC:
-        return applyRule(S, (ruleVar(lval) = ruleAllocSite(rval)).getSort());
-      case RCT_VAR_ASGN_NULL:
-        return applyRule(S, (ruleVar(lval) = ruleNull(rval)).getSort());
-      case RCT_VAR_ASGN_VAR:
-        return applyRule(S, (ruleVar(lval) = ruleVar(rval)).getSort());
-      case RCT_VAR_ASGN_REF_VAR:
-        return applyRule(S, (ruleVar(lval) = &ruleVar(rval)).getSort());
-      case RCT_VAR_ASGN_DREF_VAR:
-        return applyRule(S, (ruleVar(lval) = *ruleVar(rval)).getSort());
-      case RCT_DREF_VAR_ASGN_NULL:
-        return applyRule(S, (*ruleVar(lval) = ruleNull(rval)).getSort());
-      case RCT_DREF_VAR_ASGN_VAR:
-        return applyRule(S, (*ruleVar(lval) = ruleVar(rval)).getSort());
-      case RCT_DREF_VAR_ASGN_REF_VAR:
-        return applyRule(S, (*ruleVar(lval) = &ruleVar(rval)).getSort());
-      case RCT_DREF_VAR_ASGN_DREF_VAR:
-        return applyRule(S, (*ruleVar(lval) = *ruleVar(rval)).getSort());
-      case RCT_DEALLOC:
-        return applyRule(S, ruleDeallocSite(RC.getValue()).getSort());
-      default:
-        assert(0);
+  void ConstraintGraph::collect(PointsToSets &S) const {
+    typedef PointsToSets::PointsToSet PTSet;
+    // Merged nodes share their set, build it once
+    llvm::DenseMap<unsigned, const PTSet *> built;
+    for (unsigned n = 0; n < nodes.size(); ++n) {
+      if (values[n] == NULL)
+        continue;
+      unsigned r = n;
+      while (nodes[r].rep != r)
+        r = nodes[r].rep;
+      const Locations &pts = nodes[r].pts;
+      if (pts.empty())
+        continue;
+      PTSet &L = S[values[n]];
+      llvm::DenseMap<unsigned, const PTSet *>::iterator B = built.find(r);
+      if (B != built.end()) {
+        L.insert(B->second->begin(), B->second->end());
+        continue;
+      }
+      for (Locations::iterator I = pts.begin(), E = pts.end(); I != E; ++I) {
+        assert(values[*I] && "a temporary is not a location");
+        L.insert(values[*I]);
+      }
+      built[r] = &L;
     }
   }
 
@@ -260,29 +390,24 @@ namespace llvm { namespace ptr {
     return S;
   }
 
-#define MAX_IT 1 // it takes too long (or infinite loop) for large 
-                 // program to converge
-
-  static PointsToSets &fixpoint(const ProgramStructure &P, PointsToSets &S)
-  {
-    bool change;
-    unsigned it = 0;
-    do {
-      change = false;
-      for (ProgramStructure::const_iterator i = P.begin(); i != P.end(); ++i) {
-        change |= applyRules(*i, S);
-      }
-      ++it;
+  PointsToSets &computePointsToSets(const ProgramStructure &P, PointsToSets &S) {
+    ConstraintGraph G(P);
+    G.solve();
+    G.collect(S);
+    // Solvers of different modules may run in parallel
+    __sync_fetch_and_add(&PTNodes, (uint64_t) G.size());
+    __sync_fetch_and_add(&PTVisits, (uint64_t) G.visits);
+    __sync_fetch_and_add(&PTCollapsed, (uint64_t) G.collapsed);
 #ifdef DEBUG_POINTS
-      errs() << "it #" << it << "\n";
+    errs() << "points-to solved for " << P.size() << " rules\n";
 #endif
-    } while (change && it < MAX_IT);
-
-    return S;
+    return pruneByType(S);
   }
 
-  PointsToSets &computePointsToSets(const ProgramStructure &P, PointsToSets &S) {
-    return pruneByType(fixpoint(P, S));
+  void solverStats(uint64_t &nodes, uint64_t &visits, uint64_t &collapsed) {
+    nodes = PTNodes;
+    visits = PTVisits;
+    collapsed = PTCollapsed;
   }
 
   const PointsToSets::PointsToSet &
@@ -301,6 +426,14 @@ namespace llvm { namespace ptr {
     }
 
   ProgramStructure::ProgramStructure(Module &M) : M(M) {
+    build(NULL);
+  }
+
+  ProgramStructure::ProgramStructure(Module &M, FunctionRules &rules) : M(M) {
+    build(&rules);
+  }
+
+  void ProgramStructure::build(FunctionRules *rules) {
     typedef llvm::Module::const_global_iterator GlobalsIter;
     for (GlobalsIter g = M.global_begin(); g != M.global_end(); ++g)
       if (llvm::isGlobalPointerInitialization(&*g))
@@ -312,15 +445,26 @@ namespace llvm { namespace ptr {
 
     typedef llvm::Module::const_iterator FunctionsIter;
     for (FunctionsIter f = M.begin(); f != M.end(); ++f) {
+      // The rules of the calls and returns are always generated, those of
+      // the pointer manipulations only if rules doesn't have them yet
+      Container *local = &this->getContainer();
+      bool known = false;
+      if (rules) {
+        FunctionRules::iterator R = rules->find(&*f);
+        known = R != rules->end();
+        if (!known)
+          R = rules->insert(std::make_pair(&*f, Container())).first;
+        local = &R->second;
+      }
       typedef llvm::Function::const_iterator BasicBlocksIter;
       for (BasicBlocksIter b = f->begin(); b != f->end(); ++b)
       {
         typedef llvm::BasicBlock::const_iterator InstructionsIter;
         for (InstructionsIter i = b->begin(); i != b->end(); ++i)
-          if (llvm::isPointerManipulation(&*i))
-            detail::toRuleCode(&*i,
-                std::back_inserter(this->getContainer()));
-          else if (llvm::CallInst const* const c =
+          if (llvm::isPointerManipulation(&*i)) {
+            if (!known)
+              detail::toRuleCode(&*i, std::back_inserter(*local));
+          } else if (llvm::CallInst const* const c =
               llvm::dyn_cast<llvm::CallInst>(&*i)) {
             if (!isInlineAssembly(c))
               detail::collectCallRuleCodes(c,
@@ -336,6 +480,8 @@ namespace llvm { namespace ptr {
                 std::back_inserter(this->getContainer()));
           }
       }
+      if (rules)
+        C.insert(C.end(), local->begin(), local->end());
     }
  #ifdef DEBUG_PS
     errs() << "==PS START\n";
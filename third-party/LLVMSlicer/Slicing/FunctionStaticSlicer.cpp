@@ -10,10 +10,13 @@
 // A survey of program slicing techniques
 //===----------------------------------------------------------------------===//
 
+#define DEBUG_TYPE "slicer"
+
 #include <ctype.h>
 #include <map>
 #include <set>
 #include <list>
+#include <new>
 
 #include "llvm/IntrinsicInst.h"
 #include "llvm/Constants.h"
@@ -50,6 +53,10 @@ using namespace llvm::slicing;
 // #define DEBUG_INSTINFO
 // #define DEBUG_DUMP
 
+// Added to by the slicers of a wave at once
+volatile uint64_t FunctionStaticSlicer::RCVisits = 0;
+volatile uint64_t FunctionStaticSlicer::RCSweepEstimate = 0;
+
 void slicing::printVal(const Value *val) {
   if (val->hasName())
     errs() << val->getName();
@@ -57,9 +64,57 @@ void slicing::printVal(const Value *val) {
     val->print(errs());
 }
 
-InsInfo::InsInfo(const Instruction *i, const ptr::PointsToSets &PS,
-    const mods::Modifies &MOD) : ins(i), sliced(true) {
+void ValSet::grow(unsigned n, BumpPtrAllocator &A) {
+  if (n <= nwords)
+    return;
+  if (n < nwords * 2)
+    n = nwords * 2;
+  Word *w = A.Allocate<Word>(n);
+  for (unsigned k = 0; k < nwords; ++k)
+    w[k] = words[k];
+  for (unsigned k = nwords; k < n; ++k)
+    w[k] = 0;
+  // the old words stay in the arena until the slicer goes
+  words = w;
+  nwords = n;
+}
+
+bool ValSet::unite(const ValSet &other, const ValSet *except,
+    BumpPtrAllocator &A) {
+  bool changed = false;
+  for (unsigned k = 0; k < other.nwords; ++k) {
+    Word w = other.words[k];
+    if (except && k < except->nwords)
+      w &= ~except->words[k];
+    if (k < nwords)
+      w &= ~words[k];
+    if (w == 0)
+      continue;
+    grow(k + 1, A);
+    words[k] |= w;
+    changed = true;
+  }
+  return changed;
+}
+
+bool ValSet::intersects(const ValSet &other) const {
+  unsigned n = nwords < other.nwords ? nwords : other.nwords;
+  for (unsigned k = 0; k < n; ++k)
+    if (words[k] & other.words[k])
+      return true;
+  return false;
+}
+
+bool ValSet::empty() const {
+  for (unsigned k = 0; k < nwords; ++k)
+    if (words[k])
+      return false;
+  return true;
+}
+
+void InsInfo::init(const ptr::PointsToSets &PS, const mods::Modifies &MOD) {
   typedef ptr::PointsToSets::PointsToSet PTSet;
+  const Instruction *i = ins;
 
   if (const LoadInst *LI = dyn_cast<const LoadInst>(i)) {
     addDEF(i);
@@ -287,31 +342,47 @@ namespace {
 static RegisterPass<FunctionSlicer> X("slice", "Slices the code");
 char FunctionSlicer::ID;
 
-FunctionStaticSlicer::~FunctionStaticSlicer() {
-  for (InsInfoMap::const_iterator I = insInfoMap.begin(), E = insInfoMap.end();
-      I != E; I++)
-    delete I->second;
+FunctionStaticSlicer::FunctionStaticSlicer(Function &F, ModulePass *MP,
+    const ptr::PointsToSets &PT, const mods::Modifies &mods, bool forward) :
+  fun(F), MP(MP), infos(NULL), ninfos(0), prepared(false), forward(forward) {
+  unsigned n = 0;
+  for (Function::iterator I = F.begin(), E = F.end(); I != E; ++I)
+    n += I->size();
+  infos = arena.Allocate<InsInfo>(n);
+  for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I, ++ninfos) {
+    const Instruction *i = &*I;
+    if (i == &i->getParent()->front())
+      blockStart[i->getParent()] = ninfos;
+    insIds[i] = ninfos;
+    new (&infos[ninfos]) InsInfo(i, &values, &arena);
+    infos[ninfos].init(PT, mods);
+  }
 }
 
-typedef llvm::SmallVector<const Instruction *, 10> SuccList;
+FunctionStaticSlicer::~FunctionStaticSlicer() {
+  // the InsInfos and their sets go with the arena
+}
 
-static SuccList getSuccList(const Instruction *i) {
-  SuccList succList;
-  const BasicBlock *bb = i->getParent();
-  if (i != &bb->back()) {
-    BasicBlock::const_iterator I(i);
-    I++;
-    succList.push_back(&*I);
-  } else {
-    for (succ_const_iterator I = succ_begin(bb), E = succ_end(bb); I != E; I++)
-      succList.push_back(&(*I)->front());
+void FunctionStaticSlicer::prepare() {
+  if (prepared)
+    return;
+  // Only backward slicing looks at the control dependences
+  if (!forward) {
+    PostDominanceFrontier &PDF = MP->getAnalysis<PostDominanceFrontier>(fun);
+    frontiers.insert(PDF.begin(), PDF.end());
   }
-  return succList;
+  prepared = true;
 }
 
-bool FunctionStaticSlicer::sameValues(const Value *val1, const Value *val2)
-{
-  return val1 == val2;
+void FunctionStaticSlicer::reset() {
+  for (unsigned k = 0; k < ninfos; ++k)
+    infos[k].reset();
+}
+
+/// Whether infos[k] is the last instruction of its block
+static bool lastInBlock(const InsInfo *infos, unsigned ninfos, unsigned k) {
+  return k + 1 == ninfos ||
+    infos[k + 1].getIns()->getParent() != infos[k].getIns()->getParent();
 }
 
 /*
@@ -328,13 +399,6 @@ bool FunctionStaticSlicer::sameValues(const Value *val1, const Value *val2)
  * *   {v| v \in DEF(j), REF(j) \cap RC(i) \neq \emptyset}
  */
 bool FunctionStaticSlicer::computeRCi(InsInfo *insInfoi, InsInfo *insInfoj) {
-  /*
-  if (isa<IntrinsicInst>(insInfoi->getIns()) || isa<IntrinsicInst>(insInfoj->getIns())) {
-    errs() << "skip intrinsic inst\n";
-    return false;
-  }
-  */
-
 #ifdef DEBUG_RC
   errs() << " ---" << __func__ << "--- between '";
   insInfoi->getIns()->print(errs());
@@ -343,9 +407,6 @@ bool FunctionStaticSlicer::computeRCi(InsInfo *insInfoi, InsInfo *insInfoj) {
   errs() << "'\n";
 #endif
 
-
-  bool changed = false;
-
   InsInfo *ii, *ij;
   if (!forward) { // backward 
     ii = insInfoi;
@@ -356,152 +417,98 @@ bool FunctionStaticSlicer::computeRCi(InsInfo *insInfoi, InsInfo *insInfoj) {
     ij = insInfoi;
   }
 
-  ValSet::const_iterator I, E;
-
   /* Backward: {v| v \in RC(j), v \notin DEF(i)} */
   /* Forward:  {v| v \in RC(i), v \notin DEF(j)} */
-  for (I = ij->RC_begin(), E = ij->RC_end(); I != E; I++) {
-    const Value *RCj = *I;
-#ifdef DEBUG_RC
-    errs() << "\tRC";
-    RCj->print(errs());
-    // printVal(RCj);
-    errs() << ": ";
-#endif
-    bool in_DEF = false;
-    for (ValSet::const_iterator II = ii->DEF_begin(),
-        EE = ii->DEF_end(); II != EE; II++)
-      if (sameValues(*II, RCj)) {
-        in_DEF = true;
-        break;
-      }
-    if (!in_DEF) {
-#ifdef DEBUG_RC
-      errs() << "Kept\n";
-#endif
-      if (ii->addRC(RCj)) {
-        changed = true;
-      }
-    }
-    else {
-#ifdef DEBUG_RC
-      errs() << "Removed\n";
-#endif
-    }
-  }
+  bool changed = ii->uniteRC(ij->getRC(), &ii->getDEF());
 
   /* Backward: DEF(i) \cap RC(j) \neq \emptyset */
   /* Forward: REF(j) \cap RC(i) \neq \emptyset */
-  bool isect_nonempty = false;
-  if (!forward) {
-    I = ii->DEF_begin();
-    E = ii->DEF_end();
-  }
-  else {
-    I = ii->REF_begin();
-    E = ii->REF_end();
-  }
-  for (; I != E && !isect_nonempty; I++) {
-    const Value *VALi = *I; // VAL could be DEF or REF
-    for (ValSet::const_iterator II = ij->RC_begin(),
-        EE = ij->RC_end(); II != EE; II++) {
-      if (sameValues(VALi, *II)) {
-        isect_nonempty = true;
-        break;
-      }
-    }
-  }
-
-  /* Backward: {v| v \in REF(i), ...} */
-  /* Forward:  {v| v \in DEF(j), ...} */
-  if (!forward) {
-    I = ii->REF_begin();
-    E = ii->REF_end();
-  }
-  else {
-    I = ii->DEF_begin();
-    E = ii->DEF_end();
-  }
-  if (isect_nonempty) {
-    for (; I != E; I++)
-      if (ii->addRC(*I)) {
-        changed = true;
-#ifdef DEBUG_RC
-        errs() << "\tRC"; 
-        // printVal(*I);
-        (*I)->print(errs());
-        errs() << ": Added \n";
-#endif
-      }
+  const ValSet &VALi = forward ? ii->getREF() : ii->getDEF();
+  if (VALi.intersects(ij->getRC())) {
+    /* Backward: {v| v \in REF(i), ...} */
+    /* Forward:  {v| v \in DEF(j), ...} */
+    if (ii->uniteRC(forward ? ii->getDEF() : ii->getREF()))
+      changed = true;
   }
   return changed;
 }
 
 /*
- * Backward, Forward: get successors
- * 
+ * Backward: predecessors, whose RC depend on RC(i)
+ * Forward:  successors
  */
-bool FunctionStaticSlicer::computeRCi(InsInfo *insInfoi) {
-  const Instruction *i = insInfoi->getIns();
-  bool changed = false;
-  SuccList succList = getSuccList(i);
-  SuccList::const_iterator I = succList.begin(), E = succList.end();
-  for (;I != E; I++)
-    changed |= computeRCi(insInfoi, getInsInfo(*I));
-  return changed;
+void FunctionStaticSlicer::flowTargets(unsigned i,
+    SmallVectorImpl<unsigned> &targets) const {
+  const BasicBlock *bb = infos[i].getIns()->getParent();
+  if (forward) {
+    if (!lastInBlock(infos, ninfos, i)) {
+      targets.push_back(i + 1);
+      return;
+    }
+    for (succ_const_iterator I = succ_begin(bb), E = succ_end(bb); I != E; I++)
+      targets.push_back(blockStart.lookup(*I));
+  }
+  else {
+    if (i != blockStart.lookup(bb)) {
+      targets.push_back(i - 1);
+      return;
+    }
+    for (const_pred_iterator I = pred_begin(bb), E = pred_end(bb); I != E; I++)
+      targets.push_back(insIds.lookup(&(*I)->back()));
+  }
 }
 
 /*
  * Backward: Bottom-up
  * Forward:  Top-down
  *
+ * Only the instructions whose RC changed are propagated again, to their
+ * predecessors (backward) or successors (forward). The worklist is a
+ * stack seeded in the sweep order, so a change is followed along the
+ * flow first, the way a sweep would carry it.
  */
 void FunctionStaticSlicer::computeRC() {
-  bool changed;
-#ifdef DEBUG_RC
-  int it = 1;
-#endif
-  do {
-    changed = false;
-#ifdef DEBUG_RC
-    errs() << "======BEG RC Iteration " << it << "======\n";
-#endif
-    if (!forward) { // backward slicing, work on in bottom-up fashion
-      typedef std::reverse_iterator<Function::iterator> revFun;
-      for (revFun I = revFun(fun.end()), E = revFun(fun.begin()); I != E; I++) {
-        typedef std::reverse_iterator<BasicBlock::iterator> rev;
-        InsInfo *past = NULL;
-        for (rev II = rev(I->end()), EE = rev(I->begin()); II != EE; ++II) {
-          InsInfo *insInfo = getInsInfo(&*II);
-          if (!past)
-            changed |= computeRCi(insInfo);
-          else
-            changed |= computeRCi(insInfo, past);
-          past = insInfo;
-        }
-      }
-    } 
-    else { // forward slicing, work on in top-down fashion
-      Function::iterator FI, FE;
-      for (FI = fun.begin(), FE = fun.end(); FI != FE; ++FI) {
-        BasicBlock::iterator BI = FI->begin(), BE = FI->end();
-        if (BI == BE) // empty block
-          continue;
-        InsInfo *past = getInsInfo(&*BI);
-        BI++;
-        for (; BI != BE; ++BI) {
-          InsInfo *insInfo = getInsInfo(&*BI);
-          changed |= computeRCi(past, insInfo);
-          past = insInfo;
-        }
-        changed |= computeRCi(past);
+  std::vector<unsigned> work;
+  std::vector<bool> queued(ninfos, false);
+  // Nothing flows out of an empty RC
+  for (unsigned k = 0; k < ninfos; ++k) {
+    unsigned i = forward ? ninfos - 1 - k : k;
+    if (!infos[i].getRC().empty()) {
+      work.push_back(i);
+      queued[i] = true;
+    }
+  }
+  unsigned visits = 0;
+  bool grew = false;
+  SmallVector<unsigned, 4> targets;
+  while (!work.empty()) {
+    unsigned i = work.back();
+    work.pop_back();
+    queued[i] = false;
+    visits++;
+    targets.clear();
+    flowTargets(i, targets);
+    for (SmallVectorImpl<unsigned>::iterator I = targets.begin(),
+        E = targets.end(); I != E; ++I) {
+      unsigned j = *I;
+      bool changed = forward ? computeRCi(&infos[i], &infos[j]) :
+        computeRCi(&infos[j], &infos[i]);
+      if (!changed)
+        continue;
+      grew = true;
+      if (!queued[j]) {
+        work.push_back(j);
+        queued[j] = true;
       }
     }
+  }
 #ifdef DEBUG_RC
-    errs() << "======END RC Iteration " << it << "======\n";
-    it++;
+  errs() << "RC of '" << fun.getName() << "': " << visits << " visits for " <<
+    ninfos << " instructions\n";
 #endif
-  } while (changed);
+  __sync_fetch_and_add(&RCVisits, (uint64_t) visits);
+  // A sweep goes over every instruction once more to see nothing changes
+  __sync_fetch_and_add(&RCSweepEstimate, (uint64_t) (grew ? 2 * ninfos : ninfos));
 }
 
 /*
@@ -513,41 +520,25 @@ void FunctionStaticSlicer::computeRC() {
  * * SC(j)={j| REF(j) \cap RC(i) \neq \emptyset}
  *
  */
-void FunctionStaticSlicer::computeSCi(const Instruction *i, const Instruction *j) {
-
-  InsInfo *insInfoi, *insInfoj;
-  ValSet::const_iterator I, E;
+void FunctionStaticSlicer::computeSCi(InsInfo *insInfoi, InsInfo *insInfoj) {
+  InsInfo *ii, *ij;
   if (!forward) { // backward
-    insInfoi = getInsInfo(i);
-    insInfoj = getInsInfo(j);
-    I = insInfoi->DEF_begin();
-    E = insInfoi->DEF_end();
+    ii = insInfoi;
+    ij = insInfoj;
   }
   else {
-    insInfoj = getInsInfo(i);
-    insInfoi = getInsInfo(j);
-    I = insInfoi->REF_begin();
-    E = insInfoi->REF_end();
+    ii = insInfoj;
+    ij = insInfoi;
   }
 
-  bool isect_nonempty = false;
-  for (; I != E && !isect_nonempty; I++) {
-    const Value *VALi = *I; //VALi could be DEF or REF
-    for (ValSet::const_iterator II = insInfoj->RC_begin(),
-        EE = insInfoj->RC_end(); II != EE; II++) {
-      if (sameValues(VALi, *II)) {
+  const ValSet &VALi = forward ? ii->getREF() : ii->getDEF();
+  if (VALi.intersects(ij->getRC())) {
 #ifdef DEBUG_SC
-        errs() << "\tRC: ";
-        printVal(*II);
-        errs() << " is referenced by ";
-        i->print(errs());
-        errs() << "\n";
+    errs() << "\tRC is referenced by ";
+    ii->getIns()->print(errs());
+    errs() << "\n";
 #endif
-        isect_nonempty = true;
-        insInfoi->deslice();
-        break;
-      }
-    }
+    ii->deslice();
   }
 }
 
@@ -555,12 +546,14 @@ void FunctionStaticSlicer::computeSCi(const Instruction *i, const Instruction *j
  * Backward, Forward: iterate every instruction and its successors
  */
 void FunctionStaticSlicer::computeSC() {
-  for (inst_iterator I = inst_begin(fun), E = inst_end(fun); I != E; I++) {
-    const Instruction *i = &*I;
-    SuccList succList = getSuccList(i);
-    for (SuccList::const_iterator II = succList.begin(), EE = succList.end();
-        II != EE; II++)
-      computeSCi(i, *II);
+  for (unsigned i = 0; i < ninfos; ++i) {
+    if (!lastInBlock(infos, ninfos, i)) {
+      computeSCi(&infos[i], &infos[i + 1]);
+      continue;
+    }
+    const BasicBlock *bb = infos[i].getIns()->getParent();
+    for (succ_const_iterator I = succ_begin(bb), E = succ_end(bb); I != E; I++)
+      computeSCi(&infos[i], &infos[blockStart.lookup(*I)]);
   }
 }
 
@@ -574,20 +567,21 @@ bool FunctionStaticSlicer::computeBC() {
   errs() << " ====== BEG BC Computation ======\n";
 #endif
   if (!forward) {
-    PostDominanceFrontier &PDF = MP->getAnalysis<PostDominanceFrontier>(fun);
-    for (inst_iterator I = inst_begin(fun), E = inst_end(fun); I != E; I++) {
-      Instruction *i = &*I;
-      const InsInfo *ii = getInsInfo(i);
+    prepare();
+    for (unsigned k = 0; k < ninfos; ++k) {
+      const InsInfo *ii = &infos[k];
       if (ii->isSliced())
         continue;
-      BasicBlock *BB = i->getParent();
+      const Instruction *i = ii->getIns();
+      BasicBlock *BB = const_cast<BasicBlock *>(i->getParent());
 #ifdef DEBUG_BC
       errs() << "  ";
       i->print(errs());
       errs() << " -> bb=" << BB->getName() << '\n';
 #endif
-      PostDominanceFrontier::const_iterator frontier = PDF.find(BB);
-      if (frontier == PDF.end())
+      PostDominanceFrontier::DomSetMapType::const_iterator frontier =
+        frontiers.find(BB);
+      if (frontier == frontiers.end())
         continue;
       changed |= updateRCSC(frontier->second.begin(), frontier->second.end());
     }
@@ -609,20 +603,13 @@ bool FunctionStaticSlicer::computeBC() {
         BasicBlock * Pred = BB->getUniquePredecessor();
         if (Pred == NULL)
           continue;
-        for (BasicBlock::iterator BI = BB->begin(), BE = BB->end(); BI != BE; BI++) {
-          InsInfo *bii = getInsInfo(&*BI);
+        for (unsigned k = blockStart.lookup(BB); ; ++k) {
+          InsInfo *bii = &infos[k];
           bii->deslice();
-          for (ValSet::const_iterator VI = bii->DEF_begin(), VE = bii->DEF_end();
-            VI != VE; VI++) {
-            if (bii->addRC(*VI)) {
-              changed = true;
-#ifdef DEBUG_RC
-              errs() << "  added ";
-              printVal(*VI); 
-              errs() << "\n";
-#endif
-            }
-          }
+          if (bii->uniteRC(bii->getDEF()))
+            changed = true;
+          if (lastInBlock(infos, ninfos, k))
+            break;
         }
       }
     }
@@ -652,14 +639,8 @@ bool FunctionStaticSlicer::updateRCSC(
 #endif
     ii->deslice();
     /* RC = ... \cup \cup(b \in BC) RB */
-    for (ValSet::const_iterator II = ii->REF_begin(), EE = ii->REF_end();
-        II != EE; II++)
-      if (ii->addRC(*II)) {
-        changed = true;
-#ifdef DEBUG_RC
-        errs() << "  added " << (*II)->getName() << "\n";
-#endif
-      }
+    if (ii->uniteRC(ii->getREF()))
+      changed = true;
   }
 #ifdef DEBUG_RC
   errs() << __func__ << " ============ END: changed=" << changed << "\n";
@@ -785,9 +766,9 @@ bool FunctionStaticSlicer::slice() {
   bool removed = false;
   for (inst_iterator I = inst_begin(fun), E = inst_end(fun); I != E;) {
     Instruction &i = *I;
-    InsInfoMap::iterator ii_iter = insInfoMap.find(&i);
-    assert(ii_iter != insInfoMap.end());
-    const InsInfo *ii = ii_iter->second;
+    DenseMap<const Instruction *, unsigned>::iterator ii_iter = insIds.find(&i);
+    assert(ii_iter != insIds.end());
+    const InsInfo *ii = &infos[ii_iter->second];
     ++I;
     if (ii->isSliced() && canSlice(i)) {
 #ifdef DEBUG_SLICE
@@ -797,8 +778,7 @@ bool FunctionStaticSlicer::slice() {
 #endif
       i.replaceAllUsesWith(UndefValue::get(i.getType()));
       i.eraseFromParent();
-      insInfoMap.erase(ii_iter);
-      delete ii;
+      insIds.erase(ii_iter);
 
       removed = true;
     }
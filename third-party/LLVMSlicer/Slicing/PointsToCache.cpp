@@ -0,0 +1,697 @@
+/**
+ *  @file          PointsToCache.cpp
+ *
+ *  @version       1.0
+ *  @created       05/24/2013 03:40:12 PM
+ *  @revision      $Id$
+ *
+ *  @author        Ryan Huang <ryanhuang@cs.ucsd.edu>
+ *  @organization  University of California, San Diego
+ *
+ *  Copyright (c) 2013, Ryan Huang
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  @section       DESCRIPTION
+ *
+ *  Persistent points-to sets, Modifies and rules implementation
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/IntrinsicInst.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "commons/FunctionHash.h"
+#include "llvmslicer/PointsToCache.h"
+
+// #define DEBUG_PTCACHE
+
+// Constants are rarely used further than this from an instruction or a
+// global
+#define MAX_PATH_DEPTH 4
+
+// Value of the missing rvalue of a DEALLOC rule
+#define NO_VALUE ((uint32_t) -1)
+
+namespace llvm { namespace slicing {
+
+namespace {
+
+  typedef ptr::ProgramStructure::FunctionRules FunctionRules;
+
+  enum ValueKind {GlobalKind = 1, LocalKind};
+
+  struct CacheHeader {
+    char magic[POINTSTO_CACHE_MAGIC_LEN];
+    uint32_t version;
+    uint32_t nnames;
+    uint64_t key;
+    uint64_t funcs; // offset of the function records in the file
+    uint32_t nvalues;
+    uint32_t nsets;
+    uint32_t nmods;
+    uint32_t nfuncs;
+    uint32_t solved;
+    uint32_t pad;
+  };
+
+  struct ValueHeader {
+    uint32_t kind;
+    uint32_t name; // of the global value, or of the function of a local
+    uint32_t local;
+    uint32_t npath;
+  };
+
+  struct FunctionHeader {
+    uint32_t name;
+    uint32_t nvalues;
+    uint64_t hash;
+    uint32_t nrules;
+    uint32_t pad;
+  };
+
+  struct RuleRecord {
+    uint32_t type;
+    uint32_t lvalue;
+    uint32_t rvalue;
+  };
+
+  /// Positions of the values of a module, see PointsToCache.h
+  class ModuleLayout {
+    public:
+      explicit ModuleLayout(const Module &M) : M(M), numbered(NULL) {}
+
+      /// Base of V and the operands that lead from it to V, false if V
+      /// can't be located. Given a scope, constants are only located from
+      /// the instructions of the scope, and locals of other functions not
+      /// at all.
+      bool locate(const Value *V, const Function *scope, const GlobalValue *&base,
+          ValueHeader &vh, std::vector<uint32_t> &path);
+
+      /// The value at a position from base, NULL if there is none
+      const Value *resolve(const GlobalValue *base, const ValueHeader &vh,
+          const std::vector<uint32_t> &path);
+
+    private:
+      typedef std::pair<uint32_t, std::vector<uint32_t> > ScopedConstant;
+
+      const Module &M;
+      std::map<const Function *, std::vector<const Value *> > locals;
+      DenseMap<const Value *, uint32_t> positions; // of the numbered locals
+      const Function *numbered; // scope of constants
+      DenseMap<const Constant *, ScopedConstant> constants;
+
+      const std::vector<const Value *> &localsOf(const Function *F);
+      void numberConstants(const Function *F);
+      void numberOperands(const User *U, uint32_t local, unsigned depth,
+          std::vector<uint32_t> &path);
+      bool locateBase(const Value *V, const Function *scope,
+          const GlobalValue *&base, ValueHeader &vh);
+      bool locateConstant(const Constant *C, unsigned depth,
+          const GlobalValue *&base, ValueHeader &vh, std::vector<uint32_t> &path);
+  };
+
+  /// Names of the global values the values refer to, numbered as they
+  /// are met
+  class NameTable {
+    public:
+      uint32_t add(const GlobalValue *GV);
+      bool write(FILE *fp) const;
+      uint32_t size() const { return names.size(); }
+
+    private:
+      DenseMap<const GlobalValue *, uint32_t> ids;
+      std::vector<StringRef> names;
+  };
+
+  /// Values of the sets or rules being saved, numbered as they are met
+  class ValueWriter {
+    public:
+      ValueWriter(ModuleLayout &L, NameTable &N, const Function *scope = NULL) :
+        layout(&L), names(&N), scope(scope) {}
+
+      bool add(const Value *V, uint32_t &id);
+      bool write(FILE *fp) const;
+      uint32_t size() const { return headers.size(); }
+
+    private:
+      ModuleLayout *layout;
+      NameTable *names;
+      const Function *scope;
+      DenseMap<const Value *, uint32_t> ids;
+      std::vector<ValueHeader> headers;
+      std::vector<std::vector<uint32_t> > paths;
+  };
+
+  /// Rules of a function being saved
+  struct FunctionRecord {
+    FunctionHeader header;
+    ValueWriter values;
+    std::vector<RuleRecord> rules;
+
+    FunctionRecord(ModuleLayout &L, NameTable &N, const Function *F) :
+      values(L, N, F)
+    {
+      memset(&header, 0, sizeof(header));
+      header.name = N.add(F);
+      header.hash = hashFunction(F);
+    }
+  };
+
+}
+
+/// Arguments, blocks and instructions but debug info, as hashFunction
+/// numbers them
+const std::vector<const Value *> & ModuleLayout::localsOf(const Function *F)
+{
+  std::map<const Function *, std::vector<const Value *> >::iterator I = locals.find(F);
+  if (I != locals.end())
+    return I->second;
+  std::vector<const Value *> &L = locals[F];
+  for (Function::const_arg_iterator AI = F->arg_begin(), AE = F->arg_end();
+      AI != AE; ++AI)
+    L.push_back(AI);
+  for (Function::const_iterator BI = F->begin(), BE = F->end(); BI != BE; ++BI) {
+    L.push_back(BI);
+    for (BasicBlock::const_iterator II = BI->begin(), IE = BI->end(); II != IE; ++II)
+      if (!isa<DbgInfoIntrinsic>(II))
+        L.push_back(II);
+  }
+  for (uint32_t i = 0; i < L.size(); ++i)
+    positions[L[i]] = i;
+  return L;
+}
+
+/// Number the constants the instructions of F use, by the first local
+/// and operands that lead to them
+void ModuleLayout::numberConstants(const Function *F)
+{
+  if (numbered == F)
+    return;
+  numbered = F;
+  constants.clear();
+  const std::vector<const Value *> &L = localsOf(F);
+  std::vector<uint32_t> path;
+  for (uint32_t i = 0; i < L.size(); ++i)
+    if (const Instruction *I = dyn_cast<Instruction>(L[i]))
+      numberOperands(I, i, 0, path);
+}
+
+void ModuleLayout::numberOperands(const User *U, uint32_t local, unsigned depth,
+    std::vector<uint32_t> &path)
+{
+  for (unsigned i = 0; i < U->getNumOperands(); ++i) {
+    const Constant *C = dyn_cast<Constant>(U->getOperand(i));
+    if (C == NULL || isa<GlobalValue>(C))
+      continue;
+    path.push_back(i);
+    if (constants.insert(std::make_pair(C, ScopedConstant(local, path))).second &&
+        depth < MAX_PATH_DEPTH)
+      numberOperands(C, local, depth + 1, path);
+    path.pop_back();
+  }
+}
+
+bool ModuleLayout::locateBase(const Value *V, const Function *scope,
+    const GlobalValue *&base, ValueHeader &vh)
+{
+  if (const GlobalValue *GV = dyn_cast<GlobalValue>(V)) {
+    if (!GV->hasName() || GV->getParent() != &M)
+      return false;
+    base = GV;
+    vh.kind = GlobalKind;
+    vh.local = 0;
+    return true;
+  }
+  const Function *F = NULL;
+  if (const Argument *A = dyn_cast<Argument>(V))
+    F = A->getParent();
+  else if (const BasicBlock *BB = dyn_cast<BasicBlock>(V))
+    F = BB->getParent();
+  else if (const Instruction *I = dyn_cast<Instruction>(V))
+    F = I->getParent() ? I->getParent()->getParent() : NULL;
+  // Locals of another module may share the context
+  if (F == NULL || F->getParent() != &M || !F->hasName() || (scope && F != scope))
+    return false;
+  localsOf(F);
+  DenseMap<const Value *, uint32_t>::iterator P = positions.find(V);
+  if (P == positions.end()) // debug info
+    return false;
+  base = F;
+  vh.kind = LocalKind;
+  vh.local = P->second;
+  return true;
+}
+
+/// Find a user of C that has a position, and the operands that lead from
+/// it to C
+bool ModuleLayout::locateConstant(const Constant *C, unsigned depth,
+    const GlobalValue *&base, ValueHeader &vh, std::vector<uint32_t> &path)
+{
+  for (Value::const_use_iterator UI = C->use_begin(), UE = C->use_end(); UI != UE; ++UI) {
+    const User *U = *UI;
+    if (!isa<Constant>(U) || isa<GlobalValue>(U)) {
+      if (locateBase(U, NULL, base, vh)) {
+        path.push_back(UI.getOperandNo());
+        return true;
+      }
+    }
+  }
+  if (depth >= MAX_PATH_DEPTH)
+    return false;
+  for (Value::const_use_iterator UI = C->use_begin(), UE = C->use_end(); UI != UE; ++UI) {
+    const Constant *CU = dyn_cast<Constant>(*UI);
+    if (CU == NULL || isa<GlobalValue>(CU))
+      continue;
+    if (locateConstant(CU, depth + 1, base, vh, path)) {
+      path.push_back(UI.getOperandNo());
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ModuleLayout::locate(const Value *V, const Function *scope,
+    const GlobalValue *&base, ValueHeader &vh, std::vector<uint32_t> &path)
+{
+  path.clear();
+  vh.npath = 0;
+  if (locateBase(V, scope, base, vh))
+    return true;
+  const Constant *C = dyn_cast<Constant>(V);
+  if (C == NULL)
+    return false;
+  if (scope) {
+    numberConstants(scope);
+    DenseMap<const Constant *, ScopedConstant>::iterator I = constants.find(C);
+    if (I == constants.end())
+      return false;
+    base = scope;
+    vh.kind = LocalKind;
+    vh.local = I->second.first;
+    path = I->second.second;
+  }
+  else if (!locateConstant(C, 0, base, vh, path))
+    return false;
+  vh.npath = path.size();
+  return true;
+}
+
+const Value * ModuleLayout::resolve(const GlobalValue *base, const ValueHeader &vh,
+    const std::vector<uint32_t> &path)
+{
+  if (base == NULL)
+    return NULL;
+  const Value *V = base;
+  if (vh.kind == LocalKind) {
+    const Function *F = dyn_cast<Function>(base);
+    if (F == NULL)
+      return NULL;
+    const std::vector<const Value *> &L = localsOf(F);
+    if (vh.local >= L.size())
+      return NULL;
+    V = L[vh.local];
+  }
+  else if (vh.kind != GlobalKind)
+    return NULL;
+  for (std::vector<uint32_t>::const_iterator I = path.begin(), E = path.end();
+      I != E; ++I) {
+    const User *U = dyn_cast<User>(V);
+    if (U == NULL || *I >= U->getNumOperands())
+      return NULL;
+    V = U->getOperand(*I);
+  }
+  return V;
+}
+
+uint32_t NameTable::add(const GlobalValue *GV)
+{
+  std::pair<DenseMap<const GlobalValue *, uint32_t>::iterator, bool> r =
+    ids.insert(std::make_pair(GV, (uint32_t) names.size()));
+  if (r.second)
+    names.push_back(GV->getName());
+  return r.first->second;
+}
+
+bool NameTable::write(FILE *fp) const
+{
+  for (std::vector<StringRef>::const_iterator I = names.begin(), E = names.end();
+      I != E; ++I) {
+    uint32_t n = I->size();
+    if (fwrite(&n, sizeof(n), 1, fp) != 1 || fwrite(I->data(), 1, n, fp) != n)
+      return false;
+  }
+  return true;
+}
+
+bool ValueWriter::add(const Value *V, uint32_t &id)
+{
+  DenseMap<const Value *, uint32_t>::iterator I = ids.find(V);
+  if (I != ids.end()) {
+    id = I->second;
+    return true;
+  }
+  const GlobalValue *base;
+  ValueHeader vh;
+  std::vector<uint32_t> path;
+  if (!layout->locate(V, scope, base, vh, path)) {
+#ifdef DEBUG_PTCACHE
+    errs() << "Cannot locate ";
+    V->print(errs());
+    errs() << "\n";
+#endif
+    return false;
+  }
+  vh.name = names->add(base);
+  id = headers.size();
+  ids[V] = id;
+  headers.push_back(vh);
+  paths.push_back(path);
+  return true;
+}
+
+bool ValueWriter::write(FILE *fp) const
+{
+  for (uint32_t i = 0; i < headers.size(); ++i) {
+    const ValueHeader &vh = headers[i];
+    if (fwrite(&vh, sizeof(vh), 1, fp) != 1 ||
+        (vh.npath && fwrite(&paths[i][0], sizeof(uint32_t), vh.npath, fp) != vh.npath))
+      return false;
+  }
+  return true;
+}
+
+static bool writeIds(FILE *fp, const std::vector<uint32_t> &ids)
+{
+  return ids.empty() || fwrite(&ids[0], sizeof(uint32_t), ids.size(), fp) == ids.size();
+}
+
+/// The sets of a container as {key, n, n x value} records
+template<typename Container>
+static bool collect(const Container &C, ValueWriter &values,
+    std::vector<uint32_t> &out)
+{
+  for (typename Container::const_iterator I = C.begin(), E = C.end(); I != E; ++I) {
+    uint32_t id;
+    if (!values.add(I->first, id))
+      return false;
+    out.push_back(id);
+    out.push_back(I->second.size());
+    for (typename Container::mapped_type::const_iterator VI = I->second.begin(),
+        VE = I->second.end(); VI != VE; ++VI) {
+      if (!values.add(*VI, id))
+        return false;
+      out.push_back(id);
+    }
+  }
+  return true;
+}
+
+static bool collectRules(const ptr::ProgramStructure::Container &C, FunctionRecord &R)
+{
+  for (ptr::ProgramStructure::const_iterator I = C.begin(), E = C.end(); I != E; ++I) {
+    RuleRecord rec;
+    rec.type = I->getType();
+    if (!R.values.add(I->getLvalue(), rec.lvalue))
+      return false;
+    if (I->getRvalue() == NULL)
+      rec.rvalue = NO_VALUE;
+    else if (!R.values.add(I->getRvalue(), rec.rvalue))
+      return false;
+    R.rules.push_back(rec);
+  }
+  return true;
+}
+
+static bool writeFunction(FILE *fp, const FunctionRecord &R)
+{
+  FunctionHeader header = R.header;
+  header.nvalues = R.values.size();
+  header.nrules = R.rules.size();
+  return fwrite(&header, sizeof(header), 1, fp) == 1 && R.values.write(fp) &&
+    (R.rules.empty() ||
+     fwrite(&R.rules[0], sizeof(RuleRecord), R.rules.size(), fp) == R.rules.size());
+}
+
+bool savePointsToCache(const char *fname, const Module &M, uint64_t key,
+    const ptr::PointsToSets &PS, const mods::Modifies &MOD,
+    const FunctionRules *rules)
+{
+  ModuleLayout layout(M);
+  NameTable names;
+  ValueWriter values(layout, names);
+  std::vector<uint32_t> sets, mods;
+  bool solved = collect(PS.getContainer(), values, sets) &&
+    collect(MOD.getContainer(), values, mods);
+  if (!solved) { // the rules are still worth keeping
+    values = ValueWriter(layout, names);
+    sets.clear();
+    mods.clear();
+  }
+  std::list<FunctionRecord> funcs;
+  if (rules) {
+    for (FunctionRules::const_iterator I = rules->begin(), E = rules->end();
+        I != E; ++I) {
+      if (I->first->isDeclaration() || !I->first->hasName())
+        continue;
+      funcs.push_back(FunctionRecord(layout, names, I->first));
+      if (!collectRules(I->second, funcs.back()))
+        funcs.pop_back();
+    }
+  }
+  if (!solved && funcs.empty())
+    return false;
+
+  // Write a temporary and rename it, so that a crash or a concurrent
+  // run never sees a partial cache
+  std::string tmp = std::string(fname) + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (fp == NULL) {
+    perror("Write points-to cache");
+    return false;
+  }
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, POINTSTO_CACHE_MAGIC, POINTSTO_CACHE_MAGIC_LEN);
+  header.version = POINTSTO_CACHE_VERSION;
+  header.nnames = names.size();
+  header.key = key;
+  header.nvalues = values.size();
+  header.nsets = solved ? PS.getContainer().size() : 0;
+  header.nmods = solved ? MOD.getContainer().size() : 0;
+  header.nfuncs = funcs.size();
+  header.solved = solved;
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 && names.write(fp) &&
+    values.write(fp) && writeIds(fp, sets) && writeIds(fp, mods);
+  long offset = ok ? ftell(fp) : -1;
+  ok = offset >= 0;
+  for (std::list<FunctionRecord>::const_iterator I = funcs.begin(), E = funcs.end();
+      ok && I != E; ++I)
+    ok = writeFunction(fp, *I);
+  // The header again, now that the offset of the functions is known
+  header.funcs = offset;
+  ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+  if (fclose(fp) != 0)
+    ok = false;
+  if (!ok || rename(tmp.c_str(), fname) != 0) {
+    perror("Write points-to cache");
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool asKey(const Value *V, const Value *&key)
+{
+  key = V;
+  return true;
+}
+
+static bool asKey(const Value *V, const Function *&key)
+{
+  key = dyn_cast<Function>(V);
+  return key != NULL;
+}
+
+/// Read n {key, n, n x value} records of resolved values into C
+template<typename Container>
+static bool readSets(FILE *fp, uint32_t n, const std::vector<const Value *> &values,
+    Container &C)
+{
+  for (uint32_t i = 0; i < n; ++i) {
+    uint32_t key, size;
+    if (fread(&key, sizeof(key), 1, fp) != 1 || fread(&size, sizeof(size), 1, fp) != 1 ||
+        key >= values.size())
+      return false;
+    typename Container::key_type k;
+    if (!asKey(values[key], k))
+      return false;
+    typename Container::mapped_type &S = C[k];
+    std::vector<uint32_t> ids(size);
+    if (size && fread(&ids[0], sizeof(uint32_t), size, fp) != size)
+      return false;
+    for (std::vector<uint32_t>::const_iterator I = ids.begin(), E = ids.end(); I != E; ++I) {
+      if (*I >= values.size())
+        return false;
+      S.insert(values[*I]);
+    }
+  }
+  return true;
+}
+
+/// Read n names and the global values of M they name, NULL if none
+static bool readNames(FILE *fp, uint32_t n, const Module &M,
+    std::vector<const GlobalValue *> &globals)
+{
+  std::string name;
+  for (uint32_t i = 0; i < n; ++i) {
+    uint32_t len;
+    if (fread(&len, sizeof(len), 1, fp) != 1)
+      return false;
+    name.resize(len);
+    if (len && fread(&name[0], 1, len, fp) != len)
+      return false;
+    globals.push_back(M.getNamedValue(name));
+  }
+  return true;
+}
+
+/// Read n value records and resolve them against layout, NULL for the
+/// ones that can't be. They are only skipped without a layout.
+static bool readValues(FILE *fp, uint32_t n, const std::vector<const GlobalValue *> &globals,
+    ModuleLayout *layout, std::vector<const Value *> &values)
+{
+  std::vector<uint32_t> path;
+  for (uint32_t i = 0; i < n; ++i) {
+    ValueHeader vh;
+    if (fread(&vh, sizeof(vh), 1, fp) != 1)
+      return false;
+    path.resize(vh.npath);
+    if (vh.npath && fread(&path[0], sizeof(uint32_t), vh.npath, fp) != vh.npath)
+      return false;
+    const Value *V = NULL;
+    if (layout && vh.name < globals.size())
+      V = layout->resolve(globals[vh.name], vh, path);
+    values.push_back(V);
+  }
+  return true;
+}
+
+static bool complete(const std::vector<const Value *> &values)
+{
+  return std::find(values.begin(), values.end(), (const Value *) NULL) == values.end();
+}
+
+/// Read n function records and keep the rules of those functions of M
+/// that still have the hash they were saved with
+static bool readFunctions(FILE *fp, uint32_t n, const std::vector<const GlobalValue *> &globals,
+    ModuleLayout &layout, FunctionRules &rules)
+{
+  for (uint32_t i = 0; i < n; ++i) {
+    FunctionHeader fh;
+    if (fread(&fh, sizeof(fh), 1, fp) != 1)
+      return false;
+    const Function *F = NULL;
+    if (fh.name < globals.size())
+      F = dyn_cast_or_null<Function>(globals[fh.name]);
+    // The locals of a function that changed are not the ones saved
+    bool same = F && !F->isDeclaration() && hashFunction(F) == fh.hash;
+    std::vector<const Value *> values;
+    if (!readValues(fp, fh.nvalues, globals, same ? &layout : NULL, values))
+      return false;
+    std::vector<RuleRecord> records(fh.nrules);
+    if (fh.nrules && fread(&records[0], sizeof(RuleRecord), fh.nrules, fp) != fh.nrules)
+      return false;
+    if (!same || !complete(values))
+      continue;
+    ptr::ProgramStructure::Container C;
+    for (std::vector<RuleRecord>::const_iterator I = records.begin(), E = records.end();
+        I != E; ++I) {
+      if (I->type == ptr::RCT_UNKNOWN || I->type > ptr::RCT_DEALLOC ||
+          I->lvalue >= values.size() ||
+          (I->rvalue != NO_VALUE && I->rvalue >= values.size())) {
+        same = false;
+        break;
+      }
+      C.push_back(ptr::RuleCode((ptr::RuleCodeType) I->type, values[I->lvalue],
+            I->rvalue == NO_VALUE ? NULL : values[I->rvalue]));
+    }
+    if (same)
+      rules[F].swap(C);
+  }
+  return true;
+}
+
+bool loadPointsToCache(const char *fname, const Module &M, uint64_t key,
+    ptr::PointsToSets &PS, mods::Modifies &MOD, FunctionRules *rules)
+{
+  FILE *fp = fopen(fname, "rb");
+  if (fp == NULL) {
+    if (errno != ENOENT) // first run otherwise
+      perror("Open points-to cache");
+    return false;
+  }
+  CacheHeader header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, POINTSTO_CACHE_MAGIC, POINTSTO_CACHE_MAGIC_LEN) != 0 ||
+      header.version != POINTSTO_CACHE_VERSION) {
+    fclose(fp);
+    return false;
+  }
+  bool solved = header.solved && header.key == key;
+  if (!solved && rules == NULL) {
+    fclose(fp);
+    return false;
+  }
+  ModuleLayout layout(M);
+  std::vector<const GlobalValue *> globals;
+  bool ok = readNames(fp, header.nnames, M, globals);
+  if (ok && solved) {
+    std::vector<const Value *> values;
+    ptr::PointsToSets::Container sets;
+    mods::Modifies::Container mods;
+    // A value that can't be resolved means a hash collision
+    if (readValues(fp, header.nvalues, globals, &layout, values) && complete(values) &&
+        readSets(fp, header.nsets, values, sets) &&
+        readSets(fp, header.nmods, values, mods)) {
+      fclose(fp);
+      PS.getContainer().insert(sets.begin(), sets.end());
+      MOD.getContainer().insert(mods.begin(), mods.end());
+      return true;
+    }
+#ifdef DEBUG_PTCACHE
+    errs() << "Points-to cache " << fname << " doesn't match the module\n";
+#endif
+  }
+  // Only the rules of the functions that didn't change are of use
+  FunctionRules found;
+  if (ok && rules && fseek(fp, (long) header.funcs, SEEK_SET) == 0 &&
+      readFunctions(fp, header.nfuncs, globals, layout, found))
+    rules->insert(found.begin(), found.end());
+  fclose(fp);
+  return false;
+}
+
+}}
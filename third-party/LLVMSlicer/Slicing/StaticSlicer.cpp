@@ -10,11 +10,15 @@
 #include "llvm/Pass.h"
 #include "llvm/Value.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Threading.h"
 
 #include "commons/handy.h"
+#include "commons/FunctionHash.h"
+#include "commons/Parallel.h"
 #include "llvmslicer/Callgraph.h"
 #include "llvmslicer/Modifies.h"
 #include "llvmslicer/PointsTo.h"
+#include "llvmslicer/PointsToCache.h"
 #include "llvmslicer/StaticSlicer.h"
 #include "mapper/Matcher.h"
 
@@ -102,11 +106,12 @@ namespace llvm {namespace slicing {
           }
   }
 
-  StaticSlicer::StaticSlicer(bool forward, bool sound) : ModulePass(ID), m_module(NULL), 
+  StaticSlicer::StaticSlicer(bool forward, AliasMode alias) : ModulePass(ID), m_module(NULL), 
     m_forward(forward), m_slicers(), m_initFuns(), m_funcsToCalls(), 
     m_callsToFuncs(), m_ps(NULL), m_cg(NULL), m_mod(NULL), m_criteriaInit(false) 
   {
-    m_sound = sound;
+    m_alias = alias;
+    m_threads = 1;
     m_instInit = false;
     m_funcInit = false;
   }
@@ -129,14 +134,40 @@ namespace llvm {namespace slicing {
     gettimeofday(&atim, NULL);
     at1 = atim.tv_sec * 1000.0 + (atim.tv_usec/1000.0);
     m_ps = new ptr::PointsToSets();
-    {
-      if (m_sound) {
+    m_mod = new mods::Modifies();
+    // The sets depend on the alias mode as much as on the module. If the
+    // module changed, the rules of the functions that didn't are reused.
+    uint64_t hash = 0;
+    bool cached = false;
+    ptr::ProgramStructure::FunctionRules rules;
+    ptr::ProgramStructure::FunctionRules *cachedRules =
+      m_alias == ALIAS_RULES ? &rules : NULL;
+    if (!m_cacheFile.empty()) {
+      hash = hashCombine(hashModule(&M), m_alias);
+      cached = loadPointsToCache(m_cacheFile.c_str(), M, hash, *m_ps, *m_mod,
+          cachedRules);
+#ifdef DEBUG_STATIC_SLICER
+      if (cached)
+        errs() << "Loaded PointsToSet and Modifies from " << m_cacheFile << "\n";
+      else if (!rules.empty())
+        errs() << "Loaded the rules of " << rules.size() << " unchanged functions from "
+          << m_cacheFile << "\n";
+#endif
+    }
+    if (!cached) {
+      if (m_alias == ALIAS_RULES) {
 #ifdef DEBUG_STATIC_SLICER
         errs() << "Computing PointsToSet...\n";
 #endif
-        ptr::ProgramStructure P(M);
+        ptr::ProgramStructure P(M, rules);
         computePointsToSets(P, *m_ps);
       }
+      else if (m_alias == ALIAS_DSA) {
+#ifdef DEBUG_STATIC_SLICER
+        errs() << "Computing PointsToSet from DSA...\n";
+#endif
+        computeDSAPointsToSets(M, getAnalysis<EQTDDataStructures>(), *m_ps);
+      }
       else {
 #ifdef DEBUG_STATIC_SLICER
         errs() << "Skip Building PointsToSet. Quick and Dirty!\n";
@@ -162,10 +193,11 @@ namespace llvm {namespace slicing {
 #endif
     gettimeofday(&atim, NULL);
     at1 = atim.tv_sec * 1000.0 + (atim.tv_usec/1000.0);
-    m_mod = new mods::Modifies();
-    {
+    if (!cached) {
       mods::ProgramStructure P1(M);
       computeModifies(P1, *m_cg, *m_ps, *m_mod);
+      if (!m_cacheFile.empty())
+        savePointsToCache(m_cacheFile.c_str(), M, hash, *m_ps, *m_mod, cachedRules);
     }
     at2 = atim.tv_sec * 1000.0 + (atim.tv_usec/1000.0);
     fprintf(stderr, "%.4f ms\n", at2-at1);
@@ -179,20 +211,7 @@ namespace llvm {namespace slicing {
     at2 = atim.tv_sec * 1000.0 + (atim.tv_usec/1000.0);
     fprintf(stderr, "%.4f ms\n", at2-at1);
 
-#ifdef DEBUG_STATIC_SLICER
-    errs() << "Building FSS...\n";
-#endif
-    gettimeofday(&atim, NULL);
-    at1 = atim.tv_sec * 1000.0 + (atim.tv_usec/1000.0);
-    for (Module::iterator MI = M.begin(), ME = M.end(); MI != ME; ++MI) {
-      Function * f = MI;
-      if (f->isIntrinsic())
-        continue;
-      // errs() << "\t|" << f << "@" << f->getName() << "|\n";
-      newFSS(f);
-    }
-    at2 = atim.tv_sec * 1000.0 + (atim.tv_usec/1000.0);
-    fprintf(stderr, "%.4f ms\n", at2-at1);
+    // The FSS of a function is built by getFSS once the slice reaches it
 
 #ifdef DEBUG_STATIC_SLICER
     errs() << "Initialized.\n";
@@ -224,14 +243,85 @@ namespace llvm {namespace slicing {
   FunctionStaticSlicer * StaticSlicer::getFSS(const Function * F) {
     Slicers::iterator si;
     si = m_slicers.find(F);
-    if (si == m_slicers.end()) {
+    if (si != m_slicers.end())
+      return si->second;
+    if (F->isIntrinsic()) {
       errs() << "No slicer for " << F << "@" << F->getName() << "\n";
       return NULL;
     }
-    // assert(si != m_slicers.end());
-    return si->second;
+    // Computing the DEF and REF of every instruction against the points-to
+    // sets and Modifies is the bulk of the cost of an FSS, so it's only
+    // paid for the functions the slice reaches
+    return newFSS(const_cast<Function *>(F));
   }
   
+  namespace {
+    /// The function slicers of a wave, which only touch their own state
+    class WaveSlicing : public ParallelTask {
+      public:
+        std::vector<FunctionStaticSlicer *> slicers;
+
+        virtual void run(unsigned index, unsigned worker)
+        {
+          slicers[index]->calculateStaticSlice();
+        }
+    };
+  }
+
+  void StaticSlicer::sliceWave(const WorkList &wave)
+  {
+    // Creating the slicers and querying the pass manager stay on this
+    // thread. A function may be in a wave more than once, slicing it
+    // again would find nothing new.
+    WaveSlicing task;
+    std::set<FunctionStaticSlicer *> seen;
+    for (WorkList::const_iterator WI = wave.begin(), WE = wave.end(); WI != WE; ++WI) {
+      const Function * F = *WI;
+      if (F->isIntrinsic()) // skip intrinsic
+        continue;
+      FunctionStaticSlicer *fss = getFSS(F);
+      if (fss == NULL || !seen.insert(fss).second)
+        continue;
+      fss->prepare();
+      task.slicers.push_back(fss);
+    }
+    unsigned threads = llvm_is_multithreaded() ? m_threads : 1;
+    parallel_for(task, task.slicers.size(), threads);
+  }
+
+  void StaticSlicer::reset()
+  {
+    // Only the functions the slice reached have anything to forget
+    for (FuncIter fi = m_initFuns.begin(), fe = m_initFuns.end(); fi != fe; ++fi)
+      if (FunctionStaticSlicer *FSS = getFSS(*fi))
+        FSS->reset();
+    for (FuncIter fi = m_sliceFuncs.begin(), fe = m_sliceFuncs.end(); fi != fe; ++fi)
+      if (FunctionStaticSlicer *FSS = getFSS(*fi))
+        FSS->reset();
+    m_initFuns.clear();
+    m_sliceFuncs.clear();
+    m_criteriaInit = false;
+    m_instInit = false;
+    m_funcInit = false;
+  }
+
+  size_t StaticSlicer::footprint() const
+  {
+    // tree nodes of the sets and maps, and an InsInfo with its bit
+    // vectors and index entry
+    const size_t node = 48, insinfo = 128;
+    size_t bytes = (m_funcsToCalls.size() + m_callsToFuncs.size()) * node;
+    if (m_ps)
+      for (ptr::PointsToSets::const_iterator I = m_ps->begin(), E = m_ps->end(); I != E; ++I)
+        bytes += (1 + I->second.size()) * node;
+    if (m_mod)
+      for (mods::Modifies::const_iterator I = m_mod->begin(), E = m_mod->end(); I != E; ++I)
+        bytes += (1 + I->second.size()) * node;
+    for (Slicers::const_iterator I = m_slicers.begin(), E = m_slicers.end(); I != E; ++I)
+      bytes += node + I->second->size() * insinfo;
+    return bytes;
+  }
+
   void StaticSlicer::addInitRC(FunctionStaticSlicer * FSS, const Instruction *inst)
   {
       if (m_forward) {
@@ -280,13 +370,14 @@ namespace llvm {namespace slicing {
     //   Backward:  UP*({C})
     //   Forward:   DOWN*({C})
 
+    // The functions of a wave are sliced in parallel, what they emit is
+    // merged in wave order, so the slice doesn't depend on the threads
     while (!Q.empty()) {
+      sliceWave(Q);
       for (WorkList::iterator WI = Q.begin(), WE = Q.end(); WI != WE; ++WI) {
         const Function * F = *WI;
         if (F->isIntrinsic()) // skip intrinsic
           continue;
-        FunctionStaticSlicer *fss = getFSS(F);
-        fss->calculateStaticSlice();
         if (setAdd(P, F)) {
           m_sliceFuncs.push_back(F);
         }
@@ -312,12 +403,11 @@ namespace llvm {namespace slicing {
     //     Backward: DOWN*(XXX)
     //     Forward:  UP*(XXX)
     while (!P.empty()) {
+      sliceWave(P);
       for (WorkList::iterator WI = P.begin(), WE = P.end(); WI != WE; ++WI) {
         const Function * F = *WI;
         if (F->isIntrinsic()) // skip intrinsic
           continue;
-        FunctionStaticSlicer *fss = getFSS(F);
-        fss->calculateStaticSlice();
         setAdd(m_sliceFuncs, F);
       }
       WorkList tmp;
@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include "commons/handy.h"
+#include "commons/LLVMHelper.h"
+#include "commons/Parallel.h"
+#include "commons/ProfileDB.h"
+
+using namespace std;
+using namespace llvm;
+
+static char * program_name;
+
+//#define IMPORTER_DEBUG
+
+gen_dbg(import)
+
+#ifdef IMPORTER_DEBUG
+gen_dbg_impl(import)
+#else
+gen_dbg_nop(import)
+#endif
+
+enum InputFormat {AUTO, PERFSCRIPT, FOLDED};
+
+#define CHUNKSIZE 64 // MB of input held in memory at a time
+
+static InputFormat format = AUTO;
+static unsigned jobs = 1;
+static size_t chunk_size = CHUNKSIZE << 20;
+static int topk = -1;
+static uint64_t min_samples = 1;
+
+FILE * fout = stdout;
+char * dbname = NULL; // write a profile database instead of text
+
+typedef StringMap<FuncWeight> SampleMap;
+
+static inline StringRef trimLeft(StringRef s)
+{
+  size_t i = 0;
+  while (i < s.size() && isspace(s[i]))
+    i++;
+  return s.substr(i);
+}
+
+static inline StringRef trimRight(StringRef s)
+{
+  size_t n = s.size();
+  while (n > 0 && isspace(s[n - 1]))
+    n--;
+  return s.substr(0, n);
+}
+
+/// Whether a record starts at p. Every line of a folded stack is a
+/// record. In perf script output, a record is a sample header line
+/// followed by its indented call chain, so records start at lines
+/// that are neither indented nor blank.
+static inline bool isRecordStart(const char * buf, size_t p, InputFormat fmt)
+{
+  if (p > 0 && buf[p - 1] != '\n')
+    return false;
+  if (fmt == FOLDED)
+    return true;
+  return buf[p] != ' ' && buf[p] != '\t' && buf[p] != '\n';
+}
+
+/// Offset of the first record start in buf[from, len), len if none
+static size_t nextRecord(const char * buf, size_t from, size_t len, InputFormat fmt)
+{
+  for (size_t p = from; p < len; ++p) {
+    if (isRecordStart(buf, p, fmt))
+      return p;
+  }
+  return len;
+}
+
+/// Offset of the last record start in buf(0, len), 0 if none
+static size_t lastRecord(const char * buf, size_t len, InputFormat fmt)
+{
+  for (size_t p = len; p-- > 1; ) {
+    if (isRecordStart(buf, p, fmt))
+      return p;
+  }
+  return 0;
+}
+
+/// Guess the format from the first line that isn't a comment: a
+/// folded stack ends with its sample count, a perf script header
+/// ends with the event name.
+static InputFormat guessFormat(const char * buf, size_t len)
+{
+  size_t p = 0;
+  while (p < len) {
+    size_t e = p;
+    while (e < len && buf[e] != '\n')
+      e++;
+    StringRef line = trimRight(StringRef(buf + p, e - p));
+    if (!line.empty() && line[0] != '#') {
+      size_t sp = line.find_last_of(" \t");
+      if (sp != StringRef::npos && sp + 1 < line.size() &&
+          line.substr(sp + 1).find_first_not_of("0123456789") == StringRef::npos)
+        return FOLDED;
+      return PERFSCRIPT;
+    }
+    p = e + 1;
+  }
+  return PERFSCRIPT;
+}
+
+/// Per worker sample counts, merged once the whole input is read
+struct ImportTask : public ParallelTask {
+  InputFormat fmt;
+  const char * buf;
+  vector<size_t> bounds; // records of piece #i are in [bounds[i], bounds[i + 1])
+  vector<SampleMap> samples;
+  vector<uint64_t> records;
+  vector<uint64_t> dropped; // samples without a usable call chain
+
+  ImportTask(unsigned workers) : fmt(AUTO), buf(NULL), samples(workers),
+    records(workers, 0), dropped(workers, 0) {}
+
+  /// Charge count samples to a call chain listed from leaf to root
+  void account(unsigned worker, SmallVectorImpl<StringRef> & chain, uint64_t count)
+  {
+    if (chain.empty()) {
+      dropped[worker] += count;
+      return;
+    }
+    SampleMap & map = samples[worker];
+    map[chain[0]].self += count;
+    // recursive frames count once towards inclusive samples
+    std::sort(chain.begin(), chain.end());
+    StringRef * last = std::unique(chain.begin(), chain.end());
+    for (StringRef * it = chain.begin(); it != last; ++it)
+      map[*it].inclusive += count;
+  }
+
+  /// The symbol of a perf script call chain line:
+  ///   ADDRESS SYMBOL+OFFSET (DSO)
+  static StringRef parseFrame(StringRef line)
+  {
+    line = trimLeft(line);
+    size_t sp = line.find(' ');
+    if (sp == StringRef::npos)
+      return StringRef();
+    StringRef sym = line.substr(sp + 1);
+    size_t dso = sym.rfind(" (");
+    if (dso != StringRef::npos)
+      sym = sym.substr(0, dso);
+    size_t off = sym.rfind("+0x");
+    if (off != StringRef::npos &&
+        sym.substr(off + 3).find_first_not_of("0123456789abcdefABCDEF") == StringRef::npos)
+      sym = sym.substr(0, off);
+    sym = trimRight(trimLeft(sym));
+    if (sym.empty() || sym == "[unknown]")
+      return StringRef();
+    return sym;
+  }
+
+  void parsePerfScript(unsigned worker, StringRef record)
+  {
+    if (record[0] == '#')
+      return;
+    SmallVector<StringRef, 64> chain;
+    // skip the header
+    size_t nl = record.find('\n');
+    while (nl != StringRef::npos) {
+      record = record.substr(nl + 1);
+      nl = record.find('\n');
+      StringRef frame = parseFrame(record.substr(0, nl));
+      if (!frame.empty())
+        chain.push_back(frame);
+    }
+    records[worker]++;
+    account(worker, chain, 1);
+  }
+
+  /// A folded stack line: ROOT;...;LEAF COUNT
+  void parseFolded(unsigned worker, StringRef line)
+  {
+    line = trimRight(line);
+    if (line.empty() || line[0] == '#')
+      return;
+    size_t sp = line.find_last_of(" \t");
+    if (sp == StringRef::npos)
+      return;
+    unsigned long long count;
+    if (line.substr(sp + 1).getAsInteger(10, count))
+      return;
+    SmallVector<StringRef, 64> chain;
+    StringRef stack = line.substr(0, sp);
+    while (!stack.empty()) {
+      size_t semi = stack.rfind(';');
+      StringRef frame = semi == StringRef::npos ? stack : stack.substr(semi + 1);
+      if (!frame.empty())
+        chain.push_back(frame);
+      stack = semi == StringRef::npos ? StringRef() : stack.substr(0, semi);
+    }
+    records[worker]++;
+    account(worker, chain, count);
+  }
+
+  void run(unsigned index, unsigned worker)
+  {
+    size_t p = bounds[index], end = bounds[index + 1];
+    while (p < end) {
+      size_t next = nextRecord(buf, p + 1, end, fmt);
+      StringRef record(buf + p, next - p);
+      if (fmt == FOLDED)
+        parseFolded(worker, record);
+      else
+        parsePerfScript(worker, record);
+      p = next;
+    }
+  }
+
+  /// Aggregate the complete records in buf[0, len)
+  void process(const char * data, size_t len)
+  {
+    buf = data;
+    bounds.clear();
+    unsigned pieces = samples.size() * 4;
+    for (unsigned i = 0; i < pieces; ++i) {
+      size_t p = i == 0 ? 0 : nextRecord(buf, len / pieces * i, len, fmt);
+      if (bounds.empty() || p > bounds.back())
+        bounds.push_back(p);
+    }
+    if (bounds.back() < len)
+      bounds.push_back(len);
+    parallel_for(*this, bounds.size() - 1, samples.size());
+  }
+};
+
+/// Stream the input chunk by chunk. Only whole records are handed to
+/// the workers; the partial record at the end of a chunk is carried
+/// over to the next one.
+bool import(FILE * fin, ImportTask & task)
+{
+  size_t cap = chunk_size, len = 0;
+  char * buf = (char *) xmalloc(cap);
+  bool eof = false;
+  while (!eof || len > 0) {
+    size_t n = fread(buf + len, 1, cap - len, fin);
+    if (n < cap - len) {
+      if (ferror(fin)) {
+        perror("Read samples");
+        free(buf);
+        return false;
+      }
+      eof = true;
+    }
+    len += n;
+    if (task.fmt == AUTO)
+      task.fmt = guessFormat(buf, len);
+    size_t cut = eof ? len : lastRecord(buf, len, task.fmt);
+    if (cut == 0) {
+      if (len == 0)
+        break;
+      // a single record larger than the chunk
+      cap *= 2;
+      buf = (char *) xrealloc(buf, cap);
+      continue;
+    }
+    import_debug("chunk of %zu bytes\n", cut);
+    task.process(buf, cut);
+    memmove(buf, buf + cut, len - cut);
+    len -= cut;
+  }
+  free(buf);
+  return true;
+}
+
+struct SymbolSamples {
+  string name;
+  FuncWeight weight;
+  SymbolSamples(StringRef n, const FuncWeight & w) : name(n.str()), weight(w) {}
+};
+
+static bool compareSamples(const SymbolSamples & a, const SymbolSamples & b)
+{
+  if (a.weight.inclusive != b.weight.inclusive)
+    return a.weight.inclusive > b.weight.inclusive;
+  if (a.weight.self != b.weight.self)
+    return a.weight.self > b.weight.self;
+  return a.name < b.name;
+}
+
+void report(ImportTask & task)
+{
+  SampleMap total;
+  uint64_t records = 0, dropped = 0;
+  for (unsigned i = 0; i < task.samples.size(); ++i) {
+    SampleMap & map = task.samples[i];
+    for (SampleMap::iterator I = map.begin(), E = map.end(); I != E; ++I) {
+      FuncWeight & w = total[I->getKey()];
+      w.self += I->getValue().self;
+      w.inclusive += I->getValue().inclusive;
+    }
+    map.clear(); // release memory as we go
+    records += task.records[i];
+    dropped += task.dropped[i];
+  }
+  vector<SymbolSamples> symbols;
+  for (SampleMap::iterator I = total.begin(), E = total.end(); I != E; ++I) {
+    if (I->getValue().inclusive >= min_samples)
+      symbols.push_back(SymbolSamples(I->getKey(), I->getValue()));
+  }
+  sort(symbols.begin(), symbols.end(), compareSamples);
+  size_t k = topk >= 0 && (size_t) topk < symbols.size() ? topk : symbols.size();
+  fprintf(stderr, "%llu records, %llu without call chain, %zu symbols\n",
+      (unsigned long long) records, (unsigned long long) dropped, total.size());
+
+  if (dbname) {
+    Profile profile;
+    ProfileWeights weights;
+    for (size_t i = 0; i < k; ++i) {
+      profile[SAMPLED].push_back(symbols[i].name);
+      weights[symbols[i].name] = symbols[i].weight;
+    }
+    if (!writeProfileDB(dbname, profile, &weights))
+      exit(1);
+    return;
+  }
+  fprintf(fout, "%s\n%s\n%s\n", PROFILE_SEGMENT_BEGIN, toSpeFuncName(SAMPLED),
+      PROFILE_SEGMENT_END);
+  for (size_t i = 0; i < k; ++i) {
+    const FuncWeight & w = symbols[i].weight;
+    fprintf(fout, "%s\t%llu\t%llu\t0\n", symbols[i].name.c_str(),
+        (unsigned long long) w.self, (unsigned long long) w.inclusive);
+  }
+}
+
+static char const * option_help[] = {
+  "-o FILE\n\tOutput the generated profile to FILE file.",
+  "-b FILE\n\tOutput the generated profile as a binary database to FILE.",
+  "-f FORMAT\n\tFormat of the input: perf (output of `perf script') or folded\n\t"
+             "(one `ROOT;...;LEAF COUNT' stack per line). Guessed by default.",
+  "-n NUM\n\tOnly output the top NUM symbols by inclusive samples. Default all.",
+  "-c NUM\n\tOnly output symbols with at least NUM inclusive samples. Default 1.",
+  "-j JOBS\n\tAggregate samples on JOBS threads. 0 means one per processor.",
+  "-s MB\n\tRead the input in chunks of MB megabytes. Default 64.",
+  "-h\n\tPrint this message.",
+  0
+};
+
+static char const * option_example[] = {
+  "-j 0 -o mysql.profile perf.script",
+  "-f folded -n 1000 -b mysql.profile.db out.folded",
+  "-j 8 -o mysql.profile -   (e.g., perf script | perfimporter ...)",
+  0
+};
+
+void usage(FILE *fp = stderr)
+{
+  const char **p = option_help;
+  fprintf(fp, "Import `perf script' or folded stack samples into a weighted profile\n\n");
+  fprintf(fp, "Usage: %s [OPTIONS] INPUT\n\n", program_name);
+  while (*p) {
+    fprintf(fp, "  %s\n\n", *p);
+    p++;
+  }
+  p = option_example;
+  fprintf(fp, "Examples:\n\n");
+  while (*p) {
+    fprintf(fp, "  %s %s\n\n", program_name, *p);
+    p++;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  program_name = argv[0];
+
+  if (argc <= 1) {
+    usage();
+    exit(1);
+  }
+  int opt;
+  long num;
+  char *endptr;
+  while((opt = getopt(argc, argv, "b:c:f:hj:n:o:s:")) != -1) {
+    switch(opt) {
+      case 'b':
+        dbname = optarg;
+        break;
+      case 'f':
+        if (strcmp(optarg, "perf") == 0)
+          format = PERFSCRIPT;
+        else if (strcmp(optarg, "folded") == 0)
+          format = FOLDED;
+        else {
+          fprintf(stderr, "Unknown input format %s\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'n':
+        topk = strtol(optarg, &endptr, 10);
+        if (endptr == optarg) {
+          fprintf(stderr, "Option %s is not a valid number\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'c':
+        num = strtol(optarg, &endptr, 10);
+        if (endptr == optarg || num < 0) {
+          fprintf(stderr, "Option %s is not a valid number\n", optarg);
+          exit(1);
+        }
+        min_samples = num;
+        break;
+      case 'j':
+        num = strtol(optarg, &endptr, 10);
+        if (endptr == optarg || num < 0) {
+          fprintf(stderr, "Number of jobs must be a non-negative integer\n");
+          exit(1);
+        }
+        jobs = num == 0 ? hardware_threads() : num;
+        break;
+      case 's':
+        num = strtol(optarg, &endptr, 10);
+        if (endptr == optarg || num <= 0) {
+          fprintf(stderr, "Chunk size must be positive integer\n");
+          exit(1);
+        }
+        chunk_size = (size_t) num << 20;
+        break;
+      case 'o':
+        fout = fopen(optarg, "w");
+        if (fout == NULL) {
+          perror("Output must be a file");
+          exit(1);
+        }
+        break;
+      case 'h':
+        usage();
+        exit(0);
+      case '?':
+      default:
+        usage();
+        exit(1);
+    }
+  }
+
+  if (optind != argc-1) {
+    usage();
+    exit(1);
+  }
+
+  FILE * fin = stdin;
+  if (strcmp(argv[optind], "-") != 0) {
+    fin = fopen(argv[optind], "r");
+    if (fin == NULL) {
+      perror("Input must be a file");
+      exit(1);
+    }
+  }
+  ImportTask task(jobs);
+  task.fmt = format;
+  if (!import(fin, task))
+    exit(1);
+  if (fin != stdin)
+    fclose(fin);
+  report(task);
+  if (fout != stdout)
+    fclose(fout);
+  return 0;
+}
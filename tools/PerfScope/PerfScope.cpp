@@ -6,8 +6,13 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <errno.h>
 #include <vector>
 #include <list>
+#include <map>
 
 #include "llvm/LLVMContext.h"
 #include "llvm/IntrinsicInst.h"
@@ -31,17 +36,26 @@
 #include "llvm/Support/IRReader.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/CallSite.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/InstVisitor.h"
 #include "llvm/Support/InstIterator.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/Threading.h"
 
 #include "commons/handy.h"
 #include "commons/LLVMHelper.h"
+#include "commons/ModuleCache.h"
+#include "commons/Parallel.h"
+#include "commons/Profile.h"
+#include "commons/ProfileDB.h"
 #include "parser/PatchDecoder.h"
 #include "mapper/Matcher.h"
+#include "mapper/ModuleRouter.h"
 #include "analyzer/Evaluator.h"
 #include "analyzer/X86CostModel.h"
+#include "llvmslicer/PointsTo.h"
+#include "llvmslicer/PointsToCache.h"
 #include "llvmslicer/StaticSlicer.h"
 
 
@@ -71,12 +85,17 @@ static char * program_name;
 
 static char * id_fname = NULL;
 
-static LLVMContext & Context = getGlobalContext();
+static vector<LLVMContext *> module_contexts; // of the before-revision modules
 
 static vector<ModuleArg> newmods;
 static vector<ModuleArg> oldmods;
+static ModuleRouter * router = NULL; // source file -> owners in newmods
 
 static Profile profile;
+static ProfileWeights profile_weights;
+static ProfileDB profile_db; // mapped by -e when given a database
+
+static RiskThresholds thresholds; // tuned by -t
 
 typedef RiskEvaluator::InstVecTy InstVecTy;
 typedef RiskEvaluator::InstMapTy InstMapTy;
@@ -84,21 +103,101 @@ typedef RiskEvaluator::InstMapTy InstMapTy;
 static int objlen = MAX_PATH;
 static char objname[MAX_PATH];
 
-X86CostModel * XCM = NULL;
+static unsigned jobs = 1;
+static unsigned load_threads = 1; // parsing modules up front
+static unsigned slice_threads = 1; // slicer and DSA closures of one job
+static size_t module_budget = 0; // bytes of after-revision modules per workspace, see -M
+static bool eager_load = false; // -E
+static slicing::AliasMode alias_mode = slicing::ALIAS_NONE; // -A
+
+extern cl::opt<unsigned> DSAThreads; // closures of DSA, see -A dsa
+
+static X86CostModel * XCM = NULL;
+
+static char * cache_fname = NULL; // analysis cache kept across runs, see -C
+
+// Server mode: read IDFILE paths from stdin, or from clients of a
+// UNIX domain socket, one per line, and answer each with its report
+// followed by REPORT_END. Modules stay loaded between requests.
+static bool serve_stdin = false;
+static char * socket_path = NULL;
+
+#define REPORT_END "%%EOR\n"
+#define SAVE_REQUESTS 64 // requests between two saves of the analysis cache
+
+// A chapter with all its hunks decoded up front. Chapters are streamed
+// out of the PatchDecoder, which frees the previous one on every call,
+// so anything handed to a worker must be a self-contained copy.
+struct HunkTask {
+  unsigned start_line;
+  std::string ctrlseq;
+  Scope rep_enclosing_scope;
+  std::vector<Mod> mods;
+};
+
+struct ChapterTask {
+  std::string fullname;
+  std::vector<HunkTask> hunks;
+  std::string report; // buffered evaluator output in parallel mode
+  bool significant;
+  ChapterTask() : significant(false) {}
+};
+
+// Matchers, caller hotness and slicers are kept per module since each
+// costs a pass over the whole module to set up. They go when the module
+// is evicted.
+struct ModuleAnalysis : public ModuleState {
+  Matcher * matcher;
+  CallerHotnessCache * hotness;
+  PassManager * slicer_passes; // owns the slicer, and keeps the function
+                               // analyses it queries alive
+  slicing::StaticSlicer * slicer;
+  ModuleAnalysis() : matcher(NULL), hotness(NULL), slicer_passes(NULL), 
+    slicer(NULL) {}
+  virtual ~ModuleAnalysis()
+  {
+    delete matcher;
+    delete hotness;
+    delete slicer_passes;
+  }
 
-void runevaluator(Module * module, InstMapTy & instmap)
+  virtual size_t footprint() const { return slicer ? slicer->footprint() : 0; }
+};
+
+// Everything a chapter is analyzed against. The serial path uses
+// newmods; every parallel worker owns its own copy of the modules.
+// Modules are loaded on demand, each in a private context, and evicted
+// along with their context when over budget. Function summaries are cached
+// across modules and runs by function hash.
+struct Workspace {
+  vector<ModuleArg> * mods;
+  ModuleCache * modules; // of mods
+  X86CostModel * cost_model;
+  CompiledProfile * profile; // memoizes lookups, so one per thread
+  AnalysisCache * analysis;
+  Workspace() : mods(NULL), modules(NULL), cost_model(NULL), 
+    profile(NULL), analysis(NULL) {}
+};
+
+// Workspaces of the parallel workers. They are created on the first
+// parallel batch and kept for the lifetime of the process, so that a
+// server only pays for loading the modules once.
+static vector<Workspace> workspaces;
+static Workspace main_ws; // the serial path
+
+void runevaluator(Module * module, InstMapTy & instmap, CostModel * model, 
+    CompiledProfile * compiled, CallerHotnessCache * hotness, 
+    slicing::StaticSlicer * slicer, FILE * out)
 {
-  slicing::StaticSlicer * slicer = NULL;
-  PassManager Passes;
-  if (analysis_level > 1) {
-    slicer = new slicing::StaticSlicer(true);
-    Passes.add(slicer);
-    Passes.run(*module);
-  }
-  assert(XCM && "requires cost model");
+  if (slicer) // criteria of the previous chapter
+    slicer->reset();
+  assert(model && "requires cost model");
   if (instmap.size()) {
     OwningPtr<FunctionPassManager> FPasses(new FunctionPassManager(module));
-    FPasses->add(new RiskEvaluator(instmap, slicer, XCM, &profile, module, analysis_level));
+    RiskEvaluator * evaluator = new RiskEvaluator(instmap, slicer, model, compiled, 
+        module, analysis_level, 2, out, hotness);
+    evaluator->setThresholds(thresholds);
+    FPasses->add(evaluator);
     FPasses->doInitialization();
     for (InstMapTy::iterator map_it = instmap.begin(), map_ie = instmap.end();
         map_it != map_ie; ++map_it) {
@@ -117,9 +216,14 @@ void parseList(vector<ModuleArg> & vec, char *arg, const char *delim)
   }
 }
 
-bool load(LLVMContext & context, ModuleArg & mod)
+/// Load mod. Given the call index of the module, only its globals and
+/// metadata are read; function bodies are then read by the Matcher and
+/// the CallerGraph as chapters need them. The slicer analyzes the
+/// whole module, so it needs the bodies up front.
+bool load(LLVMContext & context, ModuleArg & mod, const CallIndex * calls = NULL)
 {
-  mod.module = ReadModule(context, mod.name);
+  mod.lazy = calls != NULL && !eager_load && analysis_level < 2;
+  mod.module = ReadModule(context, mod.name, mod.lazy);
   if (mod.module == NULL)  {
     cout << "cannot load module " << mod.name << endl;
     return false;
@@ -133,15 +237,71 @@ bool load(LLVMContext & context, ModuleArg & mod)
   return true;
 }
 
-void load(LLVMContext & context, vector<ModuleArg> & vec)
+/// Parse modules on a pool of workers. A context can't be shared
+/// between threads, so every module gets a private one.
+class ModuleLoading : public ParallelTask {
+  private:
+    vector<ModuleArg *> & mods;
+
+  public:
+    vector<LLVMContext *> contexts;
+    vector<char> loaded;
+
+    ModuleLoading(vector<ModuleArg *> & mods) : mods(mods), 
+      contexts(mods.size(), NULL), loaded(mods.size(), 0) {}
+
+    virtual void run(unsigned index, unsigned worker)
+    {
+      contexts[index] = new LLVMContext();
+      loaded[index] = load(*contexts[index], *mods[index]);
+    }
+};
+
+/// Load mods on load_threads workers, along with their strips. The
+/// context of mods[i] is returned in contexts[i]. Exits if any of them
+/// can't be loaded.
+void load(vector<ModuleArg *> & mods, vector<LLVMContext *> & contexts)
 {
-  vector<ModuleArg>::iterator it = vec.begin(), ie = vec.end();
-  for (; it != ie; it++) {
-    if (!load(context, *it))
+  ModuleLoading loading(mods);
+  parallel_for(loading, mods.size(), load_threads);
+  contexts = loading.contexts;
+  for (unsigned i = 0; i < mods.size(); ++i) {
+    if (!loading.loaded[i])
       exit(1);
   }
 }
 
+/// Index the compile units of newmods so that a chapter is only
+/// matched against the modules that contain its file. Modules with an
+/// up to date sidecar index are not loaded at all; the ones loaded to
+/// be indexed are kept for the serial path.
+void buildRouter()
+{
+  router = new ModuleRouter(patch_strip_len);
+  vector<unsigned> ids;
+  vector<ModuleArg *> stale;
+  for (unsigned i = 0; i < newmods.size(); ++i) {
+    if (!router->addSidecar(i, newmods[i].name, module_strip_len)) {
+      ids.push_back(i);
+      stale.push_back(&newmods[i]);
+    }
+  }
+  vector<LLVMContext *> contexts;
+  load(stale, contexts);
+  // In module order, so that the routes don't depend on the workers
+  // The module cache of the serial path adopts the others along with
+  // their context.
+  for (unsigned i = 0; i < stale.size(); ++i) {
+    router->addModule(ids[i], *stale[i]->module, stale[i]->name, module_strip_len);
+    if (jobs > 1) { // workers load their own copies
+      delete stale[i]->module;
+      stale[i]->module = NULL;
+      delete contexts[i];
+    }
+  }
+  perf_debug("Routing %u source files\n", (unsigned) router->size());
+}
+
 void fixnastyname(Chapter *chap) 
 {
   // add all nasty things here to avoid soft links 
@@ -149,165 +309,504 @@ void fixnastyname(Chapter *chap)
     chap->fullname = "src/backend/port/pg_shmem.c";
 }
 
-void analyze(char *input)
+/// Decode the hunks of chap into task. Returns false if the chapter
+/// is not interesting, e.g., a header file.
+bool collectChapter(Chapter *chap, ChapterTask & task)
 {
-  llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
-  PassRegistry &Registry = *PassRegistry::getPassRegistry();
-  initPassRegistry(Registry);
-
-  XCM = new X86CostModel(getTargetMachine());
-  PatchDecoder * decoder = new PatchDecoder(input);
-  assert(decoder);
-  Patch *patch = NULL;
-  Chapter *chap = NULL;
+  perf_debug("chapter: %s\n", chap->filename.c_str());
+  if (src2obj(chap->fullname.c_str(), objname, &objlen) == NULL) { // skip header files for now
+    chap->skip_rest_of_hunks();
+    return false;
+  }
+  fixnastyname(chap);
+  task.fullname = chap->fullname;
   Hunk * hunk = NULL;
-  bool insignificant = true;
-  while ((patch = decoder->next_patch()) != NULL) {
-    perf_debug("patch: %s\n", patch->patchname.c_str());
-    while ((chap = patch->next_chapter()) != NULL) {
-      perf_debug("chapter: %s\n", chap->filename.c_str());
-      if (src2obj(chap->fullname.c_str(), objname, &objlen) == NULL) { // skip header files for now
-        chap->skip_rest_of_hunks();
-        continue;
-      }
-      bool found = false;
-      for (vector<ModuleArg>::iterator it = newmods.begin(), ie = newmods.end();
-          it != ie; ++it) {
-        if (it->module == NULL && load(Context, *it))
-          continue;
-        Matcher matcher(*(it->module), it->strips, patch_strip_len);
-        fixnastyname(chap);
-        Matcher::sp_iterator I  = matcher.resetTarget(chap->fullname);
-        if (I != matcher.sp_end()) {
-          found = true;
-          inst_iterator  fi;
-          Function *func = NULL;
-          Function *prevfunc = NULL;
-          InstMapTy instmap;
+  while((hunk = chap->next_hunk())) {
+    task.hunks.push_back(HunkTask());
+    HunkTask & ht = task.hunks.back();
+    ht.start_line = hunk->start_line;
+    if (hunk->ctrlseq)
+      ht.ctrlseq = hunk->ctrlseq;
+    ht.rep_enclosing_scope = hunk->rep_enclosing_scope;
+    for (Hunk::iterator HI = hunk->begin(), HE = hunk->end(); HI != HE; ++HI)
+      ht.mods.push_back(**HI);
+  }
+  return true;
+}
+
+/// The after-revision modules of a workspace
+class WorkspaceModules : public ModuleCache {
+  private:
+    AnalysisCache * analysis;
+
+  public:
+    WorkspaceModules(vector<ModuleArg> & mods, AnalysisCache * analysis, 
+        size_t budget) : ModuleCache(mods, budget), analysis(analysis) {}
+    virtual ~WorkspaceModules() { clear(); }
+
+  protected:
+    virtual bool load(unsigned id, ModuleArg & mod, LLVMContext & context)
+    {
+      return ::load(context, mod, router->calls(id));
+    }
+
+    virtual void release(unsigned id, ModuleArg & mod)
+    {
+      if (analysis) // hashes and summarizers of loaded functions
+        analysis->forget();
+    }
+};
+
+/// Map the hunks of task to instructions in the first module of ws
+/// that contains the file and evaluate them. Returns whether any
+/// hunk is significant.
+bool analyzeChapter(Workspace & ws, ChapterTask & task, FILE * out)
+{
+  const ModuleRouter::ModuleList * owners = router->route(task.fullname);
+  if (owners == NULL) {
+    perf_debug("no module contains %s\n", task.fullname.c_str());
+    return false;
+  }
+  for (ModuleRouter::ModuleList::const_iterator oi = owners->begin(), 
+      oe = owners->end(); oi != oe; ++oi) {
+    if (ws.modules->get(*oi) == NULL)
+      continue;
+    ModuleArg * it = &(*ws.mods)[*oi];
+    ModuleAnalysis * state = static_cast<ModuleAnalysis *>(ws.modules->getState(*oi));
+    if (state == NULL) {
+      state = new ModuleAnalysis();
+      ws.modules->setState(*oi, state);
+    }
+    if (state->matcher == NULL)
+      state->matcher = new Matcher(*(it->module), it->strips, patch_strip_len);
+    Matcher & matcher = *state->matcher;
+    Matcher::sp_iterator I  = matcher.resetTarget(task.fullname);
+    if (I == matcher.sp_end()) {
+      ws.modules->update(*oi);
+      continue;
+    }
+    Function *func = NULL;
+    Function *prevfunc = NULL;
+    InstMapTy instmap;
 #ifdef NEED_MEM2REG
-          OwningPtr<FunctionPassManager> Mem2RegPass(new FunctionPassManager(it->module));
-          Mem2RegPass->add(createPromoteMemoryToRegisterPass());
-          Mem2RegPass->doInitialization();
+    OwningPtr<FunctionPassManager> Mem2RegPass(new FunctionPassManager(it->module));
+    Mem2RegPass->add(createPromoteMemoryToRegisterPass());
+    Mem2RegPass->doInitialization();
 #endif
-          while((hunk = chap->next_hunk())) {
-            int s = 0;
-            Scope scope = hunk->rep_enclosing_scope;
-            perf_debug("hunk\n  begin: line %d\n  ctrl seq.: %s\n"
-                        "  scope: [#%lu, #%lu]\n", hunk->start_line, hunk->ctrlseq,
-                        scope.begin, scope.end);  
-            Hunk::iterator HI = hunk->begin(), HE = hunk->end();
-            bool multiple = true;
-            for(; multiple; prevfunc = func) {
-              func = matcher.matchFunction(I, scope, multiple);
-              if (func == NULL)
-                break;
+    for (vector<HunkTask>::iterator hunk = task.hunks.begin(), 
+        hunk_end = task.hunks.end(); hunk != hunk_end; ++hunk) {
+      int s = 0;
+      Scope scope = hunk->rep_enclosing_scope;
+      perf_debug("hunk\n  begin: line %d\n  ctrl seq.: %s\n"
+                  "  scope: [#%lu, #%lu]\n", hunk->start_line, hunk->ctrlseq.c_str(),
+                  scope.begin, scope.end);  
+      vector<Mod>::iterator HI = hunk->mods.begin(), HE = hunk->mods.end();
+      Matcher::sp_range range = matcher.matchFunctions(scope);
+      for(I = range.first; I != range.second; ++I, prevfunc = func) {
+        func = I->function;
+        if (func == NULL) // not emitted, e.g., unused static function
+          continue;
 #ifdef NEED_MEM2REG
-              if (prevfunc != func) // Only transform the new functions
-                Mem2RegPass->run(*func);
+        if (prevfunc != func) // Only transform the new functions
+          Mem2RegPass->run(*func);
 #endif
 
-              // The enclosing scope is the min, max range:
-              //        [Mods[first].begin, Mods[last].end]
-              // We should iterate the actual modification for intervals 
-
-              // Hunk: [(..M1..)    (..M2..)  (..M3..)]
-              //                {f1}
-
-              // Skip DEL modifications and modifications that are 
-              // before function's beginning
-              while(HI != HE && ((*HI)->type == DEL || 
-                    (*HI)->rep_scope.end < I->linenumber))
-                HI++;
-
-              // Run over modifications, break out to the next hunk
-              if (HI == HE) {
-                break;
-              }
-
-              // Modification cross function boundary, this
-              // happens when the function lies in gaps.
-              // But by definition, there's no gap between Mods.
-              if (((*HI)->rep_scope.begin > I->lastline)) {
-                fprintf(stderr, "Bad things happened in %s(%u-%u): [#%lu, #%lu]\n", 
-                    I->name.c_str(),  I->linenumber, I->lastline, 
-                    (*HI)->rep_scope.begin, (*HI)->rep_scope.end);
-              }
-              // assert((*HI)->rep_scope.begin <= I->lastline);
-
-              s++;
-              const char *dname = cpp_demangle(I->name.c_str());
-              if (dname == NULL)
-                dname = I->name.c_str();
-              perf_debug("scope #%d: %s |=> [#%lu, #%lu]\n  %s:", s,
-                          dname, scope.begin, scope.end, dname);
-
-              // Four situations(top mod, bottom func):
-              // 1):   |_________|
-              //            |________|
-              // 2):   |_________|
-              //         |____|
-              // 3):   |_________|
-              //     |_______|
-              // 4):   |_________|
-              //     |_______________| 
-              //
-              // TODO in case, the adjacent hunks are inside the same function, 
-              // no need to restart search from beginning
-              if (prevfunc != func)
-                fi = inst_begin(func);
-              
-              // Find the instructions for Modifications within the range of the
-              // function
-              for (; HI != HE && (*HI)->rep_scope.begin <= I->lastline; ++HI) {
-                if ((*HI)->type == DEL) { // skip delete
-                  continue;
-                }
-                // need to modify rep_scope to reflect 
-                // the processed lines
-                Scope & rep_scope = (*HI)->rep_scope; 
-                // reach the boundary
-                if (rep_scope.begin > I->lastline) 
-                  break;
-                // adjust replacement mod scope
-                if (rep_scope.begin < I->linenumber)
-                  rep_scope.begin = I->linenumber;
-                if (rep_scope.end > I->lastline)
-                  rep_scope.end = I->lastline;
-                ////////////////////////////////
-
-                Instruction *inst;
-                bool found_inst = false;
-                while ( (inst = matcher.matchInstruction(fi, func, rep_scope)) != NULL) {
-                  instmap[func].push_back(inst);
-                  found_inst = true;
-                } 
-                if (!found_inst) 
-                  perf_debug("Can't locate any instruction for mod @[#%lu, #%lu]\n",
-                     rep_scope.begin, rep_scope.end); 
-              }
-              perf_debug("$$\n");
-            }
-            if (s == 0)
-              perf_debug("insignificant scope\n");
-            else
-              insignificant = false;
+        // The enclosing scope is the min, max range:
+        //        [Mods[first].begin, Mods[last].end]
+        // We should iterate the actual modification for intervals 
+
+        // Hunk: [(..M1..)    (..M2..)  (..M3..)]
+        //                {f1}
+
+        // Skip DEL modifications and modifications that are 
+        // before function's beginning
+        while(HI != HE && (HI->type == DEL || 
+              HI->rep_scope.end < I->linenumber))
+          HI++;
+
+        // Run over modifications, break out to the next hunk
+        if (HI == HE) {
+          break;
+        }
+
+        // Modification cross function boundary, this
+        // happens when the function lies in gaps.
+        // But by definition, there's no gap between Mods.
+        if ((HI->rep_scope.begin > I->lastline)) {
+          fprintf(stderr, "Bad things happened in %s(%u-%u): [#%lu, #%lu]\n", 
+              I->name.c_str(),  I->linenumber, I->lastline, 
+              HI->rep_scope.begin, HI->rep_scope.end);
+        }
+        // assert(HI->rep_scope.begin <= I->lastline);
+
+        s++;
+        const char *dname = cpp_demangle(I->name.c_str());
+        if (dname == NULL)
+          dname = I->name.c_str();
+        perf_debug("scope #%d: %s |=> [#%lu, #%lu]\n  %s:", s,
+                    dname, scope.begin, scope.end, dname);
+
+        // Four situations(top mod, bottom func):
+        // 1):   |_________|
+        //            |________|
+        // 2):   |_________|
+        //         |____|
+        // 3):   |_________|
+        //     |_______|
+        // 4):   |_________|
+        //     |_______________| 
+        //
+        // Find the instructions for Modifications within the range of the
+        // function
+        for (; HI != HE && HI->rep_scope.begin <= I->lastline; ++HI) {
+          if (HI->type == DEL) { // skip delete
+            continue;
           }
-          runevaluator(it->module, instmap);
+          // need to modify rep_scope to reflect 
+          // the processed lines
+          Scope & rep_scope = HI->rep_scope; 
+          // reach the boundary
+          if (rep_scope.begin > I->lastline) 
+            break;
+          // adjust replacement mod scope
+          if (rep_scope.begin < I->linenumber)
+            rep_scope.begin = I->linenumber;
+          if (rep_scope.end > I->lastline)
+            rep_scope.end = I->lastline;
+          ////////////////////////////////
+
+          Matcher::inst_range insts = matcher.matchInstructions(func, rep_scope);
+          for (Matcher::line_iterator LI = insts.first; LI != insts.second; ++LI)
+            instmap[func].push_back(LI->second);
+          if (insts.first == insts.second) 
+            perf_debug("Can't locate any instruction for mod @[#%lu, #%lu]\n",
+               rep_scope.begin, rep_scope.end); 
+        }
+        perf_debug("$$\n");
+      }
+      if (s == 0)
+        perf_debug("insignificant scope\n");
+      else
+        task.significant = true;
+    }
+    if (instmap.size()) {
+      if (state->hotness == NULL)
+        state->hotness = new CallerHotnessCache(it->module, ws.analysis, 
+            it->lazy ? router->calls(*oi) : NULL);
+      if (analysis_level > 1 && state->slicer == NULL) {
+        slicing::AliasMode alias = alias_mode;
+        TargetData * TD = NULL;
+        if (alias == slicing::ALIAS_DSA && (TD = getTargetData(it->module)) == NULL) {
+          fprintf(stderr, "Warning: %s has no data layout for DSA, fall back to -A rules\n",
+              it->name.c_str());
+          alias = slicing::ALIAS_RULES;
+        }
+        state->slicer = new slicing::StaticSlicer(true, alias);
+        state->slicer->setThreads(slice_threads);
+        state->slicer->setCacheFile(it->name + POINTSTO_CACHE_SUFFIX);
+        state->slicer_passes = new PassManager();
+        if (TD)
+          state->slicer_passes->add(TD);
+        state->slicer_passes->add(state->slicer);
+        state->slicer_passes->run(*it->module);
+      }
+      runevaluator(it->module, instmap, ws.cost_model, ws.profile, state->hotness, 
+          state->slicer, out);
+    }
 #ifdef NEED_MEM2REG
-          Mem2RegPass->doFinalization();
+    Mem2RegPass->doFinalization();
 #endif
-          break; // already found in existing module, no need to try loading others
-        }
+    ws.modules->update(*oi); // materialized functions count from now on
+    break; // already found in existing module, no need to try loading others
+  }
+  return task.significant;
+}
+
+CompiledProfile * newCompiledProfile()
+{
+  CompiledProfile * compiled = new CompiledProfile(profile, &profile_weights, &profile_db);
+  compiled->setCutoffs(thresholds.exp_percentile, thresholds.hot_percentile);
+  return compiled;
+}
+
+AnalysisCache * newAnalysisCache()
+{
+  AnalysisCache * analysis = new AnalysisCache();
+  if (cache_fname && !analysis->load(cache_fname))
+    fprintf(stderr, "Warning: ignoring analysis cache %s\n", cache_fname);
+  return analysis;
+}
+
+void saveAnalysisCache()
+{
+  if (cache_fname == NULL)
+    return;
+  AnalysisCache merged;
+  unsigned hits = 0, misses = 0;
+  if (main_ws.analysis) {
+    merged.merge(*main_ws.analysis);
+    hits += main_ws.analysis->hits;
+    misses += main_ws.analysis->misses;
+  }
+  for (vector<Workspace>::iterator wi = workspaces.begin(), we = workspaces.end();
+      wi != we; ++wi) {
+    merged.merge(*wi->analysis);
+    hits += wi->analysis->hits;
+    misses += wi->analysis->misses;
+  }
+  perf_debug("analysis cache: %u hits, %u misses\n", hits, misses);
+  merged.save(cache_fname);
+}
+
+void setupWorkspaces(unsigned workers)
+{
+  if (!workspaces.empty())
+    return;
+  workspaces.resize(workers);
+  // Target initialization is not thread safe, so cost models are
+  // created up front.
+  for (unsigned i = 0; i < workers; ++i) {
+    workspaces[i].mods = new vector<ModuleArg>();
+    for (vector<ModuleArg>::iterator it = newmods.begin(), ie = newmods.end();
+        it != ie; ++it)
+      workspaces[i].mods->push_back(ModuleArg(it->name));
+    workspaces[i].cost_model = new X86CostModel(getTargetMachine());
+    workspaces[i].profile = newCompiledProfile();
+    workspaces[i].analysis = newAnalysisCache();
+    // every worker keeps its own copies
+    workspaces[i].modules = new WorkspaceModules(*workspaces[i].mods, 
+        workspaces[i].analysis, module_budget / workers);
+  }
+}
+
+void clearModuleState(Workspace & ws)
+{
+  if (ws.modules) {
+    delete ws.modules; // along with the modules
+    ws.modules = NULL;
+  }
+  if (ws.analysis)
+    ws.analysis->forget();
+}
+
+void reportModuleCache()
+{
+  unsigned hits = 0, misses = 0, evictions = 0;
+  if (main_ws.modules) {
+    hits += main_ws.modules->hits;
+    misses += main_ws.modules->misses;
+    evictions += main_ws.modules->evictions;
+  }
+  for (vector<Workspace>::iterator wi = workspaces.begin(), we = workspaces.end();
+      wi != we; ++wi) {
+    hits += wi->modules->hits;
+    misses += wi->modules->misses;
+    evictions += wi->modules->evictions;
+  }
+  fprintf(stderr, "module cache: %u hits, %u misses, %u evictions\n", hits, misses, 
+      evictions);
+}
+
+void reportSlicer()
+{
+  if (analysis_level < 2)
+    return;
+  fprintf(stderr, "slicer: %llu RC visits, at least %llu for full sweeps (estimate)\n",
+      (unsigned long long) slicing::FunctionStaticSlicer::rcVisits(),
+      (unsigned long long) slicing::FunctionStaticSlicer::rcSweepEstimate());
+  uint64_t nodes, visits, collapsed;
+  ptr::solverStats(nodes, visits, collapsed);
+  if (nodes)
+    fprintf(stderr, "points-to: %llu nodes, %llu visits, %llu collapsed into cycles\n",
+        (unsigned long long) nodes, (unsigned long long) visits,
+        (unsigned long long) collapsed);
+  uint64_t unified;
+  ptr::dsaStats(nodes, unified);
+  if (nodes)
+    fprintf(stderr, "dsa points-to: %llu nodes, %llu unified across graphs\n",
+        (unsigned long long) nodes, (unsigned long long) unified);
+}
+
+void releaseWorkspaces()
+{
+  for (vector<Workspace>::iterator wi = workspaces.begin(), we = workspaces.end();
+      wi != we; ++wi) {
+    clearModuleState(*wi);
+    delete wi->mods;
+    delete wi->cost_model;
+    delete wi->profile;
+    delete wi->analysis;
+  }
+  workspaces.clear();
+}
+
+/// Analyze a batch of chapters on a pool of workers, one private copy
+/// of the after-revision modules per worker.
+class ChapterAnalysis : public ParallelTask {
+  private:
+    vector<ChapterTask> & tasks;
+    vector<Workspace> & workers;
+
+  public:
+    ChapterAnalysis(vector<ChapterTask> & tasks, vector<Workspace> & workers) : 
+      tasks(tasks), workers(workers) {}
+
+    virtual void run(unsigned index, unsigned worker)
+    {
+      ChapterTask & task = tasks[index];
+      char * buf = NULL;
+      size_t len = 0;
+      FILE * out = open_memstream(&buf, &len);
+      if (out == NULL)
+        diegrace("Cannot buffer the report of %s", task.fullname.c_str());
+      analyzeChapter(workers[worker], task, out);
+      fclose(out);
+      task.report.assign(buf, len);
+      free(buf);
+    }
+};
+
+void analyze(char *input, FILE * out)
+{
+  PatchDecoder * decoder = new PatchDecoder(input);
+  assert(decoder);
+  // a bad request must not take the server down
+  decoder->setFatal(!serve_stdin && socket_path == NULL);
+  Patch *patch = NULL;
+  Chapter *chap = NULL;
+  bool insignificant = true;
+  if (jobs > 1) {
+    // Decode everything first: the decoder itself is sequential. Reports
+    // are printed afterwards in chapter order so that the output doesn't
+    // depend on the number of workers.
+    vector<ChapterTask> tasks;
+    while ((patch = decoder->next_patch()) != NULL) {
+      perf_debug("patch: %s\n", patch->patchname.c_str());
+      while ((chap = patch->next_chapter()) != NULL) {
+        tasks.push_back(ChapterTask());
+        if (!collectChapter(chap, tasks.back()))
+          tasks.pop_back();
       }
-      if (!found) 
-        chap->skip_rest_of_hunks();
     }
-    delete patch;
+    if (decoder->failed())
+      tasks.clear();
+    setupWorkspaces(jobs);
+    ChapterAnalysis analysis(tasks, workspaces);
+    parallel_for(analysis, tasks.size(), jobs);
+    for (vector<ChapterTask>::iterator it = tasks.begin(), ie = tasks.end();
+        it != ie; ++it) {
+      fputs(it->report.c_str(), out);
+      if (it->significant)
+        insignificant = false;
+    }
+  }
+  else {
+    if (main_ws.cost_model == NULL) {
+      main_ws.mods = &newmods;
+      main_ws.cost_model = XCM = new X86CostModel(getTargetMachine());
+      main_ws.profile = newCompiledProfile();
+      main_ws.analysis = newAnalysisCache();
+      main_ws.modules = new WorkspaceModules(newmods, main_ws.analysis, 
+          module_budget);
+    }
+    while ((patch = decoder->next_patch()) != NULL) {
+      perf_debug("patch: %s\n", patch->patchname.c_str());
+      while ((chap = patch->next_chapter()) != NULL) {
+        ChapterTask task;
+        if (collectChapter(chap, task) && analyzeChapter(main_ws, task, out))
+          insignificant = false;
+      }
+    }
+  }
+  if (decoder->failed())
+    fprintf(out, "error: %s: %s\n", input, decoder->errorMessage().c_str());
+  else if (insignificant)
+    fprintf(out, "trivial\n");
+  delete decoder;
+}
+
+double now()
+{
+  struct timeval tim;
+  gettimeofday(&tim, NULL);
+  return tim.tv_sec * 1000.0 + (tim.tv_usec/1000.0);
+}
+
+/// Answer requests read from in until EOF. Every line names an IDFILE,
+/// the report is written to out and terminated with REPORT_END. The
+/// analysis cache is saved every SAVE_REQUESTS requests and at EOF
+/// rather than after each one, since saving rewrites the whole file.
+void serve(FILE * in, FILE * out)
+{
+  char * line = NULL;
+  size_t cap = 0;
+  unsigned unsaved = 0;
+  while (getline(&line, &cap, in) >= 0) {
+    char * fname = line;
+    while (isspace(*fname))
+      fname++;
+    char * end = fname + strlen(fname);
+    while (end > fname && isspace(end[-1]))
+      *--end = '\0';
+    if (*fname == '\0')
+      continue;
+    if (access(fname, R_OK) != 0) {
+      fprintf(out, "error: cannot read %s: %s\n", fname, strerror(errno));
+    }
+    else {
+      double t1 = now();
+      analyze(fname, out);
+      fprintf(stderr, "%s: %.4f ms\n", fname, now() - t1);
+      if (++unsaved == SAVE_REQUESTS) {
+        saveAnalysisCache();
+        unsaved = 0;
+      }
+    }
+    fputs(REPORT_END, out);
+    fflush(out);
+  }
+  free(line);
+  if (unsaved)
+    saveAnalysisCache();
+}
+
+/// Listen on a UNIX domain socket and serve one client at a time.
+void serve_socket(const char * path)
+{
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    diegrace("Socket path %s is too long", path);
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0)
+    diegrace("Cannot create socket");
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path); // stale socket from a previous server
+  if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sock, 8) < 0)
+    diegrace("Cannot listen on %s", path);
+  signal(SIGPIPE, SIG_IGN); // a client hanging up must not kill the server
+  fprintf(stderr, "listening on %s\n", path);
+  for (;;) {
+    int conn = accept(sock, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR)
+        continue;
+      diegrace("Cannot accept connection on %s", path);
+    }
+    int wconn = dup(conn);
+    FILE * in = fdopen(conn, "r");
+    FILE * out = wconn < 0 ? NULL : fdopen(wconn, "w");
+    if (in == NULL || out == NULL) {
+      fprintf(stderr, "Cannot open stream on connection\n");
+      if (in) fclose(in); else close(conn);
+      if (out) fclose(out); else if (wconn >= 0) close(wconn);
+      continue;
+    }
+    serve(in, out);
+    fclose(in);
+    fclose(out);
   }
-  if (insignificant)
-    printf("trivial\n");
-  if (XCM)
-    delete XCM;
 }
 
 static char const * option_help[] =
@@ -328,10 +827,41 @@ static char const * option_help[] =
              "|"
              PROFILE_SEGMENT_TYPE(FREQCALL)
              "|"
+             PROFILE_SEGMENT_TYPE(SAMPLED)
              "\n\t\t"
              PROFILE_SEGMENT_END 
-             "\n\t\tFUNCTION NAME\n\t\t...",
+             "\n\t\tFUNCTION NAME[<TAB>SELF[<TAB>INCLUSIVE[<TAB>CALLS]]]\n\t\t...\n\t\t"
+             "Functions with weights are expensive or hot when their cost per call or\n\t\t"
+             "call count is above a percentile of all weighted functions, see -t.\n\t\t"
+             "FILE may also be a database compiled by profilecompiler.",
+  "-t KEY=VALUE\n\tTune a threshold of the risk model. KEY is one of\n\t\t"
+             "loop     trip count above which a loop is tight (default 10)\n\t\t"
+             "inst     cost above which an instruction is expensive (default 10)\n\t\t"
+             "callers  callers above which a function is hot (default 10)\n\t\t"
+             "exppct   percentile of cost per call of expensive functions (default 90)\n\t\t"
+             "hotpct   percentile of call count of hot functions (default 90)",
   "-L LEVEL\n\tSpecify the level of analysis",
+  "-A MODE\n\tAlias analysis of the slicer from level 2 on. MODE is one of\n\t\t"
+             "none     no points-to sets, fast but blind to memory (default)\n\t\t"
+             "rules    rule-based Andersen's analysis, precise but slow on large modules\n\t\t"
+             "dsa      unification over the graphs of Data Structure Analysis,\n\t\t"
+             "         whose SCCs are inlined on every processor when -j is 1",
+  "-E\n\tRead every function of the after-revision modules when they are loaded.\n\t"
+             "By default, below level 2 only the functions of the modified files and\n\t"
+             "their callers are read.",
+  "-C FILE\n\tKeep loop, trip count and caller hotness results in FILE across runs.\n\t"
+             "Functions are looked up by a hash of their body, so unchanged functions\n\t"
+             "are not analyzed again. A server saves it every 64 requests and when\n\t"
+             "a client hangs up.",
+  "-d\n\tServer mode: keep the modules loaded and read IDFILE paths from stdin,\n\t"
+             "one per line. Each report is terminated by a line %%EOR.",
+  "-S SOCKET\n\tServer mode on a UNIX domain socket. Clients send IDFILE paths as with -d.",
+  "-M MB\n\tKeep the loaded after-revision modules and their analysis state within\n\t"
+             "about MB megabytes, split among the -j workers. The least recently used\n\t"
+             "modules are dropped and loaded again when needed. 0 means no limit.",
+  "-j JOBS\n\tAnalyze chapters on JOBS worker threads, each with a private copy of the\n\t"
+             "after-revision modules. Reports are printed in chapter order. 0 means one\n\t"
+             "worker per processor.",
   "-h\n\tPrint this message.",
   0
 };
@@ -340,6 +870,8 @@ static char const * option_example[] =
 {
   "-a test/cases/loop.1.new.s -m7 test/cases/loop.1.diff.id",
   "-a test/cases/ptest.new.s -m7 test/cases/ptest.diff.id",
+  "-a mysqld.bc -j 8 commit.diff.id",
+  "-a mysqld.bc -S /tmp/perfscope.sock",
   0
 };
 
@@ -348,7 +880,8 @@ void usage(FILE *fp = stderr)
   const char **p = option_help;
   fprintf(fp, "A PRA(Performance Risk Analysis) tool that evaluates the performance\n");
   fprintf(fp, "risk of a given code change in introducing performance regression.\n\n");
-  fprintf(fp, "Usage: %s OPTIONS IDFILE\n\n", program_name);
+  fprintf(fp, "Usage: %s OPTIONS IDFILE\n", program_name);
+  fprintf(fp, "       %s OPTIONS -d|-S SOCKET\n\n", program_name);
   while (*p) {
     fprintf(fp, "  %s\n\n", *p);
     p++;
@@ -373,7 +906,7 @@ int main(int argc, char *argv[])
   int opt;
   int plen;
   char *endptr;
-  while((opt = getopt(argc, argv, "a:b:e:hl:s:p:m:L:")) != -1) {
+  while((opt = getopt(argc, argv, "a:A:b:C:dEe:hj:l:s:p:m:t:L:M:S:")) != -1) {
     switch(opt) {
       case 'a':
         parseList(newmods, optarg, ",");
@@ -381,9 +914,25 @@ int main(int argc, char *argv[])
       case 'b':
         parseList(oldmods, optarg, ",");
         break;
+      case 'A':
+        if (strcmp(optarg, "none") == 0)
+          alias_mode = slicing::ALIAS_NONE;
+        else if (strcmp(optarg, "rules") == 0)
+          alias_mode = slicing::ALIAS_RULES;
+        else if (strcmp(optarg, "dsa") == 0)
+          alias_mode = slicing::ALIAS_DSA;
+        else {
+          fprintf(stderr, "Unknown alias mode %s\n", optarg);
+          exit(1);
+        }
+        break;
       case 'e':
       {
-        if (!parseProfile(optarg, profile)) {
+        if (isProfileDB(optarg)) {
+          if (!profile_db.open(optarg))
+            exit(1);
+        }
+        else if (!parseProfile(optarg, profile, &profile_weights)) {
           fprintf(stderr, "Ill-formated profile.\n");
           exit(1);
         }
@@ -417,9 +966,47 @@ int main(int argc, char *argv[])
         module_strip_len = plen;
         break;
       }
+      case 'C':
+        cache_fname = optarg;
+        break;
+      case 't':
+        if (!thresholds.parse(optarg)) {
+          fprintf(stderr, "Invalid threshold %s\n", optarg);
+          exit(1);
+        }
+        break;
       case 'h':
         usage();
         exit(0);
+      case 'd':
+        serve_stdin = true;
+        break;
+      case 'E':
+        eager_load = true;
+        break;
+      case 'S':
+        socket_path = optarg;
+        break;
+      case 'j':
+      {
+        plen = strtol(optarg, &endptr, 10);
+        if (endptr == optarg || plen < 0) {
+          fprintf(stderr, "Number of jobs must be a non-negative integer\n");
+          exit(1);
+        }
+        jobs = plen == 0 ? hardware_threads() : plen;
+        break;
+      }
+      case 'M':
+      {
+        plen = strtol(optarg, &endptr, 10);
+        if (endptr == optarg || plen < 0) {
+          fprintf(stderr, "Module budget must be a non-negative number of MB\n");
+          exit(1);
+        }
+        module_budget = (size_t) plen << 20;
+        break;
+      }
       case 'L':
       {
         analysis_level = atoi(optarg);
@@ -439,26 +1026,78 @@ int main(int argc, char *argv[])
     fprintf(stderr, "Must specify after-revision bitcode file argument\n");
     exit(1);
   }
-  if (optind != argc-1) {
+  bool server = serve_stdin || socket_path != NULL;
+  if (optind != argc - (server ? 0 : 1)) {
     usage();
     exit(1);
   }
-  id_fname = dupstr(argv[optind]);
-  struct timeval ltim;
-  gettimeofday(&ltim, NULL);
-  double lt1 = ltim.tv_sec * 1000.0 + (ltim.tv_usec/1000.0);
-  load(Context, oldmods);
-  load(Context, newmods);
-  gettimeofday(&ltim, NULL);
-  double lt2 = ltim.tv_sec * 1000.0 + (ltim.tv_usec/1000.0);
-  fprintf(stderr, "%.4f ms\n", lt2-lt1);
-
-  struct timeval atim;
-  gettimeofday(&atim, NULL);
-  double at1 = atim.tv_sec * 1000.0 + (atim.tv_usec/1000.0);
-  analyze(id_fname);
-  gettimeofday(&atim, NULL);
-  double at2 = atim.tv_sec * 1000.0 + (atim.tv_usec/1000.0);
-  fprintf(stderr, "%.4f ms\n", at2-at1);
+  if (!server)
+    id_fname = dupstr(argv[optind]);
+  // Several modules are parsed in parallel even for a single job, and
+  // from level 2 on a single job slices and closes DSA on every processor
+  bool threaded = (jobs > 1 || newmods.size() + oldmods.size() > 1 ||
+      analysis_level > 1) && llvm_start_multithreaded();
+  if (jobs > 1 && !threaded) {
+    fprintf(stderr, "Warning: LLVM is built without thread support, fall back to one job\n");
+    jobs = 1;
+  }
+  if (threaded) {
+    load_threads = jobs > 1 ? jobs : hardware_threads();
+    // the -j workers already keep the processors busy
+    slice_threads = jobs > 1 ? 1 : hardware_threads();
+  }
+  // Set before any worker runs the DSA passes
+  DSAThreads = slice_threads;
+  llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
+  PassRegistry &Registry = *PassRegistry::getPassRegistry();
+  initPassRegistry(Registry);
+
+  double lt1 = now();
+  vector<ModuleArg *> before;
+  for (vector<ModuleArg>::iterator it = oldmods.begin(), ie = oldmods.end(); 
+      it != ie; ++it)
+    before.push_back(&*it);
+  vector<LLVMContext *> contexts;
+  load(before, contexts);
+  module_contexts.insert(module_contexts.end(), contexts.begin(), contexts.end());
+  buildRouter(); // the other modules are loaded by the first chapter they own
+  if (jobs > 1 && server) // create them before the first request comes in
+    setupWorkspaces(jobs);
+  fprintf(stderr, "%.4f ms\n", now() - lt1);
+
+  if (socket_path)
+    serve_socket(socket_path);
+  else if (serve_stdin)
+    serve(stdin, stdout);
+  else {
+    double at1 = now();
+    analyze(id_fname, stdout);
+    fprintf(stderr, "%.4f ms\n", now() - at1);
+    saveAnalysisCache();
+  }
+  reportModuleCache();
+  reportSlicer();
+  if (main_ws.modules == NULL) { // no request came in to adopt them
+    for (vector<ModuleArg>::iterator it = newmods.begin(), ie = newmods.end();
+        it != ie; ++it) {
+      if (it->module == NULL)
+        continue;
+      LLVMContext * context = &it->module->getContext();
+      delete it->module;
+      delete context;
+    }
+  }
+  clearModuleState(main_ws);
+  releaseWorkspaces();
+  if (XCM)
+    delete XCM;
+  if (main_ws.profile)
+    delete main_ws.profile;
+  if (main_ws.analysis)
+    delete main_ws.analysis;
+  delete router;
+  for (vector<LLVMContext *>::iterator ci = module_contexts.begin(), 
+      ce = module_contexts.end(); ci != ce; ++ci)
+    delete *ci; // along with its module
   return 0;
 }
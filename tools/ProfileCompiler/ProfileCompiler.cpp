@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "commons/handy.h"
+#include "commons/LLVMHelper.h"
+#include "commons/ProfileDB.h"
+
+using namespace std;
+using namespace llvm;
+
+static char * program_name;
+
+static bool dump = false;
+
+/// Write db in the text format of parseProfile
+bool dumpProfileDB(const ProfileDB & db, FILE * fout)
+{
+  for (int i = SYSCALL; i <= SAMPLED; i++) {
+    SpeFuncType type = (SpeFuncType) i;
+    vector<pair<string, unsigned> > names;
+    for (unsigned s = 0; s < db.slot_size(); ++s) {
+      if (db.slot_mask(s) & SPEMASK(type))
+        names.push_back(make_pair(db.slot_name(s).str(), s));
+    }
+    if (names.empty())
+      continue;
+    sort(names.begin(), names.end());
+    fprintf(fout, "%s\n%s\n%s\n", PROFILE_SEGMENT_BEGIN, toSpeFuncName(type), 
+        PROFILE_SEGMENT_END);
+    for (vector<pair<string, unsigned> >::iterator it = names.begin(), 
+        ie = names.end(); it != ie; ++it) {
+      fprintf(fout, "%s", it->first.c_str());
+      FuncWeight w = db.slot_weight(it->second);
+      if (!w.empty())
+        fprintf(fout, "\t%llu\t%llu\t%llu", (unsigned long long) w.self,
+            (unsigned long long) w.inclusive, (unsigned long long) w.calls);
+      fprintf(fout, "\n");
+    }
+  }
+  return true;
+}
+
+static char const * option_help[] = {
+  "-d\n\tDump the database INPUT to the text profile OUTPUT. OUTPUT - means stdout.",
+  "-h\n\tPrint this message.",
+  0
+};
+
+static char const * option_example[] = {
+  "data/mysql.profile mysql.profile.db",
+  "-d mysql.profile.db -",
+  0
+};
+
+void usage(FILE *fp = stderr)
+{
+  const char **p = option_help;
+  fprintf(fp, "Compile a text profile into a binary profile database\n\n");
+  fprintf(fp, "Usage: %s [OPTIONS] INPUT OUTPUT\n\n", program_name);
+  while (*p) {
+    fprintf(fp, "  %s\n\n", *p);
+    p++;
+  }
+  p = option_example;
+  fprintf(fp, "Examples:\n\n");
+  while (*p) {
+    fprintf(fp, "  %s %s\n\n", program_name, *p);
+    p++;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  program_name = argv[0];
+
+  if (argc <= 1) {
+    usage();
+    exit(1);
+  }
+  int opt;
+  while((opt = getopt(argc, argv, "dh")) != -1) {
+    switch(opt) {
+      case 'd':
+        dump = true;
+        break;
+      case 'h':
+        usage();
+        exit(0);
+      case '?':
+      default:
+        usage();
+        exit(1);
+    }
+  }
+  if (optind != argc - 2) {
+    usage();
+    exit(1);
+  }
+  const char * input = argv[optind];
+  const char * output = argv[optind + 1];
+
+  if (dump) {
+    ProfileDB db;
+    if (!db.open(input))
+      exit(1);
+    FILE * fout = stdout;
+    if (strcmp(output, "-") != 0) {
+      fout = fopen(output, "w");
+      if (fout == NULL) {
+        perror("Output must be a file");
+        exit(1);
+      }
+    }
+    dumpProfileDB(db, fout);
+    if (fout != stdout)
+      fclose(fout);
+    return 0;
+  }
+
+  Profile profile;
+  ProfileWeights weights;
+  if (!parseProfile(input, profile, &weights)) {
+    fprintf(stderr, "Ill-formated profile.\n");
+    exit(1);
+  }
+  if (!writeProfileDB(output, profile, &weights))
+    exit(1);
+  return 0;
+}
@@ -39,6 +39,8 @@
 
 #include "commons/handy.h"
 #include "commons/CallSiteFinder.h"
+#include "commons/ProfileDB.h"
+#include "analyzer/AnalysisCache.h"
 #include "analyzer/Evaluator.h"
 #include "analyzer/X86CostModel.h"
 
@@ -55,6 +57,9 @@ static int topk_cost = TOPKCOSTFUNCS;
 static int topk_hot = TOPKHOTFUNCS;
 
 FILE * fout = stdout;
+char * dbname = NULL; // write a profile database instead of text
+char * cache_fname = NULL; // function costs kept across runs
+AnalysisCache * analysis = NULL;
 
 bool detail = false;
 bool printall = false;
@@ -121,7 +126,7 @@ void static_profile(Module * module, CostModel * model)
       continue;
     const char * name = cpp_demangle(F->getName().data());
     // Calculate cost
-    unsigned cost = model->getFunctionCost(F);
+    unsigned cost = analysis ? analysis->functionCost(F, model) : model->getFunctionCost(F);
     if (cost == (unsigned) -1)
       cost = 0;
     func_cost[i].cost = cost;
@@ -132,28 +137,54 @@ void static_profile(Module * module, CostModel * model)
     func_hot[i].hotness = finder.size();
     func_hot[i].name.assign(name);
   } 
-  // Print cost
+  qsort(func_cost, size, sizeof(FuncCost), compareFuncCost);
+  qsort(func_hot, size, sizeof(FuncHot), compareFuncHot);
+  size_t k = (!printall && topk_cost > 0) ? topk_cost : size;
+  if (k > size)
+    k = size;
+  size_t kh = (!printall && topk_hot > 0) ? topk_hot: size;
+  if (kh > size)
+    kh = size;
+  if (dbname) {
+    Profile profile;
+    ProfileWeights weights;
+    for (i = 0; i < k; i++) {
+      profile[EXPCALL].push_back(func_cost[i].name);
+      if (detail)
+        weights[func_cost[i].name].merge(FuncWeight(0, func_cost[i].cost, 0));
+    }
+    for (i = 0; i < kh; i++) {
+      profile[FREQCALL].push_back(func_hot[i].name);
+      if (detail)
+        weights[func_hot[i].name].merge(FuncWeight(0, 0, func_hot[i].hotness));
+    }
+    if (!writeProfileDB(dbname, profile, detail ? &weights : NULL))
+      exit(1);
+    delete [] func_cost;
+    delete [] func_hot;
+    return;
+  }
+  // Print cost. Details are written as profile weights: the static
+  // cost is the inclusive cost, with no self samples so that it is not
+  // taken for a call frequency, and the number of call sites stands in
+  // for the number of calls.
   fprintf(fout, "====\n");
   fprintf(fout, "EXPCALL\n");
   fprintf(fout, "====\n");
-  qsort(func_cost, size, sizeof(FuncCost), compareFuncCost);
-  size_t k = (!printall && topk_cost > 0) ? topk_cost : size;
   for (i = 0; i < k ; i++) {
     fprintf(fout, "%s", func_cost[i].name.c_str());
     if (detail)
-      fprintf(fout, ": %u", func_cost[i].cost);
+      fprintf(fout, "\t0\t%u", func_cost[i].cost);
     fprintf(fout, "\n");
   }
   // Print hot
   fprintf(fout, "====\n");
   fprintf(fout, "FREQCALL\n");
   fprintf(fout, "====\n");
-  qsort(func_hot, size, sizeof(FuncHot), compareFuncHot);
-  k = (!printall && topk_hot > 0) ? topk_hot: size;
-  for (i = 0; i < k; i++) {
+  for (i = 0; i < kh; i++) {
     fprintf(fout, "%s", func_hot[i].name.c_str());
     if (detail)
-      fprintf(fout, ": %u", func_hot[i].hotness);
+      fprintf(fout, "\t0\t0\t%u", func_hot[i].hotness);
     fprintf(fout, "\n");
   }
   delete [] func_cost;
@@ -162,8 +193,10 @@ void static_profile(Module * module, CostModel * model)
 
 static char const * option_help[] = {
   "-o FILE\n\tOutput the generated profile to FILE file.",
+  "-b FILE\n\tOutput the generated profile as a binary database to FILE.",
   "-a\n\tPrint all cost/hotness functions. Equivalent to `-m -1 -n -1`",
-  "-d\n\tInclude the cost/hotness detail along with the function name",
+  "-C FILE\n\tKeep function costs in FILE across runs, see perfscope -C.",
+  "-d\n\tInclude the cost/hotness detail along with the function name as profile weights",
   "-n NUM\n\tThe top NUM expensive functions to be printed.\n\tDefault 50. Negative NUM means print all.",
   "-m NUM\n\tThe top NUM hot functions to be printed.\n\tDefault 50. Negative NUM means print all.",
   "-h\n\tPrint this message.",
@@ -173,6 +206,8 @@ static char const * option_help[] = {
 static char const * option_example[] = {
   "-o mysql.profile -m 100 -n 100 mysqld.bc",
   "-o mysql.profile.all -a mysqld.bc",
+  "-b mysql.profile.db -m 100 -n 100 mysqld.bc",
+  0
 };
 
 void usage(FILE *fp = stderr)
@@ -202,8 +237,14 @@ int main(int argc, char *argv[])
   }
   int opt;
   char *endptr;
-  while((opt = getopt(argc, argv, "adn:m:o:h")) != -1) {
+  while((opt = getopt(argc, argv, "ab:C:dn:m:o:h")) != -1) {
     switch(opt) {
+      case 'b':
+        dbname = optarg;
+        break;
+      case 'C':
+        cache_fname = optarg;
+        break;
       case 'd':
         detail = true;
         break;
@@ -258,8 +299,19 @@ int main(int argc, char *argv[])
   PassRegistry &Registry = *PassRegistry::getPassRegistry();
   initPassRegistry(Registry);
 
+  if (cache_fname) {
+    analysis = new AnalysisCache();
+    if (!analysis->load(cache_fname))
+      fprintf(stderr, "Warning: ignoring analysis cache %s\n", cache_fname);
+  }
   X86CostModel * XCM = new X86CostModel(getTargetMachine());
   static_profile(module, XCM);
+  if (analysis) {
+    profile_debug("analysis cache: %u hits, %u misses\n", analysis->hits, analysis->misses);
+    analysis->forget();
+    analysis->save(cache_fname);
+    delete analysis;
+  }
   if (XCM == NULL)
     delete XCM;
   return 0;